@@ -1,3 +1,4 @@
+#include "ColorspaceConversion.h"
 
 #define MAX3(a, b, c) a > b ? (a > c ? a : c) : (b > c ? b : c)
 #define MIN3(a, b, c) a < b ? (a < c ? a : c) : (b < c ? b : c)
@@ -36,7 +37,7 @@ void RGBtoHSV(unsigned char R, unsigned char G, unsigned char B, unsigned char &
 			h = (g - b) * 256 / delta;
 		else if(g == max)
 			h = (b - r) * 256 / delta + 2 * 256;
-		else if(b == max)
+		else
 			h = (r - g) * 256 / delta + 4 * 256;
 		
 		// h is in the range (-6 to 6) * 256
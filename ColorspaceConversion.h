@@ -1,18 +1,19 @@
 #ifndef _ColorspaceConversion_included
 #define _ColorspaceConversion_included
+#include "msaExport.h"
 
-void RGBtoHSV(unsigned char R, unsigned char G, unsigned char B, unsigned char &H, unsigned char &S, unsigned char &V);
-void HSVtoRGB(unsigned char H, unsigned char S, unsigned char V, unsigned char &R, unsigned char &G, unsigned char &B);
+MSA_API void RGBtoHSV(unsigned char R, unsigned char G, unsigned char B, unsigned char &H, unsigned char &S, unsigned char &V);
+MSA_API void HSVtoRGB(unsigned char H, unsigned char S, unsigned char V, unsigned char &R, unsigned char &G, unsigned char &B);
 
-void RGBtoYCbCr(unsigned char R, unsigned char G, unsigned char B, unsigned char *Y, unsigned char *Cb, unsigned char *Cr); 
-void YCbCrtoRGB(unsigned char Y, unsigned char Cb, unsigned char Cr, unsigned char &R, unsigned char &G, unsigned char &B);
+MSA_API void RGBtoYCbCr(unsigned char R, unsigned char G, unsigned char B, unsigned char *Y, unsigned char *Cb, unsigned char *Cr); 
+MSA_API void YCbCrtoRGB(unsigned char Y, unsigned char Cb, unsigned char Cr, unsigned char &R, unsigned char &G, unsigned char &B);
 
-void RGBtoYIQ(unsigned char R, unsigned char G, unsigned char B, unsigned char &Y, unsigned char &I, unsigned char &Q);
-void YIQtoRGB(unsigned char Y, unsigned char I, unsigned char Q, unsigned char &R, unsigned char &G, unsigned char &B);
+MSA_API void RGBtoYIQ(unsigned char R, unsigned char G, unsigned char B, unsigned char &Y, unsigned char &I, unsigned char &Q);
+MSA_API void YIQtoRGB(unsigned char Y, unsigned char I, unsigned char Q, unsigned char &R, unsigned char &G, unsigned char &B);
 
-extern unsigned char RedToGray[];
-extern unsigned char GreenToGray[];
-extern unsigned char BlueToGray[];
+extern MSA_API unsigned char RedToGray[];
+extern MSA_API unsigned char GreenToGray[];
+extern MSA_API unsigned char BlueToGray[];
 
 inline unsigned char RGBtoGray(unsigned char r, unsigned char g, unsigned char b)
 {
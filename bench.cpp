@@ -0,0 +1,757 @@
+/*
+	imgbench - times the public msaImage and msaFilters operations on synthetic images
+
+	usage: imgbench [options]
+		--sizes WxH[,WxH...]	image sizes to run, default 640x480,1920x1080
+		--depths d[,d...]		depths to run, default 8,24,32; 1, 16, 48, 64 and f32, f96, f128
+								for float are also available, or "all" for every depth
+		--runs n				timed runs of each operation, default 10
+		--warmup n				untimed runs of each operation first, default 2
+		--filter text			only run operations whose name contains text
+		--csv					print comma separated values instead of a table
+		--json					print a JSON array instead of a table
+		--profile				dump the library's profiling counters as JSON to stderr at the end;
+								the library must be built with -DMSA_PROFILE
+
+	The SIMD kernels are the best the CPU supports, set MSA_ISA to compare lower levels, see
+	msaDispatch.h.  Each operation is run on every size and depth; operations that don't support a depth throw on
+	the first warmup run and are skipped.  Timings are wall clock, reported as min, median, p95
+	and mean microseconds, plus megapixels per second at the median.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+#include "msaImage.h"
+#include "msaFilters.h"
+#include "msaEdges.h"
+#include "msaPyramid.h"
+#include "msaProfile.h"
+#include "msaDispatch.h"
+
+using namespace std;
+
+// microseconds since some arbitrary point, from a clock that never goes backwards
+static double Now()
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchOptions
+{
+	vector<pair<int, int> > sizes;
+	vector<string> depths;
+	int runs;
+	int warmup;
+	string filter;
+	bool profile;
+	enum { Table, CSV, JSON } format;
+};
+
+struct BenchResult
+{
+	string name;
+	string depth;
+	int width;
+	int height;
+	int runs;
+	double min;
+	double median;
+	double p95;
+	double mean;
+};
+
+// everything an operation might need, created once per size and depth so only the operation is timed
+struct BenchImages
+{
+	int width;
+	int height;
+	int depth;
+	bool isFloat;
+	msaImage image;		// the image under test
+	msaImage other;		// a second image of the same depth for the combination ops
+	msaImage output;
+	msaImage work;		// copy of image for the in place overlay functions
+	msaImage planar;
+	msaImage red, green, blue, alpha;
+	msaImage mask;
+	msaAffineTransform transform;
+	msaPixel color;
+	msaPixel colorMap[256];
+	unsigned char brightnessMap[256];
+};
+
+// repeatable noise so runs are comparable from build to build
+static unsigned int benchSeed = 12345;
+static unsigned char NextNoise()
+{
+	benchSeed = benchSeed * 1103515245 + 12345;
+	return (unsigned char)(benchSeed >> 16);
+}
+
+// fill an 8 bit per channel image with a gradient plus noise, so filters see real structure
+static void FillSynthetic(msaImage &image, int width, int height, int depth)
+{
+	image.CreateImage(width, height, depth);
+	int samples = width * depth / 8;
+	for(int y = 0; y < height; ++y)
+	{
+		unsigned char *line = &image.Data()[y * image.BytesPerLine()];
+		for(int x = 0; x < samples; ++x)
+			line[x] = (unsigned char)(((x * 3 + y * 2) & 0xFF) / 2 + NextNoise() / 2);
+	}
+}
+
+// make a synthetic image of any supported depth, going through the matching 8 bit depth
+static void MakeImage(msaImage &image, int width, int height, const string &depthName)
+{
+	msaPixel white = { 255, 255, 255, 255 };
+	bool isFloat = depthName[0] == 'f';
+	int depth = atoi(depthName.c_str() + (isFloat ? 1 : 0));
+
+	if(isFloat)
+	{
+		msaImage base;
+		FillSynthetic(base, width, height, depth / 4);
+		base.ToFloat(image);
+	}
+	else if(depth == 1)
+	{
+		msaImage base;
+		FillSynthetic(base, width, height, 8);
+		base.Threshold(128, image);
+	}
+	else if(depth == 16 || depth == 48 || depth == 64)
+	{
+		msaImage base;
+		FillSynthetic(base, width, height, depth / 2);
+		base.SimpleConvert(depth, white, image);
+	}
+	else
+		FillSynthetic(image, width, height, depth);
+}
+
+static void SetupImages(BenchImages &images, int width, int height, const string &depthName)
+{
+	images.width = width;
+	images.height = height;
+	images.isFloat = depthName[0] == 'f';
+	images.depth = atoi(depthName.c_str() + (images.isFloat ? 1 : 0));
+
+	MakeImage(images.image, width, height, depthName);
+	MakeImage(images.other, width, height, depthName);
+
+	images.color.r = 255;
+	images.color.g = 200;
+	images.color.b = 150;
+	images.color.a = 255;
+
+	for(int i = 0; i < 256; ++i)
+	{
+		images.colorMap[i].r = (unsigned char)i;
+		images.colorMap[i].g = (unsigned char)(255 - i);
+		images.colorMap[i].b = (unsigned char)(i / 2);
+		images.colorMap[i].a = 255;
+		images.brightnessMap[i] = (unsigned char)(255 - i);
+	}
+
+	// a few degrees of rotation, which exercises the interpolation everywhere
+	images.transform.SetTransform(1.0, DegreesToRadians(10.0), width, height);
+
+	FillSynthetic(images.red, width, height, 8);
+	FillSynthetic(images.green, width, height, 8);
+	FillSynthetic(images.blue, width, height, 8);
+	FillSynthetic(images.alpha, width, height, 8);
+	FillSynthetic(images.mask, width, height, 8);
+
+	// the planar copy only exists for depths that can be planar
+	try
+	{
+		images.image.ToPlanar(images.planar);
+	}
+	catch(const char *)
+	{
+	}
+}
+
+struct BenchOperation
+{
+	string name;
+	function<void(BenchImages &)> run;
+};
+
+static void AddFilter(vector<BenchOperation> &ops, const char *name, msaFilters::FilterType type, int size)
+{
+	char fullName[64];
+	snprintf(fullName, sizeof(fullName), "filter/%s/%dx%d", name, size, size);
+
+	ops.push_back({ fullName, [type, size](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetType(type, size, size);
+		filter.FilterImage(images.image, images.output);
+	}});
+}
+
+static vector<BenchOperation> GetOperations()
+{
+	vector<BenchOperation> ops;
+
+	const char *qualities[3] = { "fast", "better", "best" };
+	for(int q = 0; q < 3; ++q)
+	{
+		int quality = q * 50;
+		ops.push_back({ string("transform/") + qualities[q], [quality](BenchImages &images)
+		{
+			images.image.TransformImage(images.transform, images.output, quality);
+		}});
+	}
+	// a quarter size by whole blocks, a thumbnail, and an enlargement
+	ops.push_back({ "resize/area/quarter", [](BenchImages &images)
+	{
+		images.image.Resize(images.image.Width() / 4, images.image.Height() / 4, msaImage::ResizeFilter::Area,
+				images.output);
+	}});
+	ops.push_back({ "resize/lanczos3/thumb", [](BenchImages &images)
+	{
+		images.image.Resize(320, 180, msaImage::ResizeFilter::Lanczos3, images.output);
+	}});
+	ops.push_back({ "resize/lanczos3/up1.5", [](BenchImages &images)
+	{
+		images.image.Resize(images.image.Width() * 3 / 2, images.image.Height() * 3 / 2,
+				msaImage::ResizeFilter::Lanczos3, images.output);
+	}});
+
+	int sizes[3] = { 3, 5, 9 };
+	for(int s = 0; s < 3; ++s)
+	{
+		AddFilter(ops, "gaussian", msaFilters::FilterType::Gaussian, sizes[s]);
+		AddFilter(ops, "sharpen", msaFilters::FilterType::Sharpen, sizes[s]);
+		AddFilter(ops, "dilate", msaFilters::FilterType::Dilate, sizes[s]);
+		AddFilter(ops, "erode", msaFilters::FilterType::Erode, sizes[s]);
+		AddFilter(ops, "median", msaFilters::FilterType::Median, sizes[s]);
+		AddFilter(ops, "box", msaFilters::FilterType::Box, sizes[s]);
+
+		// the same mean done as a plain convolution, for comparison
+		int size = sizes[s];
+		char name[64];
+		snprintf(name, sizeof(name), "filter/uniform/%dx%d", size, size);
+		ops.push_back({ name, [size](BenchImages &images)
+		{
+			vector<int> values(size * size, 1);
+			msaFilters filter;
+			filter.SetUserDefined(&values[0], size, size, size / 2, size / 2, size * size);
+			filter.FilterImage(images.image, images.output);
+		}});
+	}
+
+	// large enough that only the running sums keep it cheap
+	AddFilter(ops, "box", msaFilters::FilterType::Box, 31);
+
+	// a border mode other than clamp, which should cost the same
+	ops.push_back({ "filter/gaussian/5x5/reflect", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetType(msaFilters::FilterType::Gaussian, 5, 5);
+		filter.SetBorderMode(msaFilters::BorderMode::Reflect);
+		filter.FilterImage(images.image, images.output);
+	}});
+
+	// the other color medians
+	ops.push_back({ "filter/median/5x5/perchannel", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetType(msaFilters::FilterType::Median, 5, 5);
+		filter.SetMedianMode(msaFilters::MedianMode::PerChannel);
+		filter.FilterImage(images.image, images.output);
+	}});
+	ops.push_back({ "filter/median/5x5/vector", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetType(msaFilters::FilterType::Median, 5, 5);
+		filter.SetMedianMode(msaFilters::MedianMode::Vector);
+		filter.FilterImage(images.image, images.output);
+	}});
+
+	// disks of radius 15, as dilate and erode by a 31x31 window would be far too slow
+	ops.push_back({ "filter/dilate/disk31", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Dilate, msaFilters::ElementShape::Disk, 31, 31);
+		filter.FilterImage(images.image, images.output);
+	}});
+	ops.push_back({ "filter/erode/disk31", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Erode, msaFilters::ElementShape::Disk, 31, 31);
+		filter.FilterImage(images.image, images.output);
+	}});
+
+	// unsharp masks, which cost the same at any radius, to compare with the sharpen kernels
+	double radii[2] = { 2.0, 20.0 };
+	for(int r = 0; r < 2; ++r)
+	{
+		double radius = radii[r];
+		char name[64];
+		snprintf(name, sizeof(name), "filter/unsharp/r%g", radius);
+		ops.push_back({ name, [radius](BenchImages &images)
+		{
+			msaFilters filter;
+			filter.SetUnsharpMask(1.0, radius, 4.0);
+			filter.FilterImage(images.image, images.output);
+		}});
+	}
+
+	// bilateral filters: the grid gets cheaper as the sigmas grow, the exact one costs the window
+	ops.push_back({ "filter/bilateral/grid/s4r20", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetBilateral(4.0, 20.0);
+		filter.FilterImage(images.image, images.output);
+	}});
+	ops.push_back({ "filter/bilateral/exact/s2r20", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetBilateral(2.0, 20.0);
+		filter.SetBilateralMethod(msaFilters::BilateralMethod::Exact);
+		filter.FilterImage(images.image, images.output);
+	}});
+
+	// background subtraction sized top-hats, and an opening
+	ops.push_back({ "filter/tophat/disk31", [](BenchImages &images)
+	{
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::TopHat, msaFilters::ElementShape::Disk, 31, 31);
+		filter.FilterImage(images.image, images.output);
+	}});
+	AddFilter(ops, "open", msaFilters::FilterType::Open, 9);
+
+	// fixed point, at 14 bits, which only turns the divide into a shift, and at 8, where the
+	//  sums fit 16 bits
+	static const int fixedBits[] = { 14, 8 };
+	for(int b = 0; b < 2; ++b)
+	{
+		int bits = fixedBits[b];
+		char name[64];
+		snprintf(name, sizeof(name), "filter/gaussian/5x5/fixed%d", bits);
+		ops.push_back({ name, [bits](BenchImages &images)
+		{
+			msaFilters filter;
+			filter.SetType(msaFilters::FilterType::Gaussian, 5, 5);
+			filter.SetFixedPoint(bits);
+			filter.FilterImage(images.image, images.output);
+		}});
+	}
+
+	// a large arbitrary kernel, which goes through FFTs, and the same done spatially
+	for(int spatial = 0; spatial < 2; ++spatial)
+	{
+		ops.push_back({ spatial ? "filter/user/31x31/spatial" : "filter/user/31x31", [spatial](BenchImages &images)
+		{
+			vector<int> values(31 * 31);
+			for(int i = 0; i < 31 * 31; ++i)
+				values[i] = (i * 7) % 11 - 3;
+			msaFilters filter;
+			filter.SetUserDefined(&values[0], 31, 31, 15, 15, 0);
+			if(spatial)
+				filter.SetConvolutionMethod(msaFilters::ConvolutionMethod::Spatial);
+			filter.FilterImage(images.image, images.output);
+		}});
+	}
+
+	// background estimation sized blurs, only practical recursively
+	AddFilter(ops, "recursivegaussian", msaFilters::FilterType::RecursiveGaussian, 9);
+	double sigmas[2] = { 50.0, 200.0 };
+	for(int s = 0; s < 2; ++s)
+	{
+		double sigma = sigmas[s];
+		char name[64];
+		snprintf(name, sizeof(name), "filter/recursivegaussian/sigma%g", sigma);
+		ops.push_back({ name, [sigma](BenchImages &images)
+		{
+			msaFilters filter;
+			filter.SetRecursiveGaussian(sigma, sigma);
+			filter.FilterImage(images.image, images.output);
+		}});
+	}
+
+	ops.push_back({ "convert/to8", [](BenchImages &images) { images.image.SimpleConvert(8, images.color, images.output); }});
+	ops.push_back({ "convert/to24", [](BenchImages &images) { images.image.SimpleConvert(24, images.color, images.output); }});
+	ops.push_back({ "convert/to32", [](BenchImages &images) { images.image.SimpleConvert(32, images.color, images.output); }});
+	ops.push_back({ "convert/threshold", [](BenchImages &images) { images.image.Threshold(128, images.output); }});
+	ops.push_back({ "convert/threshold/adaptive", [](BenchImages &images)
+	{
+		images.image.AdaptiveThreshold(31, 31, 8, images.output);
+	}});
+	ops.push_back({ "convert/threshold/sauvola", [](BenchImages &images)
+	{
+		images.image.SauvolaThreshold(31, 31, 0.3, images.output);
+	}});
+	ops.push_back({ "edges/gradients", [](BenchImages &images)
+	{
+		msaEdges edges;
+		msaImage gx, gy, magnitude, orientation;
+		edges.Gradients(images.image, gx, gy, magnitude, orientation);
+	}});
+	ops.push_back({ "edges/canny", [](BenchImages &images)
+	{
+		msaEdges edges;
+		edges.Canny(images.image, images.output, 40.0, 100.0);
+	}});
+	// whole pyramids down to 1 by 1, and collapsing a Laplacian one back up
+	ops.push_back({ "pyramid/gaussian", [](BenchImages &images)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(images.image, msaPyramid::PyramidType::Gaussian);
+	}});
+	ops.push_back({ "pyramid/laplacian", [](BenchImages &images)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(images.image, msaPyramid::PyramidType::Laplacian);
+	}});
+	ops.push_back({ "pyramid/laplacian/reconstruct", [](BenchImages &images)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(images.image, msaPyramid::PyramidType::Laplacian);
+		pyramid.Reconstruct(images.output);
+	}});
+	ops.push_back({ "convert/tofloat", [](BenchImages &images) { images.image.ToFloat(images.output); }});
+	ops.push_back({ "convert/fromfloat", [](BenchImages &images)
+	{
+		images.image.FromFloat(images.depth / 4, images.output);
+	}});
+	ops.push_back({ "convert/toplanar", [](BenchImages &images) { images.image.ToPlanar(images.output); }});
+	ops.push_back({ "convert/tointerleaved", [](BenchImages &images)
+	{
+		if(!images.planar.Planar())
+			throw "No planar image";
+		images.planar.ToInterleaved(images.output);
+	}});
+	ops.push_back({ "colormap", [](BenchImages &images) { images.image.ColorMap(images.colorMap, images.output); }});
+	ops.push_back({ "remapbrightness", [](BenchImages &images)
+	{
+		images.image.RemapBrightness(images.brightnessMap, images.output);
+	}});
+	ops.push_back({ "addalpha", [](BenchImages &images) { images.image.AddAlphaChannel(images.alpha, images.output); }});
+
+	// the compose functions build their output from 8 bit planes, so only run them once per size
+	ops.push_back({ "compose/rgb", [](BenchImages &images)
+	{
+		if(images.depth != 24 || images.isFloat)
+			throw "Compose runs with the 24 bit images";
+		images.output.ComposeRGB(images.red, images.green, images.blue);
+	}});
+	ops.push_back({ "compose/rgba", [](BenchImages &images)
+	{
+		if(images.depth != 32 || images.isFloat)
+			throw "Compose runs with the 32 bit images";
+		images.output.ComposeRGBA(images.red, images.green, images.blue, images.alpha);
+	}});
+	ops.push_back({ "compose/hsv", [](BenchImages &images)
+	{
+		if(images.depth != 24 || images.isFloat)
+			throw "Compose runs with the 24 bit images";
+		images.output.ComposeHSV(images.red, images.green, images.blue);
+	}});
+	ops.push_back({ "compose/hsva", [](BenchImages &images)
+	{
+		if(images.depth != 32 || images.isFloat)
+			throw "Compose runs with the 32 bit images";
+		images.output.ComposeHSVA(images.red, images.green, images.blue, images.alpha);
+	}});
+	ops.push_back({ "split/rgb", [](BenchImages &images)
+	{
+		images.image.SplitRGB(images.red, images.green, images.blue);
+	}});
+	ops.push_back({ "split/rgba", [](BenchImages &images)
+	{
+		images.image.SplitRGBA(images.red, images.green, images.blue, images.alpha);
+	}});
+	ops.push_back({ "split/hsv", [](BenchImages &images)
+	{
+		images.image.SplitHSV(images.red, images.green, images.blue);
+	}});
+	ops.push_back({ "split/hsva", [](BenchImages &images)
+	{
+		images.image.SplitHSVA(images.red, images.green, images.blue, images.alpha);
+	}});
+
+	ops.push_back({ "combine/min", [](BenchImages &images) { images.image.MinImages(images.other, images.output); }});
+	ops.push_back({ "combine/max", [](BenchImages &images) { images.image.MaxImages(images.other, images.output); }});
+	ops.push_back({ "combine/sum", [](BenchImages &images) { images.image.SumImages(images.other, images.output); }});
+	ops.push_back({ "combine/diff", [](BenchImages &images) { images.image.DiffImages(images.other, images.output); }});
+	ops.push_back({ "combine/multiply", [](BenchImages &images)
+	{
+		images.image.MultiplyImages(images.other, images.output);
+	}});
+	ops.push_back({ "combine/divide", [](BenchImages &images) { images.image.DivideImages(images.other, images.output); }});
+
+	// overlay works in place, so overlay the second image over the whole of a work copy
+	ops.push_back({ "overlay", [](BenchImages &images)
+	{
+		if(images.work.Data() == NULL)
+			images.work.SetCopyData(images.width, images.height, images.image.BytesPerLine(), images.image.Depth(),
+					images.image.Data());
+		images.work.OverlayImage(images.other, 0, 0, images.width, images.height);
+	}});
+	ops.push_back({ "overlay/mask", [](BenchImages &images)
+	{
+		if(images.work.Data() == NULL)
+			images.work.SetCopyData(images.width, images.height, images.image.BytesPerLine(), images.image.Depth(),
+					images.image.Data());
+		images.work.OverlayImage(images.other, images.mask, 0, 0, images.width, images.height);
+	}});
+
+	return ops;
+}
+
+static double Percentile(const vector<double> &sorted, double fraction)
+{
+	int index = (int)ceil(fraction * sorted.size()) - 1;
+	if(index < 0) index = 0;
+	if(index >= (int)sorted.size()) index = sorted.size() - 1;
+	return sorted[index];
+}
+
+// run one operation, returns false if it doesn't support this image
+static bool RunOperation(BenchOperation &op, BenchImages &images, const BenchOptions &options, BenchResult &result)
+{
+	// the first warmup run also finds out whether the operation supports the depth at all
+	try
+	{
+		for(int i = 0; i < max(options.warmup, 1); ++i)
+			op.run(images);
+	}
+	catch(const char *)
+	{
+		return false;
+	}
+
+	vector<double> times(options.runs);
+	for(int i = 0; i < options.runs; ++i)
+	{
+		double start = Now();
+		op.run(images);
+		times[i] = Now() - start;
+	}
+	sort(times.begin(), times.end());
+
+	double total = 0.0;
+	for(int i = 0; i < options.runs; ++i)
+		total += times[i];
+
+	result.name = op.name;
+	result.width = images.width;
+	result.height = images.height;
+	result.runs = options.runs;
+	result.min = times[0];
+	result.median = options.runs % 2 == 1 ? times[options.runs / 2] :
+		(times[options.runs / 2 - 1] + times[options.runs / 2]) / 2.0;
+	result.p95 = Percentile(times, 0.95);
+	result.mean = total / options.runs;
+	return true;
+}
+
+static double MegapixelsPerSecond(const BenchResult &result)
+{
+	if(result.median <= 0.0)
+		return 0.0;
+	return (double)result.width * result.height / result.median;
+}
+
+static void PrintResult(const BenchResult &result, const BenchOptions &options, bool first)
+{
+	switch(options.format)
+	{
+	case BenchOptions::Table:
+		printf("%-26s %5s %10s %11.1f %11.1f %11.1f %11.1f %9.1f\n", result.name.c_str(), result.depth.c_str(),
+				(to_string(result.width) + "x" + to_string(result.height)).c_str(), result.min, result.median,
+				result.p95, result.mean, MegapixelsPerSecond(result));
+		break;
+	case BenchOptions::CSV:
+		printf("%s,%s,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.2f\n", result.name.c_str(), result.depth.c_str(), result.width,
+				result.height, result.runs, result.min, result.median, result.p95, result.mean,
+				MegapixelsPerSecond(result));
+		break;
+	case BenchOptions::JSON:
+		printf("%s\n  {\"operation\": \"%s\", \"depth\": \"%s\", \"width\": %d, \"height\": %d, \"runs\": %d, "
+				"\"min_us\": %.1f, \"median_us\": %.1f, \"p95_us\": %.1f, \"mean_us\": %.1f, \"mpixels_per_s\": %.2f}",
+				first ? "" : ",", result.name.c_str(), result.depth.c_str(), result.width, result.height, result.runs,
+				result.min, result.median, result.p95, result.mean, MegapixelsPerSecond(result));
+		break;
+	}
+	fflush(stdout);
+}
+
+static void PrintHeader(const BenchOptions &options)
+{
+	switch(options.format)
+	{
+	case BenchOptions::Table:
+		printf("kernels: %s (detected %s)\n", msaDispatch::Name(msaDispatch::Active()),
+				msaDispatch::Name(msaDispatch::Detected()));
+		printf("%-26s %5s %10s %11s %11s %11s %11s %9s\n", "operation", "depth", "size", "min us", "median us",
+				"p95 us", "mean us", "Mpix/s");
+		break;
+	case BenchOptions::CSV:
+		printf("operation,depth,width,height,runs,min_us,median_us,p95_us,mean_us,mpixels_per_s\n");
+		break;
+	case BenchOptions::JSON:
+		printf("[");
+		break;
+	}
+}
+
+static void PrintFooter(const BenchOptions &options)
+{
+	if(options.format == BenchOptions::JSON)
+		printf("\n]\n");
+}
+
+static vector<string> SplitList(const char *list)
+{
+	vector<string> items;
+	string item;
+	for(const char *p = list; ; ++p)
+	{
+		if(*p == ',' || *p == 0)
+		{
+			if(!item.empty())
+				items.push_back(item);
+			item.clear();
+			if(*p == 0)
+				break;
+		}
+		else
+			item += *p;
+	}
+	return items;
+}
+
+static void Usage()
+{
+	printf("usage: imgbench [--sizes WxH,...] [--depths d,...|all] [--runs n] [--warmup n] [--filter text]"
+			" [--csv|--json] [--profile]\n");
+}
+
+static bool ParseOptions(int argc, char **argv, BenchOptions &options)
+{
+	options.sizes.push_back(make_pair(640, 480));
+	options.sizes.push_back(make_pair(1920, 1080));
+	options.depths = SplitList("8,24,32");
+	options.runs = 10;
+	options.warmup = 2;
+	options.format = BenchOptions::Table;
+	options.profile = false;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		bool hasValue = i + 1 < argc;
+		if(strcmp(argv[i], "--sizes") == 0 && hasValue)
+		{
+			options.sizes.clear();
+			vector<string> sizes = SplitList(argv[++i]);
+			for(size_t s = 0; s < sizes.size(); ++s)
+			{
+				int w, h;
+				if(sscanf(sizes[s].c_str(), "%dx%d", &w, &h) != 2 || w < 1 || h < 1)
+				{
+					printf("Bad size %s\n", sizes[s].c_str());
+					return false;
+				}
+				options.sizes.push_back(make_pair(w, h));
+			}
+		}
+		else if(strcmp(argv[i], "--depths") == 0 && hasValue)
+		{
+			++i;
+			if(strcmp(argv[i], "all") == 0)
+				options.depths = SplitList("1,8,16,24,32,48,64,f32,f96,f128");
+			else
+				options.depths = SplitList(argv[i]);
+
+			for(size_t d = 0; d < options.depths.size(); ++d)
+			{
+				const string &name = options.depths[d];
+				const char *valid[] = { "1", "8", "16", "24", "32", "48", "64", "f32", "f96", "f128" };
+				if(find(valid, valid + 10, name) == valid + 10)
+				{
+					printf("Bad depth %s\n", name.c_str());
+					return false;
+				}
+			}
+		}
+		else if(strcmp(argv[i], "--runs") == 0 && hasValue)
+			options.runs = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "--warmup") == 0 && hasValue)
+			options.warmup = max(atoi(argv[++i]), 0);
+		else if(strcmp(argv[i], "--filter") == 0 && hasValue)
+			options.filter = argv[++i];
+		else if(strcmp(argv[i], "--csv") == 0)
+			options.format = BenchOptions::CSV;
+		else if(strcmp(argv[i], "--json") == 0)
+			options.format = BenchOptions::JSON;
+		else if(strcmp(argv[i], "--profile") == 0)
+			options.profile = true;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		Usage();
+		return -1;
+	}
+
+	vector<BenchOperation> ops = GetOperations();
+
+	PrintHeader(options);
+	bool first = true;
+
+	for(size_t s = 0; s < options.sizes.size(); ++s)
+	{
+		for(size_t d = 0; d < options.depths.size(); ++d)
+		{
+			BenchImages images;
+			SetupImages(images, options.sizes[s].first, options.sizes[s].second, options.depths[d]);
+
+			for(size_t o = 0; o < ops.size(); ++o)
+			{
+				if(!options.filter.empty() && ops[o].name.find(options.filter) == string::npos)
+					continue;
+
+				BenchResult result;
+				if(!RunOperation(ops[o], images, options, result))
+					continue;
+
+				result.depth = options.depths[d];
+				PrintResult(result, options, first);
+				first = false;
+			}
+		}
+	}
+
+	PrintFooter(options);
+
+	if(options.profile)
+	{
+		if(!msaProfile::Enabled())
+			fprintf(stderr, "Profiling counters are not built in, rebuild with -DMSA_PROFILE\n");
+		else
+			msaProfile::DumpJSON(stderr);
+	}
+
+	return 0;
+}
@@ -69,7 +69,7 @@ public:
 		oob_r = 127;
 		oob_g = 127;
 		oob_b = 127;
-		oob_b = 255;
+		oob_a = 255;
 	};
 
 	void GetNewSize(int w, int h, double scaling, double rotation, int &wNew, int &hNew)
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+#include "msaDispatch.h"
+#include "msaRowKernelsISA.h"
+
+static const char *isaNames[] = { "scalar", "sse2", "ssse3", "sse4.2", "avx2", "avx512" };
+
+static msaDispatch::ISA ProbeCPU()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return msaDispatch::ISA::AVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return msaDispatch::ISA::AVX2;
+	if(__builtin_cpu_supports("sse4.2"))
+		return msaDispatch::ISA::SSE42;
+	if(__builtin_cpu_supports("ssse3"))
+		return msaDispatch::ISA::SSSE3;
+	if(__builtin_cpu_supports("sse2"))
+		return msaDispatch::ISA::SSE2;
+#endif
+	return msaDispatch::ISA::Scalar;
+}
+
+// each level keeps the kernels below it that it has no replacement for; SSE4.2 and AVX-512
+//  have no kernels of their own yet, so they run the SSSE3 and AVX2 ones
+static void Bind(msaRowKernelTable &table, msaDispatch::ISA isa)
+{
+	memset(&table, 0, sizeof(table));
+	if(isa >= msaDispatch::ISA::SSE2)
+		BindRowKernelsSSE2(table);
+	if(isa >= msaDispatch::ISA::SSSE3)
+		BindRowKernelsSSSE3(table);
+	if(isa >= msaDispatch::ISA::AVX2)
+		BindRowKernelsAVX2(table);
+}
+
+class DispatchState
+{
+public:
+	msaDispatch::ISA detected;
+	msaDispatch::ISA active;
+	msaRowKernelTable table;
+
+	DispatchState()
+	{
+		detected = ProbeCPU();
+		active = detected;
+
+		const char *env = getenv("MSA_ISA");
+		msaDispatch::ISA requested;
+		if(env != NULL && msaDispatch::Parse(env, requested) && requested < detected)
+			active = requested;
+
+		Bind(table, active);
+	}
+};
+
+// built the first time anything asks, so it's ready even for other static initializers
+static DispatchState &State()
+{
+	static DispatchState state;
+	return state;
+}
+
+// probe at startup rather than in the middle of the first operation
+static DispatchState &startupState = State();
+
+msaDispatch::ISA msaDispatch::Detected()
+{
+	return State().detected;
+}
+
+msaDispatch::ISA msaDispatch::Active()
+{
+	return State().active;
+}
+
+msaDispatch::ISA msaDispatch::SetISA(ISA isa)
+{
+	DispatchState &state = State();
+	state.active = isa < state.detected ? isa : state.detected;
+	Bind(state.table, state.active);
+	return state.active;
+}
+
+const char *msaDispatch::Name(ISA isa)
+{
+	return isaNames[(int)isa];
+}
+
+bool msaDispatch::Parse(const char *name, ISA &isa)
+{
+	for(int i = 0; i < (int)(sizeof(isaNames) / sizeof(isaNames[0])); ++i)
+	{
+		if(strcasecmp(name, isaNames[i]) == 0)
+		{
+			isa = (ISA)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const msaRowKernelTable &msaDispatch::Kernels()
+{
+	return State().table;
+}
@@ -0,0 +1,48 @@
+#ifndef _msaDispatch_included
+#define _msaDispatch_included
+#include "msaExport.h"
+
+/*
+	Run time selection of the SIMD row kernels.  The CPU is probed once, the first time a kernel
+	is needed, and a table of function pointers is bound for the highest instruction set level
+	that both the CPU and the library support; each level keeps the kernels of the levels below
+	it that it doesn't replace.  Every level gives bit identical results, so the level only
+	changes speed.
+
+	Setting the environment variable MSA_ISA to one of scalar, sse2, ssse3, sse4.2, avx2 or
+	avx512 caps the level, for testing and benchmarking the slower paths; a level the CPU
+	doesn't support is lowered to the best one it does.
+*/
+
+struct msaRowKernelTable;
+
+class MSA_API msaDispatch
+{
+public:
+	enum class ISA
+	{
+		Scalar = 0,
+		SSE2,
+		SSSE3,
+		SSE42,
+		AVX2,
+		AVX512
+	};
+
+	// best level the CPU supports
+	static ISA Detected();
+	// level the kernels are currently bound for
+	static ISA Active();
+	// rebind the kernels for a level, lowered to Detected() if need be; returns the level used
+	// not thread safe, call it before starting any image operations
+	static ISA SetISA(ISA isa);
+
+	// lower case names as used by MSA_ISA; Parse returns false for an unknown name
+	static const char *Name(ISA isa);
+	static bool Parse(const char *name, ISA &isa);
+
+	// the bound kernels, used by the functions in msaRowKernels.h
+	static const msaRowKernelTable &Kernels();
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <math.h>
+#include <memory.h>
+#include <vector>
+#include <algorithm>
+#include "msaEdges.h"
+#include "ColorspaceConversion.h"
+#include "msaProfile.h"
+
+using namespace std;
+
+msaEdges::msaEdges()
+{
+	m_operator = GradientOperator::Sobel;
+}
+
+static void CheckDepth(msaImage &image)
+{
+	if(image.IsFloat() || (image.Depth() != 8 && image.Depth() != 24 && image.Depth() != 32))
+		throw "Invalid image depth";
+}
+
+/*
+	The gradients a line at a time.  Each line takes the sum and the difference of the gray lines
+	above and below it once, and gx and gy come out of those with a few adds per pixel: gx is the
+	difference across the smoothed columns and gy the smoothing of the column differences.  The
+	gray lines are kept in a ring of three with the edge pixel repeated past each end, so each is
+	converted from color once.
+*/
+class GradientLines
+{
+public:
+	GradientLines(msaImage &image, msaEdges::GradientOperator op) : m_image(image)
+	{
+		m_width = image.Width();
+		m_height = image.Height();
+		m_side = op == msaEdges::GradientOperator::Scharr ? 3 : 1;
+		m_middle = op == msaEdges::GradientOperator::Scharr ? 10 : 2;
+		m_gray.resize(3 * (m_width + 2));
+		m_held[0] = m_held[1] = m_held[2] = -1;
+		m_smooth.resize(m_width + 2);
+		m_difference.resize(m_width + 2);
+	}
+
+	// the gradients of line y, w values each
+	void Line(int y, int *gx, int *gy)
+	{
+		const int *top = Gray(y - 1);
+		const int *middle = Gray(y);
+		const int *bottom = Gray(y + 1);
+		for(int x = 0; x < m_width + 2; ++x)
+		{
+			m_smooth[x] = m_side * (top[x] + bottom[x]) + m_middle * middle[x];
+			m_difference[x] = bottom[x] - top[x];
+		}
+		for(int x = 0; x < m_width; ++x)
+		{
+			gx[x] = m_smooth[x + 2] - m_smooth[x];
+			gy[x] = m_side * (m_difference[x] + m_difference[x + 2]) + m_middle * m_difference[x + 1];
+		}
+	}
+
+protected:
+	msaImage &m_image;
+	int m_width;
+	int m_height;
+	int m_side;
+	int m_middle;
+	vector<int> m_gray;
+	int m_held[3];
+	vector<int> m_smooth;
+	vector<int> m_difference;
+
+	// gray line y, clamped to the image, starting one pixel before the first
+	const int *Gray(int y)
+	{
+		y = min(max(y, 0), m_height - 1);
+		int slot = y % 3;
+		int *gray = &m_gray[slot * (m_width + 2)];
+		if(m_held[slot] == y)
+			return gray;
+
+		int bpl = m_image.BytesPerLine();
+		int channels = m_image.Channels();
+		if(channels == 1)
+		{
+			const unsigned char *p = m_image.Data() + y * bpl;
+			for(int x = 0; x < m_width; ++x)
+				gray[x + 1] = p[x];
+		}
+		else if(m_image.Planar())
+		{
+			const unsigned char *r = m_image.Plane(0) + y * bpl;
+			const unsigned char *g = m_image.Plane(1) + y * bpl;
+			const unsigned char *b = m_image.Plane(2) + y * bpl;
+			for(int x = 0; x < m_width; ++x)
+				gray[x + 1] = RGBtoGray(r[x], g[x], b[x]);
+		}
+		else
+		{
+			const unsigned char *p = m_image.Data() + y * bpl;
+			for(int x = 0; x < m_width; ++x, p += channels)
+				gray[x + 1] = RGBtoGray(p[0], p[1], p[2]);
+		}
+		gray[0] = gray[1];
+		gray[m_width + 1] = gray[m_width];
+		m_held[slot] = y;
+		return gray;
+	}
+};
+
+void msaEdges::Gradients(msaImage &input, msaImage &gx, msaImage &gy, msaImage &magnitude, msaImage &orientation)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("Gradients", input.Depth()), (long long)input.Width() * input.Height());
+	CheckDepth(input);
+
+	int w = input.Width();
+	int h = input.Height();
+
+	// the outputs are only handed over at the end, so any of them can be the input
+	int floatBpl = w * sizeof(float);
+	int shortBpl = (w * 2 + 3) / 4 * 4;
+	unsigned char *gxData = new unsigned char[h * floatBpl];
+	unsigned char *gyData = new unsigned char[h * floatBpl];
+	unsigned char *magnitudeData = new unsigned char[h * shortBpl];
+	unsigned char *orientationData = new unsigned char[h * floatBpl];
+
+	GradientLines lines(input, m_operator);
+	vector<int> lineX(w);
+	vector<int> lineY(w);
+	for(int y = 0; y < h; ++y)
+	{
+		lines.Line(y, &lineX[0], &lineY[0]);
+		float *pgx = (float *)&gxData[y * floatBpl];
+		float *pgy = (float *)&gyData[y * floatBpl];
+		unsigned short *pmagnitude = (unsigned short *)&magnitudeData[y * shortBpl];
+		float *porientation = (float *)&orientationData[y * floatBpl];
+		for(int x = 0; x < w; ++x)
+		{
+			int dx = lineX[x];
+			int dy = lineY[x];
+			pgx[x] = (float)dx;
+			pgy[x] = (float)dy;
+			// at most 4080 * sqrt(2) for Scharr, well inside 16 bits
+			pmagnitude[x] = (unsigned short)(sqrt((double)(dx * dx + dy * dy)) + 0.5);
+			porientation[x] = (float)atan2((double)dy, (double)dx);
+		}
+	}
+
+	gx.TakeExternalData(w, h, floatBpl, 32, gxData, false, true);
+	gy.TakeExternalData(w, h, floatBpl, 32, gyData, false, true);
+	magnitude.TakeExternalData(w, h, shortBpl, 16, magnitudeData);
+	orientation.TakeExternalData(w, h, floatBpl, 32, orientationData, false, true);
+}
+
+// tan(22.5 degrees) in 15 bit fixed point, for sorting gradients into directions without angles
+static const int tan22 = 13573;
+
+/*
+	Canny a line at a time behind the gradients.  A pixel survives non-maximum suppression if its
+	squared magnitude is greater than its neighbor before it across the edge and at least the one
+	after, the neighbors being left and right, above and below or along a diagonal, whichever is
+	nearest the gradient's direction; the comparison being one sided keeps just one of a pair of
+	equal pixels.  The direction comes from comparing |gy| with |gx| times tan(22.5) and
+	tan(67.5), so no angles are taken, and squared magnitudes are compared exactly.
+
+	Survivors at least low are marked in a map with a border of empty pixels, and those at least
+	high are pushed on a stack as well.  Linking pops each edge pixel and pushes every marked
+	neighbor not yet an edge, so each pixel is visited once and there's no recursion to overflow.
+*/
+void msaEdges::Canny(msaImage &input, msaImage &edges, double low, double high)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("Canny", input.Depth()), (long long)input.Width() * input.Height());
+	CheckDepth(input);
+	if(!(low >= 0.0 && low <= high))
+		throw "Canny thresholds must have 0 <= low <= high";
+
+	int w = input.Width();
+	int h = input.Height();
+	double low2 = low * low;
+	double high2 = high * high;
+
+	// 0 for no edge, 1 for a pixel that can be linked, 2 for an edge
+	int mapWidth = w + 2;
+	vector<unsigned char> map((size_t)mapWidth * (h + 2), 0);
+	vector<int> stack;
+
+	// gradients and squared magnitudes of the lines above, at and below the one being thinned,
+	//  with a magnitude of 0 past each end and past the top and bottom
+	GradientLines lines(input, m_operator);
+	vector<int> gx(3 * w);
+	vector<int> gy(3 * w);
+	vector<int> magnitudes(3 * (w + 2), 0);
+	int slots[3] = { 0, 1, 2 };
+
+	lines.Line(0, &gx[slots[1] * w], &gy[slots[1] * w]);
+	for(int x = 0; x < w; ++x)
+		magnitudes[slots[1] * (w + 2) + x + 1] = gx[slots[1] * w + x] * gx[slots[1] * w + x] +
+				gy[slots[1] * w + x] * gy[slots[1] * w + x];
+
+	for(int y = 0; y < h; ++y)
+	{
+		int *next = &magnitudes[slots[2] * (w + 2)];
+		if(y + 1 < h)
+		{
+			int *nextX = &gx[slots[2] * w];
+			int *nextY = &gy[slots[2] * w];
+			lines.Line(y + 1, nextX, nextY);
+			for(int x = 0; x < w; ++x)
+				next[x + 1] = nextX[x] * nextX[x] + nextY[x] * nextY[x];
+		}
+		else
+			fill(next, next + w + 2, 0);
+
+		const int *above = &magnitudes[slots[0] * (w + 2)] + 1;
+		const int *here = &magnitudes[slots[1] * (w + 2)] + 1;
+		const int *below = next + 1;
+		const int *lineX = &gx[slots[1] * w];
+		const int *lineY = &gy[slots[1] * w];
+		unsigned char *mapLine = &map[(size_t)(y + 1) * mapWidth + 1];
+
+		for(int x = 0; x < w; ++x)
+		{
+			int m = here[x];
+			if(m < low2)
+				continue;
+
+			int ax = abs(lineX[x]);
+			int ay = abs(lineY[x]) << 15;
+			int tan22x = ax * tan22;
+			bool peak;
+			if(ay < tan22x)
+				peak = m > here[x - 1] && m >= here[x + 1];
+			else if(ay > tan22x + (ax << 16))
+				peak = m > above[x] && m >= below[x];
+			else
+			{
+				// gradients down and right or up and left run along the main diagonal
+				int s = (lineX[x] ^ lineY[x]) < 0 ? -1 : 1;
+				peak = m > above[x - s] && m >= below[x + s];
+			}
+			if(!peak)
+				continue;
+
+			if(m >= high2)
+			{
+				mapLine[x] = 2;
+				stack.push_back((y + 1) * mapWidth + x + 1);
+			}
+			else
+				mapLine[x] = 1;
+		}
+
+		// the line below becomes the one being thinned, and the line above is reused
+		int top = slots[0];
+		slots[0] = slots[1];
+		slots[1] = slots[2];
+		slots[2] = top;
+	}
+
+	const int neighbors[8] = { -mapWidth - 1, -mapWidth, -mapWidth + 1, -1, 1, mapWidth - 1, mapWidth,
+			mapWidth + 1 };
+	while(!stack.empty())
+	{
+		int i = stack.back();
+		stack.pop_back();
+		for(int n = 0; n < 8; ++n)
+		{
+			int j = i + neighbors[n];
+			if(map[j] == 1)
+			{
+				map[j] = 2;
+				stack.push_back(j);
+			}
+		}
+	}
+
+	// bitonal lines are whole 64 bit words, the padding left clear
+	int bpl = (w + 63) / 64 * 8;
+	unsigned char *data = new unsigned char[h * bpl];
+	memset(data, 0, h * bpl);
+	for(int y = 0; y < h; ++y)
+	{
+		const unsigned char *mapLine = &map[(size_t)(y + 1) * mapWidth + 1];
+		unsigned char *pout = &data[y * bpl];
+		for(int x = 0; x < w; ++x)
+			if(mapLine[x] == 2)
+				pout[x >> 3] |= 0x80 >> (x & 7);
+	}
+
+	edges.TakeExternalData(w, h, bpl, 1, data);
+}
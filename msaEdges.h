@@ -0,0 +1,48 @@
+#ifndef _msaEdges_included
+#define _msaEdges_included
+#include "msaImage.h"
+
+/*
+	Image gradients and Canny edge detection for 8 bit images, color ones by their gray value.
+	A convolution with a Sobel kernel through msaFilters clamps to the sample range, which loses
+	every negative gradient, and x and y would take a pass each; here both come out of one pass,
+	kept signed, along with the magnitude and orientation.
+
+	x runs right and y runs down, so gx is positive where the image gets brighter to the right and
+	gy where it gets brighter going down.  Pixels past the edges repeat the edge pixels.
+*/
+
+class MSA_API msaEdges
+{
+public:
+	// the 3x3 gradient kernels: both are [-1 0 1] one way, smoothed by [1 2 1] across it for
+	//  Sobel and by [3 10 3] for Scharr, which is closer to rotation invariant; Scharr gradients
+	//  are 4 times as large for the same edge, and Canny thresholds should be scaled to match
+	enum class GradientOperator
+	{
+		Sobel = 0,
+		Scharr
+	};
+
+	msaEdges();
+
+	GradientOperator GetOperator() { return m_operator; };
+	void SetOperator(GradientOperator op) { m_operator = op; };
+
+	// gradients of an 8, 24 or 32 bit image, interleaved or planar: gx and gy are 1 channel float
+	//  images of the signed gradients, magnitude a 16 bit image of their length, rounded, and
+	//  orientation a float image of their angle in radians, from -pi to pi, clockwise from the
+	//  x axis as seen on the screen
+	void Gradients(msaImage &input, msaImage &gx, msaImage &gy, msaImage &magnitude, msaImage &orientation);
+
+	// Canny edges into a bitonal image with the edge pixels set: pixels that are the largest
+	//  gradient magnitude across their edge are kept if that's at least high, or if it's at least
+	//  low and they join a kept pixel through others at least low, in any of 8 directions
+	// there's no smoothing first; blur noisy images beforehand, with a Gaussian for true Canny
+	void Canny(msaImage &input, msaImage &edges, double low, double high);
+
+protected:
+	GradientOperator m_operator;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _msaExport_included
+#define _msaExport_included
+
+// the library is compiled with -fvisibility=hidden, so only classes and functions marked
+//  MSA_API are exported from libmsaimage.so; the row kernels and other internals stay private
+#if defined(__GNUC__)
+#define MSA_API __attribute__((visibility("default")))
+#else
+#define MSA_API
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+#include <math.h>
+#include <algorithm>
+#include "msaFFT.h"
+
+using namespace std;
+
+typedef complex<double> Complex;
+
+// plain complex multiply; the library version guards against infinities and NaNs, which
+//  costs a function call per multiply
+static inline Complex Mul(const Complex &a, const Complex &b)
+{
+	return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+static const double sin60 = 0.86602540378443864676;
+static const double cos72 = 0.30901699437494742410;
+static const double sin72 = 0.95105651629515357212;
+static const double cos144 = -0.80901699437494742410;
+static const double sin144 = 0.58778525229247312917;
+
+// multiply by -i, or by i for the inverse transform
+static inline Complex MulMinusI(const Complex &a, bool inverse)
+{
+	return inverse ? Complex(-a.imag(), a.real()) : Complex(a.imag(), -a.real());
+}
+
+msaFFT::msaFFT()
+{
+	m_size = 0;
+}
+
+void msaFFT::Create(int n)
+{
+	if(n < 1)
+		throw "FFT size must be at least 1";
+
+	m_factors.clear();
+	int rest = n;
+	while(rest % 4 == 0)
+	{
+		m_factors.push_back(4);
+		rest /= 4;
+	}
+	const int primes[3] = { 2, 3, 5 };
+	for(int i = 0; i < 3; ++i)
+	{
+		while(rest % primes[i] == 0)
+		{
+			m_factors.push_back(primes[i]);
+			rest /= primes[i];
+		}
+	}
+	if(rest != 1)
+		throw "FFT size must have no prime factors other than 2, 3 and 5";
+
+	m_size = n;
+	m_roots.resize(n);
+	for(int k = 0; k < n; ++k)
+		m_roots[k] = Complex(cos(2.0 * M_PI * k / n), -sin(2.0 * M_PI * k / n));
+	m_work.resize(n);
+}
+
+int msaFFT::GoodSize(int n)
+{
+	for(int size = max(n, 1); ; ++size)
+	{
+		int rest = size;
+		while(rest % 2 == 0) rest /= 2;
+		while(rest % 3 == 0) rest /= 3;
+		while(rest % 5 == 0) rest /= 5;
+		if(rest == 1)
+			return size;
+	}
+}
+
+void msaFFT::Forward(Complex *data)
+{
+	Transform(data, false);
+}
+
+void msaFFT::Inverse(Complex *data)
+{
+	Transform(data, true);
+}
+
+/*
+	Each pass splits the current length n into p interleaved pieces of length m = n / p: the p
+	samples m apart go through a p point DFT, and output t of it is twiddled by w^(j t) for its
+	position j within the piece.  The samples s apart at each step are separate transforms, where s
+	is the product of the factors done so far; the twiddle for those is the root with index j t s.
+*/
+void msaFFT::Transform(Complex *data, bool inverse)
+{
+	if(m_size <= 1)
+		return;
+
+	Complex *x = data;
+	Complex *y = &m_work[0];
+	int n = m_size;
+	int s = 1;
+
+	for(size_t f = 0; f < m_factors.size(); ++f)
+	{
+		int p = m_factors[f];
+		int m = n / p;
+
+		for(int j = 0; j < m; ++j)
+		{
+			Complex twiddle[5];
+			for(int t = 0; t < p; ++t)
+			{
+				twiddle[t] = m_roots[j * t * s];
+				if(inverse)
+					twiddle[t] = conj(twiddle[t]);
+			}
+
+			for(int q = 0; q < s; ++q)
+			{
+				const Complex *in = x + q + s * j;
+				Complex *out = y + q + s * p * j;
+				int step = s * m;
+
+				if(p == 4)
+				{
+					Complex a0 = in[0], a1 = in[step], a2 = in[2 * step], a3 = in[3 * step];
+					Complex sum02 = a0 + a2, diff02 = a0 - a2;
+					Complex sum13 = a1 + a3, diff13 = MulMinusI(a1 - a3, inverse);
+					out[0] = sum02 + sum13;
+					out[s] = Mul(diff02 + diff13, twiddle[1]);
+					out[2 * s] = Mul(sum02 - sum13, twiddle[2]);
+					out[3 * s] = Mul(diff02 - diff13, twiddle[3]);
+				}
+				else if(p == 2)
+				{
+					Complex a0 = in[0], a1 = in[step];
+					out[0] = a0 + a1;
+					out[s] = Mul(a0 - a1, twiddle[1]);
+				}
+				else if(p == 3)
+				{
+					// b1 and b2 are a0 - (a1 + a2) / 2 -+ i sin(60) (a1 - a2), twiddled
+					Complex a0 = in[0], a1 = in[step], a2 = in[2 * step];
+					Complex sum = a1 + a2;
+					Complex mid = a0 - 0.5 * sum;
+					Complex rot = MulMinusI(sin60 * (a1 - a2), inverse);
+					out[0] = a0 + sum;
+					out[s] = Mul(mid + rot, twiddle[1]);
+					out[2 * s] = Mul(mid - rot, twiddle[2]);
+				}
+				else
+				{
+					// the same pairing for 5 points, with the cosines and sines of 72 and 144 degrees
+					Complex a0 = in[0], a1 = in[step], a2 = in[2 * step], a3 = in[3 * step], a4 = in[4 * step];
+					Complex sum14 = a1 + a4, sum23 = a2 + a3;
+					Complex diff14 = a1 - a4, diff23 = a2 - a3;
+					Complex mid1 = a0 + cos72 * sum14 + cos144 * sum23;
+					Complex mid2 = a0 + cos144 * sum14 + cos72 * sum23;
+					Complex rot1 = MulMinusI(sin72 * diff14 + sin144 * diff23, inverse);
+					Complex rot2 = MulMinusI(sin144 * diff14 - sin72 * diff23, inverse);
+					out[0] = a0 + sum14 + sum23;
+					out[s] = Mul(mid1 + rot1, twiddle[1]);
+					out[2 * s] = Mul(mid2 + rot2, twiddle[2]);
+					out[3 * s] = Mul(mid2 - rot2, twiddle[3]);
+					out[4 * s] = Mul(mid1 - rot1, twiddle[4]);
+				}
+			}
+		}
+
+		swap(x, y);
+		n = m;
+		s *= p;
+	}
+
+	if(x != data)
+		copy(x, x + m_size, data);
+}
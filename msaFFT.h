@@ -0,0 +1,40 @@
+#ifndef _msaFFT_included
+#define _msaFFT_included
+#include <complex>
+#include <vector>
+#include "msaExport.h"
+
+/*
+	Self contained complex FFT for sizes whose only prime factors are 2, 3 and 5, which is dense
+	enough that padding up to the next one costs little.  It's a Stockham transform, one pass per
+	factor with radix 4 taken where it can be, so the output comes out in order without a bit
+	reversal pass.  A plan holds its own work buffer, so use one per thread.
+*/
+
+class MSA_API msaFFT
+{
+public:
+	msaFFT();
+
+	// set up for transforms of n points
+	void Create(int n);
+	int Size() { return m_size; };
+
+	// transforms in place; neither is scaled, so a forward and inverse transform multiply by n
+	void Forward(std::complex<double> *data);
+	void Inverse(std::complex<double> *data);
+
+	// the smallest size Create() accepts that is at least n
+	static int GoodSize(int n);
+
+protected:
+	int m_size;
+	std::vector<int> m_factors;
+	// exp(-2 pi i k / n) for k from 0 to n - 1
+	std::vector<std::complex<double> > m_roots;
+	std::vector<std::complex<double> > m_work;
+
+	void Transform(std::complex<double> *data, bool inverse);
+};
+
+#endif
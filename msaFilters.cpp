@@ -2,13 +2,31 @@
 #include <stdio.h>
 #include <math.h>
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <complex>
 #include <sys/time.h>
 #include <memory.h>
 #include "msaFilters.h"
 #include "ColorspaceConversion.h"
+#include "msaRowKernels.h"
+#include "msaProfile.h"
+#include "msaFFT.h"
+#include "msaDispatch.h"
+#include "msaRowKernelsISA.h"
+#include "msaSortNetworks.h"
 
 using namespace std;
 
+// the morphology made of more than one dilate or erode
+static bool IsCompoundMorphology(msaFilters::FilterType type)
+{
+	return type == msaFilters::FilterType::Open || type == msaFilters::FilterType::Close ||
+			type == msaFilters::FilterType::TopHat || type == msaFilters::FilterType::BlackHat ||
+			type == msaFilters::FilterType::Gradient;
+}
+
 msaFilters::msaFilters()
 {
 	m_type = FilterType::Undefined;
@@ -17,10 +35,69 @@ msaFilters::msaFilters()
 	m_divisor = 1;
 	m_count = 0;
 	m_values.resize(m_count);
+	m_cx = 0;
+	m_cy = 0;
+	m_sigmaX = 0.0;
+	m_sigmaY = 0.0;
+	m_amount = 0.0;
+	m_threshold = 0.0;
+	m_sigmaRange = 0.0;
+	m_bilateral = BilateralMethod::Grid;
+	m_method = ConvolutionMethod::Automatic;
+	m_border = BorderMode::Clamp;
+	m_borderValue = 0.0;
+	m_median = MedianMode::Luminance;
+	m_fixedBits = 0;
+	m_fixedDivisor = 1;
+	m_fixedError = 0;
+}
+
+#ifdef MSA_PROFILE
+static const char *FilterTypeName(msaFilters::FilterType type)
+{
+	switch(type)
+	{
+	case msaFilters::FilterType::UserDefined:
+		return "UserDefined";
+	case msaFilters::FilterType::Dilate:
+		return "Dilate";
+	case msaFilters::FilterType::Erode:
+		return "Erode";
+	case msaFilters::FilterType::Median:
+		return "Median";
+	case msaFilters::FilterType::Gaussian:
+		return "Gaussian";
+	case msaFilters::FilterType::Sharpen:
+		return "Sharpen";
+	case msaFilters::FilterType::Box:
+		return "Box";
+	case msaFilters::FilterType::RecursiveGaussian:
+		return "RecursiveGaussian";
+	case msaFilters::FilterType::Open:
+		return "Open";
+	case msaFilters::FilterType::Close:
+		return "Close";
+	case msaFilters::FilterType::TopHat:
+		return "TopHat";
+	case msaFilters::FilterType::BlackHat:
+		return "BlackHat";
+	case msaFilters::FilterType::Gradient:
+		return "Gradient";
+	case msaFilters::FilterType::UnsharpMask:
+		return "UnsharpMask";
+	case msaFilters::FilterType::Bilateral:
+		return "Bilateral";
+	default:
+		return "Undefined";
+	}
 }
+#endif
 
 void msaFilters::FilterImage(msaImage &input, msaImage &output)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name(input.Planar() ? "FilterImage/Planar" : "FilterImage", FilterTypeName(m_type),
+			input.Depth(), input.IsFloat()), (long long)input.Width() * input.Height());
+
 	// grab input image parameters
 	int w = input.Width();
 	int h = input.Height();
@@ -28,84 +105,97 @@ void msaFilters::FilterImage(msaImage &input, msaImage &output)
 	int depth = input.Depth();
 	unsigned char *indata = input.Data();
 
+	// planar color images are filtered one plane at a time, each plane being a grayscale image
+	if(input.Planar() && input.Channels() > 1)
+	{
+		if(depth != 24 && depth != 32 && depth != 48 && depth != 64)
+			throw "Invalid image depth";
+
+		int channels = input.Channels();
+		unsigned char *outdata = new unsigned char[channels * h * bpl];
+
+		for(int c = 0; c < channels; ++c)
+		{
+			if(input.BitsPerSample() == 16)
+				FilterGeneric<unsigned short, 1>(input.Plane(c), &outdata[c * h * bpl], w, h, bpl);
+			else
+				FilterGeneric<unsigned char, 1>(input.Plane(c), &outdata[c * h * bpl], w, h, bpl);
+		}
+
+		output.TakeExternalData(w, h, bpl, depth, outdata, true);
+		return;
+	}
+
 	// we're going to allocate our own space, so we can be sure input BPL and output BPL match,
 	//  and we'll give the data to the output image so it can delete it
 	unsigned char *outdata = new unsigned char[h * bpl];
 
-	switch(m_type)
+	if(input.IsFloat())
 	{
-	case FilterType::UserDefined:
-	case FilterType::Gaussian:
-	case FilterType::Sharpen:
-		switch(depth)
+		switch(input.Channels())
 		{
-		case 8:
-			Filter8(indata, outdata, w, h, bpl);
-			break;
-		case 24:
-			Filter24(indata, outdata, w, h, bpl);
+		case 1:
+			FilterFloat<1>(indata, outdata, w, h, bpl);
 			break;
-		case 32:
-			Filter32(indata, outdata, w, h, bpl);
+		case 3:
+			FilterFloat<3>(indata, outdata, w, h, bpl);
 			break;
-		default:
-			throw "Invalid image depth";
+		case 4:
+			FilterFloat<4>(indata, outdata, w, h, bpl);
 			break;
 		}
-		break;
-	case FilterType::Dilate:
+
+		output.TakeExternalData(w, h, bpl, depth, outdata, false, true);
+		return;
+	}
+
+	// 16 bit per channel images use the generic kernels
+	if(input.BitsPerSample() == 16)
+	{
 		switch(depth)
 		{
-		case 8:
-			Dilate8(indata, outdata, w, h, bpl);
-			break;
-		case 24:
-			Dilate24(indata, outdata, w, h, bpl);
+		case 16:
+			FilterGeneric<unsigned short, 1>(indata, outdata, w, h, bpl);
 			break;
-		case 32:
-			Dilate32(indata, outdata, w, h, bpl);
+		case 48:
+			FilterGeneric<unsigned short, 3>(indata, outdata, w, h, bpl);
 			break;
-		default:
-			throw "Invalid image depth";
+		case 64:
+			FilterGeneric<unsigned short, 4>(indata, outdata, w, h, bpl);
 			break;
 		}
-		break;
-	case FilterType::Erode:
-		switch(depth)
-		{
-		case 8:
-			Erode8(indata, outdata, w, h, bpl);
-			break;
-		case 24:
-			Erode24(indata, outdata, w, h, bpl);
-			break;
-		case 32:
-			Erode32(indata, outdata, w, h, bpl);
-			break;
-		default:
+
+		output.TakeExternalData(w, h, bpl, depth, outdata);
+		return;
+	}
+
+	// bitonal images only have their own morphology, everything else goes through the generic
+	//  kernels
+	switch(depth)
+	{
+	case 1:
+		if(m_type == FilterType::Dilate)
+			Dilate1(indata, outdata, w, h, bpl);
+		else if(m_type == FilterType::Erode)
+			Erode1(indata, outdata, w, h, bpl);
+		else if(IsCompoundMorphology(m_type))
+			CompoundMorphology1(indata, outdata, w, h, bpl);
+		else if(m_type == FilterType::Undefined)
+			throw "Invalid filter type";
+		else
 			throw "Invalid image depth";
-			break;
-		}
 		break;
-	case FilterType::Median:
-		switch(depth)
-		{
-		case 8:
-			MedianFilter8(indata, outdata, w, h, bpl);
-			break;
-		case 24:
-			MedianFilter24(indata, outdata, w, h, bpl);
-			break;
-		case 32:
-			MedianFilter32(indata, outdata, w, h, bpl);
-			break;
-		default:
-			throw "Invalid image depth";
-			break;
-		}
+	case 8:
+		FilterGeneric<unsigned char, 1>(indata, outdata, w, h, bpl);
+		break;
+	case 24:
+		FilterGeneric<unsigned char, 3>(indata, outdata, w, h, bpl);
+		break;
+	case 32:
+		FilterGeneric<unsigned char, 4>(indata, outdata, w, h, bpl);
 		break;
 	default:
-		throw "Invalid filter type";
+		throw "Invalid image depth";
 	}
 
 	// create the output image and give it the filtered data
@@ -125,6 +215,11 @@ void msaFilters::SetType(FilterType type, int w, int h)
 		m_type = type;
 		break;
 	case FilterType::Median:
+	case FilterType::Open:
+	case FilterType::Close:
+	case FilterType::TopHat:
+	case FilterType::BlackHat:
+	case FilterType::Gradient:
 		SetFilterSize(w, h);
 		m_type = type;
 		break;
@@ -136,9 +231,26 @@ void msaFilters::SetType(FilterType type, int w, int h)
 		SetToSharpen(w, h);
 		m_type = type;
 		break;
+	case FilterType::Box:
+		SetToBox(w, h);
+		m_type = type;
+		break;
+	case FilterType::RecursiveGaussian:
+		if (w < 3 || h < 3)
+			throw "Width or height of Gaussian filter must be at least 3 pixels";
+		// the Gaussian kernel's curve is exp(-3.14 * (d / r)^2) for a radius r of half the size,
+		//  which is a sigma of r / sqrt(6.28); the smallest size comes out just under 0.5
+		SetRecursiveGaussian(max(0.5, (w / 2) / sqrt(6.28)), max(0.5, (h / 2) / sqrt(6.28)));
+		break;
 	case FilterType::UserDefined:
 		throw "User defined filters must be set with SetUserDefined";
 		break;
+	case FilterType::UnsharpMask:
+		throw "Unsharp masks must be set with SetUnsharpMask";
+		break;
+	case FilterType::Bilateral:
+		throw "Bilateral filters must be set with SetBilateral";
+		break;
 	default:
 		throw "SetType must be called with a defined filter type";
 	}
@@ -149,11 +261,14 @@ void msaFilters::SetFilterSize(int w, int h)
 	// set the thing special filters need
 	m_width = w;
 	m_height = h;
+	m_cx = w / 2;
+	m_cy = h / 2;
 
 	// clear the rest
 	m_divisor = 1;
 	m_count = 0;
 	m_values.resize(m_count);
+	QuantizeKernel();
 }
 
 void msaFilters::SetUserDefined(const int *vals, int w, int h, int cx, int cy, int divisor)
@@ -188,6 +303,172 @@ void msaFilters::SetUserDefined(const int *vals, int w, int h, int cx, int cy, i
 		m_divisor = divisor;
 
 	if(m_divisor == 0) m_divisor = 1;
+
+	QuantizeKernel();
+}
+
+void msaFilters::SetStructuringElement(FilterType type, const int *mask, int w, int h, int cx, int cy)
+{
+	if(type != FilterType::Dilate && type != FilterType::Erode && !IsCompoundMorphology(type))
+		throw "Structuring elements are only for morphology";
+	if(w < 1 || h < 1)
+		throw "Structuring element must be at least 1 pixel";
+	if(cx < 0 || cx >= w || cy < 0 || cy >= h)
+		throw "Structuring element center must be inside the element";
+	if(count_if(mask, mask + w * h, [](int v) { return v != 0; }) == 0)
+		throw "Structuring element is empty";
+
+	SetFilterSize(w, h);
+	m_cx = cx;
+	m_cy = cy;
+	m_count = w * h;
+	m_values.resize(m_count);
+	for(int i = 0; i < m_count; ++i)
+		m_values[i] = mask[i] != 0 ? 1 : 0;
+
+	m_type = type;
+}
+
+void msaFilters::SetStructuringElement(FilterType type, ElementShape shape, int w, int h)
+{
+	if(w < 1 || h < 1)
+		throw "Structuring element must be at least 1 pixel";
+
+	// distances from the middle of the element, which falls between pixels when w or h is even
+	double rx = (w - 1) / 2.0;
+	double ry = (h - 1) / 2.0;
+	vector<int> mask(w * h);
+	for(int y = 0; y < h; ++y)
+	{
+		for(int x = 0; x < w; ++x)
+		{
+			double dx = fabs(x - rx);
+			double dy = fabs(y - ry);
+			bool inside;
+			switch(shape)
+			{
+			case ElementShape::Disk:
+				// dx^2 / rx^2 + dy^2 / ry^2 <= 1, multiplied out so a zero radius works; the middle
+				//  line and column are always in, so even sizes reach the edges
+				inside = dx < 1.0 || dy < 1.0 || dx * dx * ry * ry + dy * dy * rx * rx <= rx * rx * ry * ry;
+				break;
+			case ElementShape::Diamond:
+				inside = dx < 1.0 || dy < 1.0 || dx * ry + dy * rx <= rx * ry;
+				break;
+			case ElementShape::Cross:
+				inside = x == w / 2 || y == h / 2;
+				break;
+			default:
+				inside = true;
+				break;
+			}
+			mask[y * w + x] = inside ? 1 : 0;
+		}
+	}
+
+	SetStructuringElement(type, &mask[0], w, h, w / 2, h / 2);
+}
+
+void msaFilters::SetLineElement(FilterType type, int length, double angle)
+{
+	if(length < 1)
+		throw "Structuring element must be at least 1 pixel";
+
+	// step along the line a pixel at a time from the middle, rounding to the nearest pixel; y runs
+	//  down the image, so counterclockwise is up
+	double c = cos(angle * M_PI / 180.0);
+	double s = -sin(angle * M_PI / 180.0);
+	vector<int> xs(length), ys(length);
+	int reachX = 0, reachY = 0;
+	for(int i = 0; i < length; ++i)
+	{
+		double t = i - (length - 1) / 2.0;
+		xs[i] = (int)lround(t * c);
+		ys[i] = (int)lround(t * s);
+		reachX = max(reachX, abs(xs[i]));
+		reachY = max(reachY, abs(ys[i]));
+	}
+
+	int w = 2 * reachX + 1;
+	int h = 2 * reachY + 1;
+	vector<int> mask(w * h);
+	for(int i = 0; i < length; ++i)
+		mask[(ys[i] + reachY) * w + xs[i] + reachX] = 1;
+
+	SetStructuringElement(type, &mask[0], w, h, reachX, reachY);
+}
+
+void msaFilters::SetFixedPoint(int bits)
+{
+	if(bits < 0 || bits > 14)
+		throw "Fixed point precision must be from 0 to 14 bits";
+
+	m_fixedBits = bits;
+	QuantizeKernel();
+}
+
+/*
+	Each kernel value over the divisor is rounded to a multiple of 1 / 2^bits.  14 bits keeps the
+	values of a smoothing kernel within 16 bits, which the SSE2 loops need.  Factors of two common
+	to the whole kernel are taken back out, which changes no result but leaves smaller values, so
+	more kernels fit 16 bit sums; a 3x3 binomial kernel over 16 comes out as itself.
+
+	Samples are never negative, so a sum with the scaled kernel is off from the exact, unrounded
+	one by at most 255 times the total of the kernel values that came out too large, or of the ones
+	that came out too small, whichever is more.  Rounding the two can take them up to one more
+	level apart, which is what GetFixedPointError() reports.
+*/
+void msaFilters::QuantizeKernel()
+{
+	m_fixedValues.clear();
+	m_fixedDivisor = 1;
+	m_fixedError = 0;
+	if(m_fixedBits == 0 || m_count == 0)
+		return;
+
+	int shift = m_fixedBits;
+	vector<long long> scaled(m_count);
+	for(int i = 0; i < m_count; ++i)
+		scaled[i] = llround(ldexp((double)m_values[i] / m_divisor, shift));
+
+	while(shift > 0)
+	{
+		int i;
+		for(i = 0; i < m_count && (scaled[i] & 1) == 0; ++i);
+		if(i < m_count)
+			break;
+
+		for(i = 0; i < m_count; ++i)
+			scaled[i] /= 2;
+		--shift;
+	}
+
+	m_fixedValues.resize(m_count);
+	m_fixedDivisor = 1 << shift;
+	long long over = 0, under = 0;
+	for(int i = 0; i < m_count; ++i)
+	{
+		if(scaled[i] < numeric_limits<int>::min() || scaled[i] > numeric_limits<int>::max())
+		{
+			m_fixedValues.clear();
+			m_fixedDivisor = 1;
+			throw "Kernel values are too large for fixed point";
+		}
+
+		m_fixedValues[i] = (int)scaled[i];
+		// the error times both divisors, with the sign of the kernel's own divisor taken out
+		long long error = scaled[i] * m_divisor - (long long)m_values[i] * m_fixedDivisor;
+		if(m_divisor < 0)
+			error = -error;
+		if(error > 0)
+			over += error;
+		else
+			under -= error;
+	}
+
+	long long error = max(over, under);
+	if(error > 0)
+		m_fixedError = (int)(255.0 * error / ((double)llabs(m_divisor) * m_fixedDivisor)) + 1;
 }
 
 void msaFilters::SetToGaussian(int w, int h)
@@ -266,2758 +547,2427 @@ void msaFilters::SetToSharpen(int w, int h)
 	SetUserDefined(vals, w, h, w / 2, h / 2, 0);
 }
 
-inline unsigned char *GetClippedValue24(int x, int y, unsigned char *data, int w, int h, int bpl)
+void msaFilters::SetRecursiveGaussian(double sigmaX, double sigmaY)
 {
-	if(x >= w) x = w - 1;
-	if(y >= h) y = h - 1;
-	if(x < 0) x = 0;
-	if(y < 0) y = 0;
-
-	return &data[y * bpl + x * 3];
+	if(!(sigmaX >= 0.5 && sigmaY >= 0.5))
+		throw "Sigma of recursive Gaussian filter must be at least 0.5";
+
+	// the size of the Gaussian kernel with these sigmas, for GetWidth() and GetHeight()
+	SetFilterSize(2 * (int)(sigmaX * sqrt(6.28) + 0.5) + 1, 2 * (int)(sigmaY * sqrt(6.28) + 0.5) + 1);
+	m_sigmaX = sigmaX;
+	m_sigmaY = sigmaY;
+	m_type = FilterType::RecursiveGaussian;
 }
 
-inline unsigned char *GetClippedValue32(int x, int y, unsigned char *data, int w, int h, int bpl)
+void msaFilters::SetUnsharpMask(double amount, double radius, double threshold)
 {
-	if(x >= w) x = w - 1;
-	if(y >= h) y = h - 1;
-	if(x < 0) x = 0;
-	if(y < 0) y = 0;
+	if(!(amount >= 0.0))
+		throw "Amount of unsharp mask must not be negative";
+	if(!(threshold >= 0.0))
+		throw "Threshold of unsharp mask must not be negative";
+	if(!(radius >= 0.5))
+		throw "Radius of unsharp mask must be at least 0.5";
+
+	// the blur is the recursive Gaussian's, with GetWidth() and GetHeight() to match
+	SetRecursiveGaussian(radius, radius);
+	m_amount = amount;
+	m_threshold = threshold;
+	m_type = FilterType::UnsharpMask;
+}
 
-	return &data[y * bpl + x * 4];
+void msaFilters::SetBilateral(double sigmaSpatial, double sigmaRange)
+{
+	if(!(sigmaSpatial >= 0.5))
+		throw "Spatial sigma of bilateral filter must be at least 0.5";
+	if(!(sigmaRange >= 1.0))
+		throw "Range sigma of bilateral filter must be at least 1";
+
+	// the exact filter's window, out to 2.5 sigma like the Gaussian kernel
+	int radius = max(1, (int)(2.5 * sigmaSpatial + 0.5));
+	SetFilterSize(2 * radius + 1, 2 * radius + 1);
+	m_sigmaX = sigmaSpatial;
+	m_sigmaY = sigmaSpatial;
+	m_sigmaRange = sigmaRange;
+	m_type = FilterType::Bilateral;
 }
 
-inline unsigned char *GetClippedValue8(int x, int y, unsigned char *data, int w, int h, int bpl)
+void msaFilters::SetToBox(int w, int h)
 {
-	if(x >= w) x = w - 1;
-	if(y >= h) y = h - 1;
-	if(x < 0) x = 0;
-	if(y < 0) y = 0;
+	if(w < 1 || h < 1)
+		throw "Width and height of box filter must be at least 1 pixel";
 
-	return &data[y * bpl + x];
+	// the kernel isn't used by the box filter itself, but keeps Val() and GetDivisor() meaningful
+	vector<int> vals(w * h, 1);
+	SetUserDefined(&vals[0], w, h, w / 2, h / 2, w * h);
 }
 
-/*
-	For color values; since we're going to sort by gray values (the only way to really do a median filter) then
-	we need to have some way to get from the median value back to the source RGB value.
-*/
-void msaFilters::MedianFilter24(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+void msaFilters::SetBorderMode(BorderMode mode, double value)
 {
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;	
+	m_border = mode;
+	m_borderValue = value;
+}
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+// index of a pixel along a line, clipped to the image so the edge pixels repeat
+inline int ClipIndex(int i, int size)
+{
+	if(i >= size) i = size - 1;
+	if(i < 0) i = 0;
+	return i;
+}
 
-		for(imgX = startx; imgX < endx; ++imgX)		
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
+// line or column i of an image size long, moved inside it by the border mode; -1 means the
+//  constant border value
+static inline int BorderIndex(int i, int size, msaFilters::BorderMode mode)
+{
+	if(i >= 0 && i < size)
+		return i;
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
+	switch(mode)
+	{
+	case msaFilters::BorderMode::Reflect:
+	{
+		// mirrored with the edge pixel repeated, so the pattern repeats every 2 * size pixels
+		int period = 2 * size;
+		i %= period;
+		if(i < 0) i += period;
+		return i < size ? i : period - 1 - i;
+	}
+	case msaFilters::BorderMode::Wrap:
+		i %= size;
+		return i < 0 ? i + size : i;
+	case msaFilters::BorderMode::Constant:
+		return -1;
+	default:
+		return ClipIndex(i, size);
+	}
+}
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
+// round and clamp to an integer sample, float samples are stored as they are
+template <typename T>
+static inline T ToSample(double v)
+{
+	if(is_floating_point<T>::value)
+		return (T)v;
+	if(v <= 0.0)
+		return 0;
+	if(v >= numeric_limits<T>::max())
+		return numeric_limits<T>::max();
+	return (T)(v + 0.5);
+}
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
+/*
+	The filters that work on a window read their lines through this, so none of them needs edge
+	cases of its own.  It keeps a ring of the window's lines, each copied once with the pixels the
+	window hangs off either end filled in by the border mode, so the window of every pixel is a
+	plain run of samples and one branch free loop covers the whole image.  Moving down a line
+	loads just the new bottom line of the window, into the slot of the line leaving the top.
+
+	Lines off the top or bottom come from the border mode as well.  When the window doesn't reach
+	past either end of the line, lines inside the image are used where they are, without copying,
+	unless copy is set.  The lines come from Source(), which a derived class can have make them
+	some other way than reading them from the image.
+*/
+template <typename T, int C>
+class BorderedLines
+{
+public:
+	// the window reaches left pixels before the one it's for and right pixels after, and top
+	//  lines above and bottom lines below
+	BorderedLines(unsigned char *input, int w, int h, int bpl, int left, int right, int top, int bottom,
+			msaFilters::BorderMode mode, T value, bool copy = false)
+	{
+		m_input = input;
+		m_width = w;
+		m_height = h;
+		m_bpl = bpl;
+		m_left = left;
+		m_top = top;
+		m_mode = mode;
+		m_count = top + bottom + 1;
+		m_samples = (left + w + right) * C;
+
+		m_lines.resize(m_count);
+		m_slots.resize(m_count);
+		m_held.assign(m_count, numeric_limits<int>::min());
+		if(copy || left > 0 || right > 0)
+			m_ring.resize((size_t)m_count * m_samples);
+		m_constant.assign(m_samples, value);
+
+		// the image column each padded pixel comes from, or -1 for the constant
+		m_columns.resize(left + w + right);
+		for(int x = 0; x < (int)m_columns.size(); ++x)
+			m_columns[x] = BorderIndex(x - left, w, mode);
+	}
+
+	virtual ~BorderedLines()
+	{
+	}
 
-			// find median value
-			int total = m_count / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
+	// the window's lines for image line y, top to bottom, each starting left pixels before the
+	//  first pixel of the line
+	T *const *Window(int y)
+	{
+		for(int i = 0; i < m_count; ++i)
+		{
+			int line = y - m_top + i;
+			int slot = line % m_count;
+			if(slot < 0)
+				slot += m_count;
+			if(m_held[slot] != line)
 			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-		}
+				Load(line, slot);
+				m_held[slot] = line;
+			}
+			m_lines[i] = m_slots[slot];
+		}
+		return &m_lines[0];
+	}
+
+protected:
+	unsigned char *m_input;
+	int m_width;
+	int m_height;
+	int m_bpl;
+	int m_left;
+	int m_top;
+	msaFilters::BorderMode m_mode;
+	int m_count;
+	int m_samples;
+
+	vector<T> m_ring;
+	vector<T> m_constant;
+	vector<int> m_columns;
+	// the line each slot of the ring holds, and where it is
+	vector<int> m_held;
+	vector<T *> m_slots;
+	vector<T *> m_lines;
+
+	// image line y, which is inside the image
+	virtual const T *Source(int y)
+	{
+		return (const T *)&m_input[y * m_bpl];
 	}
 
-	// now deal with the edges
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+	void Load(int line, int slot)
+	{
+		int source = BorderIndex(line, m_height, m_mode);
+		if(source < 0)
+		{
+			m_slots[slot] = &m_constant[0];
+			return;
+		}
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		const T *in = Source(source);
+		if(m_ring.empty())
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
+			m_slots[slot] = (T *)in;
+			return;
+		}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY < 0) continue;
+		T *out = &m_ring[(size_t)slot * m_samples];
+		memcpy(&out[m_left * C], in, m_width * C * sizeof(T));
+		for(int x = 0; x < (int)m_columns.size(); ++x)
+		{
+			if(x == m_left)
+				x += m_width;
+			if(x >= (int)m_columns.size())
+				break;
 
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
+			const T *pin = m_columns[x] < 0 ? &m_constant[0] : &in[m_columns[x] * C];
+			for(int c = 0; c < C; ++c)
+				out[x * C + c] = pin[c];
+		}
+		m_slots[slot] = out;
+	}
+};
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
+// one line of a convolution of wider samples, each tap adding to all the colors of a pixel; KW and
+//  KH fix the kernel size so the taps unroll completely, or are 0 for any size
+template <typename T, int C, int KW, int KH>
+static void ConvolveLine(T *const *window, const int *kernel, int kw, int kh, int divisor, T *out, int w)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	const int colors = C >= 3 ? 3 : C;
+	long long maxVal = numeric_limits<T>::max();
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
+	for(int x = 0; x < w; ++x)
+	{
+		long long sum[C];
+		for(int c = 0; c < colors; ++c)
+			sum[c] = divisor / 2;	// for rounding purposes
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			T *pin = window[filtY] + x * C;
+			for(int filtX = 0; filtX < width; ++filtX, pin += C)
 			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+				long long k = kernel[filtVal++];
+				for(int c = 0; c < colors; ++c)
+					sum[c] += pin[c] * k;
+			}
+		}
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
+		for(int c = 0; c < colors; ++c)
+		{
+			long long v = sum[c] / divisor;
+			if(v > maxVal) v = maxVal;
+			if(v < 0) v = 0;
+			out[x * C + c] = (T)v;
 		}
 	}
+}
+
+/*
+	Convolution of 8 or 16 bit samples.  8 bit lines go through the dispatched row kernel, which
+	convolves each interleaved channel separately, alpha included, though alpha then comes straight
+	from the center pixel.  Sums are rounded by adding half the divisor and clamped to the range;
+	the row kernels apply a power of two divisor, which fixed point always gives, as a shift.  The
+	3x3, 5x5 and 7x7 kernels that small blurs and sharpens use get loops of their own size, here
+	and in the row kernels.
+*/
+template <typename T, int C>
+void msaFilters::FilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl, const int *values,
+		int divisor)
+{
+	BorderedLines<T, C> lines(input, w, h, bpl, m_cx, m_width - 1 - m_cx, m_cy, m_height - 1 - m_cy, m_border,
+			ToSample<T>(m_borderValue));
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		T *const *window = lines.Window(imgY);
+		T *pout = (T *)&output[imgY * bpl];
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		if(sizeof(T) == 1)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY >= h) continue;
+			ConvolveRowBytes((const unsigned char *const *)window, values, m_width, m_height, C, divisor,
+					(unsigned char *)pout, w * C);
+		}
+		else if(m_width == 3 && m_height == 3)
+			ConvolveLine<T, C, 3, 3>(window, values, m_width, m_height, divisor, pout, w);
+		else if(m_width == 5 && m_height == 5)
+			ConvolveLine<T, C, 5, 5>(window, values, m_width, m_height, divisor, pout, w);
+		else if(m_width == 7 && m_height == 7)
+			ConvolveLine<T, C, 7, 7>(window, values, m_width, m_height, divisor, pout, w);
+		else
+			ConvolveLine<T, C, 0, 0>(window, values, m_width, m_height, divisor, pout, w);
 
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
+		// alpha isn't filtered, it comes straight from the center pixel
+		if(C == 4)
+		{
+			T *pin = (T *)&input[imgY * bpl];
+			for(int imgX = 0; imgX < w; ++imgX)
+				pout[imgX * C + 3] = pin[imgX * C + 3];
+		}
+	}
+}
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
+// a histogram of bytes with a coarse one of 16 values a bucket beside it, so finding the median
+//  looks at 16 buckets and then at most 16 values rather than all 256
+struct ByteHistogram
+{
+	long fine[256];
+	long coarse[16];
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
+	void Clear()
+	{
+		memset(fine, 0, sizeof(fine));
+		memset(coarse, 0, sizeof(coarse));
+	}
+	void Add(int value)
+	{
+		++fine[value];
+		++coarse[value >> 4];
+	}
+	void Remove(int value)
+	{
+		--fine[value];
+		--coarse[value >> 4];
+	}
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+	// counting down from the top of count values, the value at rank count / 2
+	int Median(int count) const
+	{
+		long total = count / 2;
+		int bucket;
+		for(bucket = 15; bucket > 0; --bucket)
+		{
+			if(total - coarse[bucket] < 0)
+				break;
+			total -= coarse[bucket];
+		}
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
+		int i;
+		for(i = bucket * 16 + 15; i > bucket * 16; --i)
+		{
+			total -= fine[i];
+			if(total < 0)
+				break;
 		}
+		return i;
 	}
+};
+
+/*
+	8 bit median from histograms that slide along the line, a column of the window in and one out
+	for each pixel.  Gray images and the per channel median keep one for each channel, except for
+	3x3 and 5x5 windows, which go through the sorting networks in the row kernels.  The
+	luminance median slides a histogram of the pixels' gray values, worked out once for each line
+	of the window, and then picks the largest RGB value of the pixels with the median gray.  Alpha
+	comes straight from the center pixel.
+*/
+template <int C>
+void msaFilters::MedianFilterBytes(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	int startx = m_width / 2;
+	int starty = m_height / 2;
+	int count = m_width * m_height;
+	int span = w + m_width - 1;
+	const int colors = C >= 3 ? 3 : C;
+
+	BorderedLines<unsigned char, C> lines(input, w, h, bpl, startx, m_width - 1 - startx, starty,
+			m_height - 1 - starty, m_border, ToSample<unsigned char>(m_borderValue));
+
+	ByteHistogram histograms[colors];
+	vector<unsigned char> grays;
+	bool luminance = C >= 3 && m_median == MedianMode::Luminance;
+	if(luminance)
+		grays.resize(m_height * span);
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		unsigned char *const *window = lines.Window(imgY);
+		unsigned char *pin = &input[imgY * bpl];
 		unsigned char *pout = &output[imgY * bpl];
 
-		for(imgX = 0; imgX < startx; ++imgX)
+		// small square windows go through a sorting network a line at a time, alpha included, though
+		//  it then comes straight from the center pixel
+		if(!luminance && m_width == m_height && (m_width == 3 || m_width == 5))
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
+			MedianRowBytes((const unsigned char *const *)window, m_width, C, pout, w * C);
+			if(C == 4)
+				for(int imgX = 0; imgX < w; ++imgX)
+					pout[imgX * C + 3] = pin[imgX * C + 3];
+			continue;
+		}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+		if(!luminance)
+		{
+			for(int c = 0; c < colors; ++c)
 			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
+				histograms[c].Clear();
+				for(int filtY = 0; filtY < m_height; ++filtY)
+					for(int filtX = 0; filtX < m_width - 1; ++filtX)
+						histograms[c].Add(window[filtY][filtX * C + c]);
+			}
 
-				for(filtX = 0; filtX < m_width; ++filtX)
+			for(int imgX = 0; imgX < w; ++imgX)
+			{
+				for(int c = 0; c < colors; ++c)
 				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX < 0) continue;
-
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX) * 3];
+					for(int filtY = 0; filtY < m_height; ++filtY)
+						histograms[c].Add(window[filtY][(imgX + m_width - 1) * C + c]);
 
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
+					pout[imgX * C + c] = histograms[c].Median(count);
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
-
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
+					for(int filtY = 0; filtY < m_height; ++filtY)
+						histograms[c].Remove(window[filtY][imgX * C + c]);
 				}
-			}
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+				if(C == 4)
+					pout[imgX * C + 3] = pin[imgX * C + 3];
+			}
+			continue;
+		}
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
+		for(int filtY = 0; filtY < m_height; ++filtY)
+		{
+			unsigned char *p = window[filtY];
+			unsigned char *gray = &grays[filtY * span];
+			for(int x = 0; x < span; ++x, p += C)
+				gray[x] = RGBtoGray(p[0], p[1], p[2]);
 		}
-	}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 3];
+		ByteHistogram &histogram = histograms[0];
+		histogram.Clear();
+		for(int filtY = 0; filtY < m_height; ++filtY)
+			for(int filtX = 0; filtX < m_width - 1; ++filtX)
+				histogram.Add(grays[filtY * span + filtX]);
 
-		for(imgX = endx; imgX < w; ++imgX)
+		for(int imgX = 0; imgX < w; ++imgX)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-			
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
+			for(int filtY = 0; filtY < m_height; ++filtY)
+				histogram.Add(grays[filtY * span + imgX + m_width - 1]);
 
-				for(filtX = 0; filtX < m_width; ++filtX)
+			// keep an RGB int so we can get from the median gray back to a color
+			int median = histogram.Median(count);
+			int rgb = 0;
+			for(int filtY = 0; filtY < m_height; ++filtY)
+			{
+				const unsigned char *gray = &grays[filtY * span + imgX];
+				for(int filtX = 0; filtX < m_width; ++filtX)
 				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX >= w) continue;
-
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX) * 3];
-
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
+					if(gray[filtX] != median)
+						continue;
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
+					unsigned char *p = window[filtY] + (imgX + filtX) * C;
+					int value = (p[0] << 16) + (p[1] << 8) + p[2];
+					if(value > rgb)
+						rgb = value;
 				}
 			}
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+			pout[imgX * C] = rgb >> 16;
+			pout[imgX * C + 1] = (rgb >> 8) & 0xff;
+			pout[imgX * C + 2] = rgb & 0xff;
+			if(C == 4)
+				pout[imgX * C + 3] = pin[imgX * C + 3];
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
+			for(int filtY = 0; filtY < m_height; ++filtY)
+				histogram.Remove(grays[filtY * span + imgX]);
 		}
 	}
 }
 
-void msaFilters::Dilate24(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// the distance between two color pixels, the sum of the differences of their color channels
+template <typename S, typename T>
+static inline S ColorDistance(const T *a, const T *b)
+{
+	S distance = 0;
+	for(int c = 0; c < 3; ++c)
+	{
+		S d = (S)a[c] - (S)b[c];
+		distance += d < 0 ? -d : d;
+	}
+	return distance;
+}
+
+/*
+	The vector median needs the distance from each pixel of the window to every other, which done
+	directly is the square of the window's area for each pixel.  Sliding along the line, a column
+	of the window leaves and one comes in, and the distances between the columns that stay don't
+	change, so each pixel keeps its distance to each column of the window and only the new column
+	is measured against the rest.  A pixel's total is the sum of its columns'.
+*/
+template <typename T, int C>
+void msaFilters::VectorMedianN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
 {
-	int imgX, imgY;
+	// bytes sum in an int, which any usable window holds, 16 bit samples in a long long, and
+	//  floats in a double
+	typedef typename conditional<is_floating_point<T>::value, double,
+			typename conditional<sizeof(T) == 1, int, long long>::type>::type S;
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
 	int startx = m_width / 2;
-	int endx = w - startx - 1;
 	int starty = m_height / 2;
-	int endy = h - starty - 1;
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+	BorderedLines<T, C> lines(input, w, h, bpl, startx, m_width - 1 - startx, starty, m_height - 1 - starty,
+			m_border, ToSample<T>(m_borderValue));
+
+	// the window's columns sit in a ring of m_width slots, by column modulo the width; the
+	//  distances from the pixel in a slot and row to each slot's column follow each other
+	vector<S> distances(m_width * m_height * m_width);
+	vector<int> slots(m_width);
+	// the new column's pixels, and the distances to them from a column already in the window
+	vector<const T *> pixels(m_height);
+	vector<S> theirs(m_height);
+
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		T *const *window = lines.Window(imgY);
+		T *pin = (T *)&input[imgY * bpl];
+		T *pout = (T *)&output[imgY * bpl];
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		for(int imgX = 0; imgX < w; ++imgX)
 		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
+			for(int filtX = 0; filtX < m_width; ++filtX)
+				slots[filtX] = (imgX + filtX) % m_width;
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			// the first pixel of a line brings in every column, the rest just the last
+			for(int filtX = imgX == 0 ? 0 : m_width - 1; filtX < m_width; ++filtX)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
+				int slot = slots[filtX];
+				const int column = (imgX + filtX) * C;
+				for(int row = 0; row < m_height; ++row)
+					pixels[row] = &window[row][column];
+
+				// against itself
+				for(int row = 0; row < m_height; ++row)
+				{
+					S total = 0;
+					for(int other = 0; other < m_height; ++other)
+						total += ColorDistance<S>(pixels[row], pixels[other]);
+					distances[(slot * m_height + row) * m_width + slot] = total;
+				}
+
+				// and the columns to its left, which get their distances to it at the same time
+				for(int left = 0; left < filtX; ++left)
 				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g > max)
+					int otherSlot = slots[left];
+					const int otherColumn = (imgX + left) * C;
+					fill(theirs.begin(), theirs.end(), 0);
+					for(int row = 0; row < m_height; ++row)
 					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
+						S total = 0;
+						for(int other = 0; other < m_height; ++other)
+						{
+							S d = ColorDistance<S>(pixels[row], &window[other][otherColumn]);
+							total += d;
+							theirs[other] += d;
+						}
+						distances[(slot * m_height + row) * m_width + otherSlot] = total;
 					}
+
+					for(int other = 0; other < m_height; ++other)
+						distances[(otherSlot * m_height + other) * m_width + slot] = theirs[other];
 				}
 			}
 
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-		}
-	}
-
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+			// the pixel with the least total distance, the first one if there's a tie
+			S best = 0;
+			const T *bestPixel = NULL;
+			for(int row = 0; row < m_height; ++row)
+			{
+				for(int filtX = 0; filtX < m_width; ++filtX)
+				{
+					const S *mine = &distances[(slots[filtX] * m_height + row) * m_width];
+					S total = 0;
+					for(int other = 0; other < m_width; ++other)
+						total += mine[other];
 
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g > max)
+					if(bestPixel == NULL || total < best)
 					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
+						best = total;
+						bestPixel = &window[row][(imgX + filtX) * C];
 					}
 				}
 			}
 
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-		}
-	}
-
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
-			}
+			for(int c = 0; c < 3; ++c)
+				pout[imgX * C + c] = bestPixel[c];
 
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
+			// alpha comes straight from the center pixel
+			if(C == 4)
+				pout[imgX * C + 3] = pin[imgX * C + 3];
 		}
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
-			}
+/*
+	Bitonal morphology works on whole 64 bit words, 64 pixels at a time.  Lines are loaded into
+	native words with the first pixel in the high bit, so moving pixels left along the line is a
+	left shift that carries in bits from the next word.  Dilate is an OR of shifted lines and erode
+	an AND; pixels off the edge of the image are filled with whatever doesn't change the result
+	(0 for OR, 1 for AND), which gives the same answer as repeating the edge pixels.
+*/
+typedef unsigned long long BitWord;
 
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-		}
+// copy a packed line into words, setting the bits past the end of the line to fill
+static void LoadBitLine(const unsigned char *line, int w, BitWord *words, BitWord fill)
+{
+	int count = (w + 63) / 64;
+	int bytes = (w + 7) / 8;
+	memset(words, 0, count * sizeof(BitWord));
+	memcpy(words, line, bytes);
+	for(int i = 0; i < count; ++i)
+	{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		words[i] = __builtin_bswap64(words[i]);
+#endif
 	}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 3];
-
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-		}
+	if(w % 64 != 0)
+	{
+		BitWord tail = ~0ULL >> (w % 64);
+		words[count - 1] = (words[count - 1] & ~tail) | (fill & tail);
 	}
 }
 
-void msaFilters::Erode24(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// copy words back out to a packed line, clearing the bits past the end of the line
+static void StoreBitLine(BitWord *words, int w, unsigned char *line)
 {
-	int imgX, imgY;
+	int count = (w + 63) / 64;
+	if(w % 64 != 0)
+		words[count - 1] &= ~(~0ULL >> (w % 64));
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;
+	for(int i = 0; i < count; ++i)
+	{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		words[i] = __builtin_bswap64(words[i]);
+#endif
+	}
+	memcpy(line, words, (w + 7) / 8);
+}
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+// dst pixel x gets src pixel x + shift, with fill coming in from past either end
+static void ShiftBitLine(const BitWord *src, BitWord *dst, int count, int shift, BitWord fill)
+{
+	int wordShift = (shift < 0 ? -shift : shift) / 64;
+	int bitShift = (shift < 0 ? -shift : shift) % 64;
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	for(int i = 0; i < count; ++i)
+	{
+		if(shift >= 0)
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
+			int j = i + wordShift;
+			BitWord a = j < count ? src[j] : fill;
+			BitWord b = j + 1 < count ? src[j + 1] : fill;
+			dst[i] = bitShift == 0 ? a : (a << bitShift) | (b >> (64 - bitShift));
 		}
-	}
-
-	// now deal with the edges
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
-
-		for(imgX = startx; imgX < endx; ++imgX)
+		else
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
+			int j = i - wordShift;
+			BitWord a = j >= 0 ? src[j] : fill;
+			BitWord b = j - 1 >= 0 ? src[j - 1] : fill;
+			dst[i] = bitShift == 0 ? a : (a >> bitShift) | (b << (64 - bitShift));
 		}
 	}
+}
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
+static void Morphology1(unsigned char *input, unsigned char *output, int w, int h, int bpl, int fw, int fh, int startx,
+		int starty, bool dilate)
+{
+	int count = (w + 63) / 64;
+	BitWord fill = dilate ? 0 : ~0ULL;
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
+	// lines get enough leading words of fill to hold the startx pixels left of the image
+	int pad = (startx + 63) / 64;
+	int total = pad + count;
 
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-		}
-	}
+	vector<BitWord> rows(h * count);
+	vector<BitWord> run(total);
+	vector<BitWord> shifted(total);
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
+	// horizontal pass; run holds the combination of pixels x to x + n - 1, and is built up by
+	//  doubling n, so a window of fw pixels takes about log2(fw) shifts rather than fw
+	for(int y = 0; y < h; ++y)
+	{
+		for(int i = 0; i < pad; ++i)
+			run[i] = fill;
+		LoadBitLine(&input[y * bpl], w, &run[pad], fill);
 
-		for(imgX = 0; imgX < startx; ++imgX)
+		for(int n = 1; n < fw; )
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
+			int m = n < fw - n ? n : fw - n;
+			ShiftBitLine(&run[0], &shifted[0], total, m, fill);
+			for(int i = 0; i < total; ++i)
+				run[i] = dilate ? run[i] | shifted[i] : run[i] & shifted[i];
+			n += m;
 		}
+
+		// then line the window up so it starts startx pixels to the left
+		ShiftBitLine(&run[0], &shifted[0], total, pad * 64 - startx, fill);
+		memcpy(&rows[y * count], &shifted[0], count * sizeof(BitWord));
 	}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 3];
+	// vertical pass, a whole word of pixels at a time; rows off the image are just skipped
+	for(int y = 0; y < h; ++y)
+	{
+		int top = y - starty < 0 ? 0 : y - starty;
+		int bottom = y - starty + fh > h ? h : y - starty + fh;
 
-		for(imgX = endx; imgX < w; ++imgX)
+		for(int i = 0; i < count; ++i)
+			run[i] = fill;
+		for(int filtY = top; filtY < bottom; ++filtY)
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
+			BitWord *row = &rows[filtY * count];
+			for(int i = 0; i < count; ++i)
+				run[i] = dilate ? run[i] | row[i] : run[i] & row[i];
 		}
+
+		StoreBitLine(&run[0], w, &output[y * bpl]);
+		memset(&output[y * bpl + (w + 7) / 8], 0, bpl - (w + 7) / 8);
 	}
 }
 
-
-void msaFilters::Filter24(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// a run of pixels along one line of a structuring element; index is the run's place in the
+//  element's list of run lengths
+struct ElementRun
 {
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_cx;
-	int endx = w - startx - 1;
-	int starty = m_cy;
-	int endy = h - starty - 1;
-
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
-
-		for(imgX = startx; imgX < endx; ++imgX)
+	int row;
+	int start;
+	int length;
+	int index;
+};
+
+// split each line of a w by h structuring element into runs, top to bottom and left to right, and
+//  list the different run lengths from shortest to longest
+static void ElementRuns(const vector<int> &mask, int w, int h, vector<ElementRun> &runs, vector<int> &lengths)
+{
+	runs.clear();
+	lengths.clear();
+	for(int y = 0; y < h; ++y)
+	{
+		for(int x = 0; x < w; )
 		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
+			if(mask[y * w + x] == 0)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 3];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-				}
+				++x;
+				continue;
 			}
 
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
+			ElementRun run = { y, x, 0, 0 };
+			while(x < w && mask[y * w + x] != 0)
+				++x;
+			run.length = x - run.start;
+			runs.push_back(run);
+			lengths.push_back(run.length);
 		}
 	}
 
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-				}
-			}
+	sort(lengths.begin(), lengths.end());
+	lengths.erase(unique(lengths.begin(), lengths.end()), lengths.end());
+	for(size_t i = 0; i < runs.size(); ++i)
+		runs[i].index = (int)(lower_bound(lengths.begin(), lengths.end(), runs[i].length) - lengths.begin());
+}
 
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
+/*
+	Bitonal morphology by a structuring element.  Each line of the image is combined along runs of
+	every length in the element, longest last, each length built from the one before by combining
+	it with itself shifted, the way the rectangle builds its width.  Each output line is then the
+	combination of one of those lines for each run of the element, shifted into place.  Lines get
+	leading words of fill, as in Morphology1(), for the runs that start left of the image.
+*/
+static void Morphology1Runs(unsigned char *input, unsigned char *output, int w, int h, int bpl,
+		const vector<int> &mask, int fw, int fh, int cx, int cy, bool dilate)
+{
+	int count = (w + 63) / 64;
+	BitWord fill = dilate ? 0 : ~0ULL;
 
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
+	vector<ElementRun> runs;
+	vector<int> lengths;
+	ElementRuns(mask, fw, fh, runs, lengths);
+	int lengthCount = (int)lengths.size();
 
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-		}
-	}
+	int pad = (cx + 63) / 64;
+	int total = pad + count;
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 3];
+	// the combined runs of each length for every line, line by line within each length
+	vector<BitWord> combined((size_t)lengthCount * h * total);
+	vector<BitWord> run(total);
+	vector<BitWord> shifted(total);
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	for(int y = 0; y < h; ++y)
+	{
+		for(int i = 0; i < pad; ++i)
+			run[i] = fill;
+		LoadBitLine(&input[y * bpl], w, &run[pad], fill);
+		int n = 1;
+		for(int k = 0; k < lengthCount; ++k)
 		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
+			while(n < lengths[k])
 			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue24(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-				}
+				int m = n < lengths[k] - n ? n : lengths[k] - n;
+				ShiftBitLine(&run[0], &shifted[0], total, m, fill);
+				for(int i = 0; i < total; ++i)
+					run[i] = dilate ? run[i] | shifted[i] : run[i] & shifted[i];
+				n += m;
 			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
+			memcpy(&combined[((size_t)k * h + y) * total], &run[0], total * sizeof(BitWord));
 		}
 	}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
+	for(int y = 0; y < h; ++y)
+	{
+		for(int i = 0; i < count; ++i)
+			run[i] = fill;
 
-		for(imgX = 0; imgX < startx; ++imgX)
+		for(size_t r = 0; r < runs.size(); ++r)
 		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
+			int line = y - cy + runs[r].row;
+			if(line < 0 || line >= h)
+				continue;
 
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
+			ShiftBitLine(&combined[((size_t)runs[r].index * h + line) * total], &shifted[0], total,
+					pad * 64 + runs[r].start - cx, fill);
+			for(int i = 0; i < count; ++i)
+				run[i] = dilate ? run[i] | shifted[i] : run[i] & shifted[i];
 		}
-	}
-
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 3];
-
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue24(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
 
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-		}
+		StoreBitLine(&run[0], w, &output[y * bpl]);
+		memset(&output[y * bpl + (w + 7) / 8], 0, bpl - (w + 7) / 8);
 	}
 }
 
-/*
-	For color values; since we're going to sort by gray values (the only way to really do a median filter) then
-	we need to have some way to get from the median value back to the source RGB value.
-*/
-void msaFilters::MedianFilter32(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// elements that fill their rectangle are separable, anything else goes by runs
+static void MorphologyBits(unsigned char *input, unsigned char *output, int w, int h, int bpl,
+		const vector<int> &mask, int fw, int fh, int cx, int cy, bool dilate)
 {
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;	
-
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)		
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
+	if(find(mask.begin(), mask.end(), 0) == mask.end())
+		Morphology1(input, output, w, h, bpl, fw, fh, cx, cy, dilate);
+	else
+		Morphology1Runs(input, output, w, h, bpl, mask, fw, fh, cx, cy, dilate);
+}
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
+void msaFilters::Dilate1(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<int> mask;
+	int cx, cy;
+	ElementMask(mask, cx, cy, false);
+	MorphologyBits(input, output, w, h, bpl, mask, m_width, m_height, cx, cy, true);
+}
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
+void msaFilters::Erode1(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<int> mask;
+	int cx, cy;
+	ElementMask(mask, cx, cy, false);
+	MorphologyBits(input, output, w, h, bpl, mask, m_width, m_height, cx, cy, false);
+}
 
-			// find median value
-			int total = m_count / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+// bitonal images are small enough that the passes just go through a whole temporary image
+void msaFilters::CompoundMorphology1(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<int> mask, reflected;
+	int cx, cy, rcx, rcy;
+	ElementMask(mask, cx, cy, false);
+	ElementMask(reflected, rcx, rcy, true);
+	vector<unsigned char> temp(h * bpl);
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-			*pout++ = alpha;
-		}
+	if(m_type == FilterType::Gradient)
+	{
+		MorphologyBits(input, output, w, h, bpl, mask, m_width, m_height, cx, cy, true);
+		MorphologyBits(input, &temp[0], w, h, bpl, mask, m_width, m_height, cx, cy, false);
+		for(int i = 0; i < h * bpl; ++i)
+			output[i] &= ~temp[i];
+		return;
 	}
 
-	// now deal with the edges
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
+	bool open = m_type == FilterType::Open || m_type == FilterType::TopHat;
+	MorphologyBits(input, &temp[0], w, h, bpl, mask, m_width, m_height, cx, cy, !open);
+	MorphologyBits(&temp[0], output, w, h, bpl, reflected, m_width, m_height, rcx, rcy, open);
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	if(m_type == FilterType::TopHat)
+	{
+		// the input's padding bits can be anything, so clear them again
+		int bytes = (w + 7) / 8;
+		for(int y = 0; y < h; ++y)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY < 0) continue;
-
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
-
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
-
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-			*pout++ = alpha;
+			unsigned char *in = &input[y * bpl];
+			unsigned char *out = &output[y * bpl];
+			for(int i = 0; i < bytes; ++i)
+				out[i] = in[i] & ~out[i];
+			if(w % 8 != 0)
+				out[bytes - 1] &= 0xff << (8 - w % 8);
 		}
 	}
-
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY >= h) continue;
-
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
-
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
-
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-			*pout++ = alpha;
-		}
+	else if(m_type == FilterType::BlackHat)
+	{
+		for(int i = 0; i < h * bpl; ++i)
+			output[i] &= ~input[i];
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
-
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX < 0) continue;
-
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX) * 4];
-
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
-
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
-
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-			*pout++ = alpha;
-		}
-	}
-
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 4];
-
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long colors[256] = {0};
-			long totalVals = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-			
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
-
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX >= w) continue;
-
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX) * 4];
+template <typename T, int C>
+void msaFilters::FilterGeneric(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	switch(m_type)
+	{
+	case FilterType::UserDefined:
+	case FilterType::Gaussian:
+	case FilterType::Sharpen:
+		Convolve<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Box:
+		BoxFilter<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::RecursiveGaussian:
+		RecursiveGaussianN<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::UnsharpMask:
+		UnsharpMaskN<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Bilateral:
+		if(sizeof(T) != 1)
+			throw "Bilateral filter is only for 8 bit samples";
+		BilateralBytes<C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Dilate:
+		DilateN<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Erode:
+		ErodeN<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Open:
+	case FilterType::Close:
+	case FilterType::TopHat:
+	case FilterType::BlackHat:
+	case FilterType::Gradient:
+		CompoundMorphologyN<T, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Median:
+		if(C >= 3 && m_median == MedianMode::Vector)
+			VectorMedianN<T, C>(input, output, w, h, bpl);
+		else if(sizeof(T) == 1)
+			MedianFilterBytes<C>(input, output, w, h, bpl);
+		else
+			MedianFilterN<T, C>(input, output, w, h, bpl);
+		break;
+	default:
+		throw "Invalid filter type";
+	}
+}
 
-					++totalVals;
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
 
-					int gray = RGBtoGray(r, g, b);
-					++count[gray];
 
-					// create an RGB int to store so we can obtain the median color later
-					int rgb = (((int)r) << 16) + (((int)g) << 8) + (int)b;
-					if(colors[gray] != 0)
-					{
-						if(rgb > colors[gray]) colors[gray] = rgb;
-					}
-					else
-						colors[gray] = rgb;
-					
-				}
-			}
+// brightness used to rank color pixels for morphology; integer samples sum exactly in an int
+template <typename T>
+using MorphologyKey = typename conditional<is_floating_point<T>::value, double, int>::type;
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+template <typename T, int C>
+inline MorphologyKey<T> PixelKey(const T *p)
+{
+	if(C >= 3)
+		return (MorphologyKey<T>)p[0] + p[1] + p[2];
+	return p[0];
+}
 
-			// set value and increment output pointer
-			*pout++ = colors[i] >> 16;
-			*pout++ = (colors[i] >> 8) & 0xff;
-			*pout++ = colors[i] & 0xff;
-			*pout++ = alpha;
-		}
+// out gets whichever of the pixels of a and b is larger, or smaller, by their keys, a when
+//  neither is, and its key goes with it; out can be a
+template <typename T, int C, bool Larger>
+static void PickPixels(const T *a, const MorphologyKey<T> *keysA, const T *b, const MorphologyKey<T> *keysB, T *out,
+		MorphologyKey<T> *keysOut, int count)
+{
+	for(int x = 0; x < count; ++x)
+	{
+		bool takeB = Larger ? keysB[x] > keysA[x] : keysB[x] < keysA[x];
+		const T *p = takeB ? &b[x * C] : &a[x * C];
+		keysOut[x] = takeB ? keysB[x] : keysA[x];
+		for(int c = 0; c < C; ++c)
+			out[x * C + c] = p[c];
 	}
 }
 
-void msaFilters::Dilate32(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+/*
+	Dilate or erode a line at a time, by a structuring element given as a mask.  Each line of the
+	element is split into runs, and each line of the window gets the best pixel of every run of
+	each length the element has, which the line keeps while it's in the window.  Those come from
+	the shortest up, each length built from the one before by picking between it and itself
+	shifted, at most doubling each time, so every length costs one or two passes along the line;
+	lengths that go up by a pixel or two at a time, like the lines of a disk, cost one each, and a
+	rectangle has just the one length.  An output line is then the best of one of those lines for
+	each run, shifted into place.
+
+	Runs are taken top to bottom and left to right, and a later one has to be strictly better to
+	replace an earlier one, so color pixels are picked whole by brightness, the first best in the
+	window.  Each line keeps the brightness of its pixels alongside them, so it's worked out once
+	for each pixel of the window's lines.  8 bit gray lines are picked between with the min and max
+	row kernels instead.  Alpha comes straight from the center pixel.
+*/
+template <typename T, int C>
+class MorphologyLines
 {
-	int imgX, imgY;
+public:
+	typedef MorphologyKey<T> Key;
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;
-
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
+	// lines has to reach cx pixels left, fw - 1 - cx right, cy lines up and fh - 1 - cy down
+	MorphologyLines(BorderedLines<T, C> &lines, int w, const vector<int> &mask, int fw, int fh, int cx, int cy,
+			bool dilate) : m_lines(lines)
+	{
+		m_width = w;
+		m_fh = fh;
+		m_cx = cx;
+		m_cy = cy;
+		m_dilate = dilate;
+		ElementRuns(mask, fw, fh, m_runs, m_lengths);
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		m_span = w + fw - 1;
+		m_samples = m_span * C;
+		m_ring.resize((size_t)fh * m_lengths.size() * m_samples);
+		m_held.assign(fh, numeric_limits<int>::min());
+		m_work.resize(m_samples);
+		if(!Bytes())
 		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-			*pout++ = alpha;
+			m_keyRing.resize((size_t)fh * m_lengths.size() * m_span);
+			m_workKeys.resize(m_span);
+			m_lineKeys.resize(m_span);
+			m_outKeys.resize(w);
 		}
 	}
 
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+	// output line y, which may be any line, though going down a line at a time is cheapest
+	void Line(int y, T *out)
+	{
+		T *const *window = m_lines.Window(y);
+		int lengthCount = (int)m_lengths.size();
+		for(int i = 0; i < m_fh; ++i)
+		{
+			int slot = Slot(y - m_cy + i);
+			if(m_held[slot] == y - m_cy + i)
+				continue;
+			m_held[slot] = y - m_cy + i;
+
+			const T *from = window[i];
+			const Key *fromKeys = NULL;
+			if(!Bytes())
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
+				for(int x = 0; x < m_span; ++x)
+					m_lineKeys[x] = PixelKey<T, C>(&from[x * C]);
+				fromKeys = &m_lineKeys[0];
 			}
 
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-			*pout++ = alpha;
-		}
-	}
-
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			int n = 1;
+			for(int k = 0; k < lengthCount; ++k)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-			*pout++ = alpha;
-		}
-	}
-
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
+				size_t index = (size_t)slot * lengthCount + k;
+				T *to = &m_ring[index * m_samples];
+				Key *toKeys = Bytes() ? NULL : &m_keyRing[index * m_span];
+				if(m_lengths[k] == 1)
 				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					pin++;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
+					memcpy(to, from, m_samples * sizeof(T));
+					if(!Bytes())
+						memcpy(toKeys, fromKeys, m_span * sizeof(Key));
 				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-			*pout++ = alpha;
-		}
-	}
-
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 4];
-
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			long rmax = 0;
-			long gmax = 0;
-			long bmax = 0;
-			long max = 0;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
+				while(n < m_lengths[k])
 				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g > max)
-					{
-						rmax = r;
-						gmax = g;
-						bmax = b;
-						max = r + g + b;
-					}
+					int m = n < m_lengths[k] - n ? n : m_lengths[k] - n;
+					bool last = n + m == m_lengths[k];
+					T *next = last ? to : &m_work[0];
+					Key *nextKeys = last ? toKeys : (Bytes() ? NULL : &m_workKeys[0]);
+					Pick(from, fromKeys, from + m * C, fromKeys + m, next, nextKeys, m_span - n - m + 1);
+					from = next;
+					fromKeys = nextKeys;
+					n += m;
 				}
 			}
-
-			// set value and increment output pointer
-			*pout++ = rmax;
-			*pout++ = gmax;
-			*pout++ = bmax;
-			*pout++ = alpha;
 		}
-	}
-}
-
-void msaFilters::Erode32(unsigned char *input, unsigned char *output, int w, int h, int bpl)
-{
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
+		for(size_t r = 0; r < m_runs.size(); ++r)
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			size_t index = (size_t)Slot(y - m_cy + m_runs[r].row) * lengthCount + m_runs[r].index;
+			const T *from = &m_ring[index * m_samples + m_runs[r].start * C];
+			const Key *fromKeys = Bytes() ? NULL : &m_keyRing[index * m_span + m_runs[r].start];
+			if(r == 0)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
+				memcpy(out, from, m_width * C * sizeof(T));
+				if(!Bytes())
+					memcpy(&m_outKeys[0], fromKeys, m_width * sizeof(Key));
 			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-			*pout++ = alpha;
-		}
-	}
-
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			else
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
+				Key *outKeys = Bytes() ? NULL : &m_outKeys[0];
+				Pick(out, outKeys, from, fromKeys, out, outKeys, m_width);
 			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-			*pout++ = alpha;
 		}
-	}
-
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		if(C == 4)
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-			*pout++ = alpha;
+			const T *center = window[m_cy] + m_cx * C;
+			for(int x = 0; x < m_width; ++x)
+				out[x * C + 3] = center[x * C + 3];
 		}
 	}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
+protected:
+	BorderedLines<T, C> &m_lines;
+	int m_width;
+	int m_fh;
+	int m_cx;
+	int m_cy;
+	bool m_dilate;
+	int m_span;
+	int m_samples;
+	vector<ElementRun> m_runs;
+	vector<int> m_lengths;
 
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
+	// the runs of each line of the window, every length of them, in a ring like the window's
+	//  lines, and their keys; held is the image line each slot has
+	vector<T> m_ring;
+	vector<Key> m_keyRing;
+	vector<int> m_held;
+	vector<T> m_work;
+	vector<Key> m_workKeys;
+	vector<Key> m_lineKeys;
+	vector<Key> m_outKeys;
 
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-			*pout++ = alpha;
-		}
+	static bool Bytes()
+	{
+		return sizeof(T) == 1 && C == 1;
 	}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 4];
+	int Slot(int line)
+	{
+		int slot = line % m_fh;
+		return slot < 0 ? slot + m_fh : slot;
+	}
 
-		for(imgX = endx; imgX < w; ++imgX)
+	void Pick(const T *a, const Key *keysA, const T *b, const Key *keysB, T *out, Key *keysOut, int count)
+	{
+		if(Bytes())
 		{
-			long rmin = 255;
-			long gmin = 255;
-			long bmin = 255;
-			long min = 255 * 3;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char r = *pin++;
-					unsigned char g = *pin++;
-					unsigned char b = *pin++;
-					++pin;
-					if(r + b + g < min)
-					{
-						rmin = r;
-						gmin = g;
-						bmin = b;
-						min = r + g + b;
-					}
-				}
-			}
-
-			// set value and increment output pointer
-			*pout++ = rmin;
-			*pout++ = gmin;
-			*pout++ = bmin;
-			*pout++ = alpha;
+			if(m_dilate)
+				MaxRowsBytes((const unsigned char *)a, (const unsigned char *)b, (unsigned char *)out, count);
+			else
+				MinRowsBytes((const unsigned char *)a, (const unsigned char *)b, (unsigned char *)out, count);
 		}
+		else if(m_dilate)
+			PickPixels<T, C, true>(a, keysA, b, keysB, out, keysOut, count);
+		else
+			PickPixels<T, C, false>(a, keysA, b, keysB, out, keysOut, count);
 	}
-}
-
+};
 
-void msaFilters::Filter32(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// window lines read from the output of a morphology pass rather than from an image, so one pass
+//  feeds the next a line at a time
+template <typename T, int C>
+class ChainedLines : public BorderedLines<T, C>
 {
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_cx;
-	int endx = w - startx - 1;
-	int starty = m_cy;
-	int endy = h - starty - 1;
-
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx) * 4];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-					++pin;
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-			*pout++ = alpha;
-		}
+public:
+	ChainedLines(MorphologyLines<T, C> &pass, int w, int h, int left, int right, int top, int bottom,
+			msaFilters::BorderMode mode, T value) :
+		BorderedLines<T, C>(NULL, w, h, 0, left, right, top, bottom, mode, value, true), m_pass(pass), m_line(w * C)
+	{
 	}
 
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-					++pin;
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
+protected:
+	MorphologyLines<T, C> &m_pass;
+	vector<T> m_line;
 
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-			*pout++ = alpha;
-		}
+	const T *Source(int line)
+	{
+		m_pass.Line(line, &m_line[0]);
+		return &m_line[0];
 	}
+};
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx * 4];
-
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue32(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-					++pin;
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-			*pout++ = alpha;
-		}
+void msaFilters::ElementMask(vector<int> &mask, int &cx, int &cy, bool reflect)
+{
+	mask = m_values;
+	if(mask.empty())
+		mask.assign(m_width * m_height, 1);
+	cx = m_cx;
+	cy = m_cy;
+
+	// turned half way round, each offset from the center becomes its negative
+	if(reflect)
+	{
+		reverse(mask.begin(), mask.end());
+		cx = m_width - 1 - cx;
+		cy = m_height - 1 - cy;
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-					++pin;
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
+template <typename T, int C>
+void msaFilters::DilateN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<int> mask;
+	int cx, cy;
+	ElementMask(mask, cx, cy, false);
 
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
+	BorderedLines<T, C> lines(input, w, h, bpl, cx, m_width - 1 - cx, cy, m_height - 1 - cy, m_border,
+			ToSample<T>(m_borderValue));
+	MorphologyLines<T, C> dilate(lines, w, mask, m_width, m_height, cx, cy, true);
+	for(int y = 0; y < h; ++y)
+		dilate.Line(y, (T *)&output[y * bpl]);
+}
 
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-			*pout++ = alpha;
-		}
-	}
+template <typename T, int C>
+void msaFilters::ErodeN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<int> mask;
+	int cx, cy;
+	ElementMask(mask, cx, cy, false);
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx * 4];
+	BorderedLines<T, C> lines(input, w, h, bpl, cx, m_width - 1 - cx, cy, m_height - 1 - cy, m_border,
+			ToSample<T>(m_borderValue));
+	MorphologyLines<T, C> erode(lines, w, mask, m_width, m_height, cx, cy, false);
+	for(int y = 0; y < h; ++y)
+		erode.Line(y, (T *)&output[y * bpl]);
+}
 
-		for(imgX = endx; imgX < w; ++imgX)
+// a - b for each color channel, not below 0 for integer samples; alpha is left alone
+template <typename T, int C>
+static void SubtractLine(const T *a, const T *b, T *out, int w)
+{
+	const int colors = C >= 3 ? 3 : C;
+	for(int x = 0; x < w; ++x)
+	{
+		for(int c = 0; c < colors; ++c)
 		{
-			long rsum = m_divisor / 2;	// for rounding purposes
-			long gsum = m_divisor / 2;
-			long bsum = m_divisor / 2;
-			unsigned char alpha = input[imgY * bpl + imgX * 4 + 3];
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue32(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-
-					rsum += *pin++ * m_values[filtVal];
-					gsum += *pin++ * m_values[filtVal];
-					bsum += *pin++ * m_values[filtVal++];
-					++pin;
-				}
-			}
-
-			rsum /= m_divisor;
-			gsum /= m_divisor;
-			bsum /= m_divisor;
-
-			if(rsum > 255) rsum = 255;
-			if(gsum > 255) gsum = 255;
-			if(bsum > 255) bsum = 255;
-			if(rsum < 0) rsum = 0;
-			if(gsum < 0) gsum = 0;
-			if(bsum < 0) bsum = 0;
-
-			// set value and increment output pointer
-			*pout++ = rsum;
-			*pout++ = gsum;
-			*pout++ = bsum;
-			*pout++ = alpha;
+			T va = a[x * C + c];
+			T vb = b[x * C + c];
+			out[x * C + c] = is_floating_point<T>::value || va > vb ? (T)(va - vb) : (T)0;
 		}
 	}
 }
 
-void msaFilters::MedianFilter8(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+/*
+	Opening, closing, the top-hats and the gradient.  The second pass of an opening or closing
+	reads the first pass's lines as they come out, through a window ring of its own, so there is
+	never more of the first pass than the window's lines; lines past the edges come from the border
+	mode applied to the first pass, the same as filtering its output as an image.  The gradient
+	runs both passes on the same window.  The differences are per channel, with alpha straight
+	from the center pixel.
+*/
+template <typename T, int C>
+void msaFilters::CompoundMorphologyN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
 {
-	int imgX, imgY;
-
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;	
+	vector<int> mask, reflected;
+	int cx, cy, rcx, rcy;
+	ElementMask(mask, cx, cy, false);
+	ElementMask(reflected, rcx, rcy, true);
+	T value = ToSample<T>(m_borderValue);
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	BorderedLines<T, C> lines(input, w, h, bpl, cx, m_width - 1 - cx, cy, m_height - 1 - cy, m_border, value);
+	vector<T> line(w * C);
 
-		for(imgX = startx; imgX < endx; ++imgX)		
+	if(m_type == FilterType::Gradient)
+	{
+		MorphologyLines<T, C> dilate(lines, w, mask, m_width, m_height, cx, cy, true);
+		MorphologyLines<T, C> erode(lines, w, mask, m_width, m_height, cx, cy, false);
+		for(int y = 0; y < h; ++y)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++count[*pin++];
-				}
-			}
-
-			// find median value
-			int total = m_count / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = i;
+			T *pout = (T *)&output[y * bpl];
+			dilate.Line(y, pout);
+			erode.Line(y, &line[0]);
+			SubtractLine<T, C>(pout, &line[0], pout, w);
 		}
+		return;
 	}
 
-	// now deal with the edges
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	// opening erodes and then dilates, closing the other way round
+	bool open = m_type == FilterType::Open || m_type == FilterType::TopHat;
+	MorphologyLines<T, C> first(lines, w, mask, m_width, m_height, cx, cy, !open);
+	ChainedLines<T, C> chained(first, w, h, rcx, m_width - 1 - rcx, rcy, m_height - 1 - rcy, m_border, value);
+	MorphologyLines<T, C> second(chained, w, reflected, m_width, m_height, rcx, rcy, open);
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	for(int y = 0; y < h; ++y)
+	{
+		T *pin = (T *)&input[y * bpl];
+		T *pout = (T *)&output[y * bpl];
+		if(m_type == FilterType::Open || m_type == FilterType::Close)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long totalVals = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY < 0) continue;
-
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					++count[*pin++];
-				}
-			}
-
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = i;
+			second.Line(y, pout);
+			continue;
 		}
+
+		second.Line(y, &line[0]);
+		if(m_type == FilterType::TopHat)
+			SubtractLine<T, C>(pin, &line[0], pout, w);
+		else
+			SubtractLine<T, C>(&line[0], pin, pout, w);
+		if(C == 4)
+			for(int x = 0; x < w; ++x)
+				pout[x * C + 3] = pin[x * C + 3];
 	}
+}
+
+// the median of each channel of a 3x3 or 5x5 window by a sorting network, for the sample types
+//  with no row kernel for it; alpha comes straight from the center pixel
+template <typename T, int C>
+static void MedianNetworkN(unsigned char *input, unsigned char *output, int w, int h, int bpl, int size,
+		msaFilters::BorderMode mode, T value)
+{
+	int start = size / 2;
+	BorderedLines<T, C> lines(input, w, h, bpl, start, start, start, start, mode, value);
+	const int colors = C >= 3 ? 3 : C;
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	T p[25];
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		T *const *window = lines.Window(imgY);
+		T *pin = (T *)&input[imgY * bpl];
+		T *pout = (T *)&output[imgY * bpl];
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		for(int imgX = 0; imgX < w; ++imgX)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long totalVals = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			for(int c = 0; c < colors; ++c)
 			{
-				// skip the row if it takes us out of bounds
-				if(imgY - starty + filtY >= h) continue;
+				for(int filtY = 0; filtY < size; ++filtY)
+					for(int filtX = 0; filtX < size; ++filtX)
+						p[filtY * size + filtX] = window[filtY][(imgX + filtX) * C + c];
 
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					++totalVals;
-					++count[*pin++];
-				}
+				pout[imgX * C + c] = size == 3 ? Median9<T, ScalarMinMax<T> >(p) : Median25<T, ScalarMinMax<T> >(p);
 			}
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = i;
+			if(C == 4)
+				pout[imgX * C + 3] = pin[imgX * C + 3];
 		}
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long totalVals = 0;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
-
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX < 0) continue;
-
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX)];
+/*
+	A full histogram of 16 bit values is too big to clear for every pixel, so the median is found
+	in two steps: a coarse histogram of the top 8 bits finds the bucket holding the median, then a
+	fine histogram of the low 8 bits of just the values in that bucket finds the value itself.
+	Each color channel is ranked separately, and alpha comes straight from the center pixel.
+*/
+template <typename T, int C>
+void msaFilters::MedianFilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	if(m_width == m_height && (m_width == 3 || m_width == 5))
+	{
+		MedianNetworkN<T, C>(input, output, w, h, bpl, m_width, m_border, ToSample<T>(m_borderValue));
+		return;
+	}
 
-					++totalVals;
-					++count[*pin];
-				}
-			}
+	int startx = m_width / 2;
+	int starty = m_height / 2;
+	int shift = 8 * sizeof(T) - 8;
+	int fineMask = (1 << shift) - 1;
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
-			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
+	BorderedLines<T, C> lines(input, w, h, bpl, startx, m_width - 1 - startx, starty, m_height - 1 - starty,
+			m_border, ToSample<T>(m_borderValue));
 
-			// set value and increment output pointer
-			*pout++ = i;
-		}
-	}
+	int colors = C >= 3 ? 3 : C;
+	vector<long> fine(fineMask + 1);
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx];
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		T *const *window = lines.Window(imgY);
+		T *pout = (T *)&output[imgY * bpl];
 
-		for(imgX = endx; imgX < w; ++imgX)
+		for(int imgX = 0; imgX < w; ++imgX)
 		{
-			// set and zero out array containing the count of values
-			long count[256] = {0};
-			long totalVals = 0;
-			
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			for(int c = 0; c < colors; ++c)
 			{
-				// skip the row if it takes us out of bounds
-				if((imgY - starty + filtY >= h) || (imgY - starty + filtY < 0)) continue;
+				long coarse[256] = {0};
+				for(int filtY = 0; filtY < m_height; ++filtY)
+				{
+					T *p = window[filtY] + imgX * C + c;
+					for(int filtX = 0; filtX < m_width; ++filtX, p += C)
+						++coarse[*p >> shift];
+				}
 
-				for(filtX = 0; filtX < m_width; ++filtX)
+				// find the bucket holding the median, counting down from the top like the 8 bit filters
+				long total = m_width * m_height / 2;
+				int bucket;
+				for(bucket = 255; bucket > 0; --bucket)
 				{
-					// skip the column if it takes us out of bounds
-					if(imgX - startx + filtX >= w) continue;
+					if(total - coarse[bucket] < 0)
+						break;
+					total -= coarse[bucket];
+				}
 
-					unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx + filtX)];
+				// now rank just the values in that bucket
+				fill(fine.begin(), fine.end(), 0);
+				for(int filtY = 0; filtY < m_height; ++filtY)
+				{
+					T *p = window[filtY] + imgX * C + c;
+					for(int filtX = 0; filtX < m_width; ++filtX, p += C)
+						if((*p >> shift) == bucket)
+							++fine[*p & fineMask];
+				}
 
-					++totalVals;
-					++count[*pin];
+				int i;
+				for(i = fineMask; i > 0; --i)
+				{
+					total -= fine[i];
+					if(total < 0)
+						break;
 				}
+
+				*pout++ = (T)((bucket << shift) + i);
 			}
 
-			// find median value
-			int total = totalVals / 2;
-			int i;
-			for(i = 255; i >= 0; --i)
+			if(C == 4)
 			{
-				total -= count[i];
-				if(total < 0)
-					break;
-			}			
-
-			// set value and increment output pointer
-			*pout++ = i;
+				*pout = ((T *)&input[imgY * bpl])[imgX * C + 3];
+				++pout;
+			}
 		}
 	}
 }
 
-void msaFilters::Dilate8(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+/*
+	The box filter keeps a running sum down each column of the window, updated with one line in and
+	one line out as it moves down the image, and runs along those column sums the same way for each
+	output line; so the cost per pixel is a few adds, whatever the window size.  Edges follow the
+	border mode, so the results match a uniform kernel through the convolution exactly.
+*/
+static inline double BoxMean(double sum, double area)
+{
+	return sum / area;
+}
+
+template <typename S>
+static inline S BoxMean(S sum, S area)
 {
-	int imgX, imgY;
+	return (sum + area / 2) / area;
+}
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;
+template <typename T, int C, typename S>
+void msaFilters::BoxFilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	int samples = (w + m_width - 1) * C;
+	S area = (S)m_width * m_height;
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	// the window reaches one line further up for the line leaving it, so the first line of each
+	//  window is that one and the rest are the window itself
+	BorderedLines<T, C> lines(input, w, h, bpl, m_cx, m_width - 1 - m_cx, m_cy + 1, m_height - 1 - m_cy, m_border,
+			ToSample<T>(m_borderValue));
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	// integer sums are unsigned, so a line going out of the window can wrap below zero and back
+	vector<S> columns(samples, 0);
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		T *const *window = lines.Window(imgY);
+		if(imgY == 0)
+		{
+			for(int filtY = 1; filtY <= m_height; ++filtY)
+				for(int i = 0; i < samples; ++i)
+					columns[i] += window[filtY][i];
+		}
+		else
 		{
-			long max = 0;
+			T *in = window[m_height];
+			T *out = window[0];
+			for(int i = 0; i < samples; ++i)
+				columns[i] += (S)in[i] - (S)out[i];
+		}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+		S sums[C];
+		for(int c = 0; c < C; ++c)
+			sums[c] = 0;
+		for(int filtX = 0; filtX < m_width; ++filtX)
+			for(int c = 0; c < C; ++c)
+				sums[c] += columns[filtX * C + c];
+
+		T *line = (T *)&input[imgY * bpl];
+		T *pout = (T *)&output[imgY * bpl];
+		for(int imgX = 0; imgX < w; ++imgX)
+		{
+			if(imgX > 0)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char g = *pin++;
-					if(g > max)
-						max = g;
-				}
+				int in = (imgX + m_width - 1) * C;
+				int out = (imgX - 1) * C;
+				for(int c = 0; c < C; ++c)
+					sums[c] += columns[in + c] - columns[out + c];
 			}
 
-			// set value and increment output pointer
-			*pout++ = max;
+			// alpha isn't filtered, it comes from the center pixel
+			for(int c = 0; c < (C == 4 ? 3 : C); ++c)
+				pout[imgX * C + c] = (T)BoxMean(sums[c], area);
+			if(C == 4)
+				pout[imgX * C + 3] = line[imgX * C + 3];
 		}
 	}
+}
 
-	// now deal with the edges
-
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+// pick the sum type: 32 bits where the largest window sum fits, which covers any sensible 8 bit
+//  window, 64 bits otherwise, and double for float images
+template <typename T, int C>
+void msaFilters::BoxFilter(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	if(is_floating_point<T>::value)
+		BoxFilterN<T, C, double>(input, output, w, h, bpl);
+	else if((unsigned long long)numeric_limits<T>::max() * m_width * m_height <= 0xFFFFFFFFULL)
+		BoxFilterN<T, C, unsigned int>(input, output, w, h, bpl);
+	else
+		BoxFilterN<T, C, unsigned long long>(input, output, w, h, bpl);
+}
 
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long max = 0;
+/*
+	Young and van Vliet's recursive Gaussian runs a third order filter forward along each line and
+	then backward, so each sample costs the same six multiplies whatever the sigma.  The filter's
+	poles are the fixed ones Young, van Vliet and van Ginkel fitted to a Gaussian ("Recursive Gabor
+	filtering", 2002), scaled so that the whole filter's variance is exactly sigma squared.  Lines
+	are filtered horizontally into a float image and then vertically, all rows at once, into the
+	output; the recursion itself is kept in doubles, since for large sigmas its gain on the input
+	is tiny and floats would lose the signal.
+
+	Edges always repeat the edge pixels, whatever the border mode.  Ahead of a line that's a
+	constant, which the forward pass has settled on, so it starts there.  The backward pass has to
+	start from where it would be after the whole clamped tail past the end, which Triggs and Sdika
+	showed is a fixed 3x3 matrix of the forward pass's last three outputs; that's worked out here
+	by running the tail once for each output when the coefficients are set up.
+
+	Against a true Gaussian convolution with the same edges, 8 bit results are within 3 levels, and
+	on average within a third of one, for sigmas from 1.5 up, however large; from 0.8 they can be 6
+	levels off on noise, and at 0.5 far more, as no third order filter follows a Gaussian that
+	narrow.  Against the Gaussian kernel of the size SetType() maps to, which stops at 2.5 sigma
+	and rounds its values, results are within 3 levels for sizes from 5 up; the 3 pixel kernel is
+	barely a blur at all, so it's nothing like the recursive filter at sigma 0.5.
+*/
+class RecursiveGaussianCoefficients
+{
+public:
+	double b;		// gain on the input sample
+	double a[3];	// feedback from the last three outputs
+	double m[3][3];	// backward state past the end of a line, from the forward deviations
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+	RecursiveGaussianCoefficients(double sigma)
+	{
+		// find the scale q that gives the poles 1 / d^(1/q) the right variance, which is the sum
+		//  of 2 p / (1 - p)^2 over them, and grows with q
+		const complex<double> d1(1.41650, 1.00829);
+		const double d3 = 1.86543;
+		double lo = 0.0, hi = 2.0 * sigma + 10.0;
+		for(int i = 0; i < 100; ++i)
+		{
+			double q = (lo + hi) / 2.0;
+			complex<double> p1 = 1.0 / pow(d1, 1.0 / q);
+			double p3 = 1.0 / pow(d3, 1.0 / q);
+			double variance = 4.0 * (p1 / ((1.0 - p1) * (1.0 - p1))).real() + 2.0 * p3 / ((1.0 - p3) * (1.0 - p3));
+			if(variance < sigma * sigma)
+				lo = q;
+			else
+				hi = q;
+		}
+
+		// multiply out (1 - p1 / z)(1 - p2 / z)(1 - p3 / z), p2 being p1's conjugate
+		double q = (lo + hi) / 2.0;
+		complex<double> p1 = 1.0 / pow(d1, 1.0 / q);
+		double p3 = 1.0 / pow(d3, 1.0 / q);
+		double sum = 2.0 * p1.real();
+		double product = norm(p1);
+		a[0] = sum + p3;
+		a[1] = -(product + sum * p3);
+		a[2] = product * p3;
+		b = 1.0 - (a[0] + a[1] + a[2]);
+
+		// past the end the input is constant, so relative to it the forward outputs just decay
+		//  from their last three values; run that decay until it's gone, then the backward pass
+		//  over it, once for each of the three values
+		for(int j = 0; j < 3; ++j)
+		{
+			vector<double> tail;
+			double w1 = j == 0 ? 1.0 : 0.0, w2 = j == 1 ? 1.0 : 0.0, w3 = j == 2 ? 1.0 : 0.0;
+			while(tail.size() < 3 || fabs(w1) + fabs(w2) + fabs(w3) > 1e-15)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char g = *pin++;
-					if( g > max)
-						max = g;
-				}
+				double v = a[0] * w1 + a[1] * w2 + a[2] * w3;
+				w3 = w2;
+				w2 = w1;
+				w1 = v;
+				tail.push_back(v);
 			}
 
-			// set value and increment output pointer
-			*pout++ = max;
+			double y1 = 0.0, y2 = 0.0, y3 = 0.0;
+			for(int i = (int)tail.size() - 1; i >= 0; --i)
+			{
+				double v = b * tail[i] + a[0] * y1 + a[1] * y2 + a[2] * y3;
+				y3 = y2;
+				y2 = y1;
+				y1 = v;
+				if(i < 3)
+					m[i][j] = v;
+			}
 		}
 	}
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	// the backward pass's three outputs past the end, given the forward pass's last three and
+	//  the last input
+	void EndState(double w1, double w2, double w3, double last, double &y1, double &y2, double &y3) const
+	{
+		w1 -= last;
+		w2 -= last;
+		w3 -= last;
+		y1 = last + m[0][0] * w1 + m[0][1] * w2 + m[0][2] * w3;
+		y2 = last + m[1][0] * w1 + m[1][1] * w2 + m[1][2] * w3;
+		y3 = last + m[2][0] * w1 + m[2][1] * w2 + m[2][2] * w3;
+	}
+};
+
+// filter L interleaved lines of count samples each, forward and then backward in place; each
+//  sample depends on the ones just before it, so running several lines together keeps the
+//  processor busy while it waits on them
+template <int L>
+static void RecursiveGaussianLines(double *lines, int count, const RecursiveGaussianCoefficients &k)
+{
+	double w1[L], w2[L], w3[L], last[L];
+	for(int l = 0; l < L; ++l)
+	{
+		w1[l] = w2[l] = w3[l] = lines[l];
+		last[l] = lines[(count - 1) * L + l];
+	}
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	for(int i = 0; i < count; ++i)
+	{
+		double *p = &lines[i * L];
+		for(int l = 0; l < L; ++l)
 		{
-			long max = 0;
+			double v = k.b * p[l] + k.a[0] * w1[l] + k.a[1] * w2[l] + k.a[2] * w3[l];
+			w3[l] = w2[l];
+			w2[l] = w1[l];
+			w1[l] = v;
+			p[l] = v;
+		}
+	}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char g = *pin++;
-					if(g > max)
-						max = g;
-				}
-			}
+	double y1[L], y2[L], y3[L];
+	for(int l = 0; l < L; ++l)
+		k.EndState(w1[l], w2[l], w3[l], last[l], y1[l], y2[l], y3[l]);
 
-			// set value and increment output pointer
-			*pout++ = max;
+	for(int i = count - 1; i >= 0; --i)
+	{
+		double *p = &lines[i * L];
+		for(int l = 0; l < L; ++l)
+		{
+			double v = k.b * p[l] + k.a[0] * y1[l] + k.a[1] * y2[l] + k.a[2] * y3[l];
+			y3[l] = y2[l];
+			y2[l] = y1[l];
+			y1[l] = v;
+			p[l] = v;
 		}
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
-
-		for(imgX = 0; imgX < startx; ++imgX)
+// both passes of the recursive Gaussian; the last one goes up the image, handing each line of the
+//  blur to finish(y, blur) to make the output from
+template <typename T, int C, typename Finish>
+static void RecursiveGaussianPasses(unsigned char *input, int w, int h, int bpl, double sigmaX, double sigmaY,
+		Finish finish)
+{
+	RecursiveGaussianCoefficients kx(sigmaX);
+	RecursiveGaussianCoefficients ky(sigmaY);
+
+	int samples = w * C;
+
+	// horizontal pass, a few lines at a time interleaved into one buffer, into a float image;
+	//  alpha is filtered along with the colors but replaced at the end, it isn't filtered
+	const int rows = C == 1 ? 4 : 2;
+	const int lanes = rows * C;
+	vector<float> temp((size_t)samples * h);
+	vector<double> lines((size_t)w * lanes);
+	for(int y = 0; y < h; y += rows)
+	{
+		// past the bottom the last line is filtered again, and thrown away
+		for(int r = 0; r < rows; ++r)
 		{
-			long max = 0;
+			T *pin = (T *)&input[ClipIndex(y + r, h) * bpl];
+			for(int x = 0; x < w; ++x)
+				for(int c = 0; c < C; ++c)
+					lines[x * lanes + r * C + c] = pin[x * C + c];
+		}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char g = *pin;
-					if(g > max)
-						max = g;
-				}
-			}
+		RecursiveGaussianLines<lanes>(&lines[0], w, kx);
 
-			// set value and increment output pointer
-			*pout++ = max;
+		for(int r = 0; r < rows && y + r < h; ++r)
+		{
+			float *ptemp = &temp[(size_t)(y + r) * samples];
+			for(int x = 0; x < w; ++x)
+				for(int c = 0; c < C; ++c)
+					ptemp[x * C + c] = (float)lines[x * lanes + r * C + c];
 		}
 	}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx];
+	// vertical forward pass down all the columns at once, keeping the last three rows of outputs
+	//  in doubles and writing each row over the temporary one it came from
+	vector<double> state(samples * 3);
+	double *w1 = &state[0], *w2 = &state[samples], *w3 = &state[samples * 2];
+	vector<double> last(temp.end() - samples, temp.end());
+	for(int i = 0; i < samples; ++i)
+		w1[i] = w2[i] = w3[i] = temp[i];
 
-		for(imgX = endx; imgX < w; ++imgX)
+	for(int y = 0; y < h; ++y)
+	{
+		float *ptemp = &temp[(size_t)y * samples];
+		// the oldest row becomes the newest
+		double *v = w3;
+		for(int i = 0; i < samples; ++i)
 		{
-			long max = 0;
+			v[i] = ky.b * ptemp[i] + ky.a[0] * w1[i] + ky.a[1] * w2[i] + ky.a[2] * w3[i];
+			ptemp[i] = (float)v[i];
+		}
+		w3 = w2;
+		w2 = w1;
+		w1 = v;
+	}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char g = *pin;
-					if(g > max)
-						max = g;
-				}
-			}
+	// backward pass up the columns, starting from the clamped tail below the image
+	vector<double> backState(samples * 3);
+	double *y1 = &backState[0], *y2 = &backState[samples], *y3 = &backState[samples * 2];
+	for(int i = 0; i < samples; ++i)
+		ky.EndState(w1[i], w2[i], w3[i], last[i], y1[i], y2[i], y3[i]);
 
-			// set value and increment output pointer
-			*pout++ = max;
-		}
+	for(int y = h - 1; y >= 0; --y)
+	{
+		float *ptemp = &temp[(size_t)y * samples];
+		double *v = y3;
+		for(int i = 0; i < samples; ++i)
+			v[i] = ky.b * ptemp[i] + ky.a[0] * y1[i] + ky.a[1] * y2[i] + ky.a[2] * y3[i];
+		finish(y, (const double *)v);
+		y3 = y2;
+		y2 = y1;
+		y1 = v;
 	}
 }
 
-void msaFilters::Erode8(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+template <typename T, int C>
+void msaFilters::RecursiveGaussianN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
 {
-	int imgX, imgY;
+	RecursiveGaussianPasses<T, C>(input, w, h, bpl, m_sigmaX, m_sigmaY, [&](int y, const double *blur)
+	{
+		T *pin = (T *)&input[y * bpl];
+		T *pout = (T *)&output[y * bpl];
+		for(int i = 0; i < w * C; ++i)
+			pout[i] = ToSample<T>(blur[i]);
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_width / 2;
-	int endx = w - startx - 1;
-	int starty = m_height / 2;
-	int endy = h - starty - 1;
+		// alpha comes from the center pixel
+		if(C == 4)
+		{
+			for(int x = 0; x < w; ++x)
+				pout[x * C + 3] = pin[x * C + 3];
+		}
+	});
+}
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+/*
+	Unsharp mask on the recursive Gaussian, so the cost is the same for any radius.  Each line of
+	the blur is used as it comes out of the last pass: the output moves away from the blur by
+	amount times the pixel's difference from it, unless that difference is under the threshold,
+	and is rounded and clamped just once.  Alpha comes from the center pixel.
+*/
+template <typename T, int C>
+void msaFilters::UnsharpMaskN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	const int colors = C >= 3 ? 3 : C;
+	double amount = m_amount;
+	double threshold = m_threshold;
 
-		for(imgX = startx; imgX < endx; ++imgX)
+	RecursiveGaussianPasses<T, C>(input, w, h, bpl, m_sigmaX, m_sigmaY, [&](int y, const double *blur)
+	{
+		T *pin = (T *)&input[y * bpl];
+		T *pout = (T *)&output[y * bpl];
+		for(int x = 0; x < w; ++x)
 		{
-			long min = 255;
-
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			for(int c = 0; c < colors; ++c)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char g = *pin++;
-					if(g < min)
-					{
-						min = g;
-					}
-				}
+				int i = x * C + c;
+				double difference = pin[i] - blur[i];
+				if(fabs(difference) < threshold)
+					pout[i] = pin[i];
+				else
+					pout[i] = ToSample<T>(pin[i] + amount * difference);
 			}
-
-			// set value and increment output pointer
-			*pout++ = min;
+			if(C == 4)
+				pout[x * C + 3] = pin[x * C + 3];
 		}
-	}
+	});
+}
+
+/*
+	Bilateral filter: each pixel becomes the mean of the pixels around it, weighted by a Gaussian
+	on their distance and one on their difference from it, so regions are smoothed but the edges
+	between them aren't.  The weights are normalized by their sum, so pixels past the edges of the
+	image are simply left out.
+
+	Both methods work a band of lines at a time.  A band reads only the input and writes only its
+	own lines, and the result is the same wherever the bands are cut, so they could go to separate
+	threads; here they run in turn.
+*/
+static const int bilateralBand = 64;
 
-	// now deal with the edges
-	// now deal with the edges
+// the exact filter for lines top to bottom - 1: spatial holds the weights of the (2 radius + 1)
+//  square window, and range the weight of each sum of squared channel differences
+template <int C>
+static void BilateralExactBand(const unsigned char *input, unsigned char *output, int w, int h, int bpl, int top,
+		int bottom, int radius, const float *spatial, const float *range)
+{
+	const int colors = C >= 3 ? 3 : C;
+	int size = 2 * radius + 1;
 
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	for(int y = top; y < bottom; ++y)
+	{
+		int firstY = max(0, y - radius);
+		int lastY = min(h - 1, y + radius);
+		const unsigned char *pin = &input[y * bpl];
+		unsigned char *pout = &output[y * bpl];
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		for(int x = 0; x < w; ++x)
 		{
-			long min = 255;
+			int firstX = max(0, x - radius);
+			int lastX = min(w - 1, x + radius);
+			const unsigned char *center = &pin[x * C];
+			float sums[3] = { 0.0f, 0.0f, 0.0f };
+			float total = 0.0f;
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
+			for(int filtY = firstY; filtY <= lastY; ++filtY)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
+				const unsigned char *p = &input[filtY * bpl + firstX * C];
+				const float *weights = &spatial[(filtY - y + radius) * size + firstX - x + radius];
+				for(int filtX = firstX; filtX <= lastX; ++filtX, p += C)
 				{
-					unsigned char g = *pin;
-					if(g < min)
-						min = g;
+					int distance = 0;
+					for(int c = 0; c < colors; ++c)
+						distance += (p[c] - center[c]) * (p[c] - center[c]);
+
+					float weight = *weights++ * range[distance];
+					for(int c = 0; c < colors; ++c)
+						sums[c] += weight * p[c];
+					total += weight;
 				}
 			}
 
-			// set value and increment output pointer
-			*pout++ = min;
+			// the center pixel's own weight is 1, so the total never runs out
+			for(int c = 0; c < colors; ++c)
+				pout[x * C + c] = ToSample<unsigned char>(sums[c] / total);
+			if(C == 4)
+				pout[x * C + 3] = center[3];
 		}
 	}
+}
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+// the level a pixel goes into the grid by, its gray value for color
+template <int C>
+static inline int BilateralLevel(const unsigned char *p)
+{
+	if(C >= 3)
+		return RGBtoGray(p[0], p[1], p[2]);
+	return p[0];
+}
 
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long min = 255;
+// smallest cells of the grid, in pixels and levels; smaller sigmas would need grids many times
+//  the size of the band
+static const double bilateralMinCell = 2.0;
+static const double bilateralMinLevel = 4.0;
+
+// blur the grid along one axis of n cells step floats apart, for each of outer blocks outerStep
+//  floats apart, each cell being inner floats; cells past the ends count as empty
+// the kernel is spread 4 spread 16 - 10 spread 4 spread spread, 1 4 6 4 1 for a spread of 1 and
+//  otherwise that mixed with leaving the cell alone, for a variance of spread cells squared
+static void BlurGridAxis(const float *in, float *out, int n, int step, int outer, int outerStep, int inner,
+		float spread)
+{
+	const float far = spread;
+	const float near = 4.0f * spread;
+	const float middle = 16.0f - 10.0f * spread;
+	for(int o = 0; o < outer; ++o)
+	{
+		const float *pin = &in[(size_t)o * outerStep];
+		float *pout = &out[(size_t)o * outerStep];
+		for(int i = 0; i < n; ++i)
+		{
+			const float *far0 = i >= 2 ? &pin[(i - 2) * step] : NULL;
+			const float *near0 = i >= 1 ? &pin[(i - 1) * step] : NULL;
+			const float *mid = &pin[i * step];
+			const float *near1 = i + 1 < n ? &pin[(i + 1) * step] : NULL;
+			const float *far1 = i + 2 < n ? &pin[(i + 2) * step] : NULL;
+			float *p = &pout[i * step];
+			for(int k = 0; k < inner; ++k)
+				p[k] = middle * mid[k];
+			if(near0 != NULL)
+				for(int k = 0; k < inner; ++k)
+					p[k] += near * near0[k];
+			if(near1 != NULL)
+				for(int k = 0; k < inner; ++k)
+					p[k] += near * near1[k];
+			if(far0 != NULL)
+				for(int k = 0; k < inner; ++k)
+					p[k] += far * far0[k];
+			if(far1 != NULL)
+				for(int k = 0; k < inner; ++k)
+					p[k] += far * far1[k];
+		}
+	}
+}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					unsigned char g = *pin++;
-					if(g < min)
-					{
-						min = g;
-					}
-				}
-			}
+/*
+	The bilateral grid for lines top to bottom - 1.  Pixel x, y of level g belongs to cell
+	x / cellSize, y / cellSize, g / levelSize, rounded; each cell sums the colors of its pixels
+	and counts them.  Blurring the cells along all three axes by 1 4 6 4 1, a Gaussian of one
+	cell, does the weighting of both distance and level at once, and each output pixel is read
+	back by interpolating the sums and the count between the eight cells around its own position
+	and dividing.  Where a sigma is under the smallest cell, the cells are the smallest size and
+	the blur along those axes is narrowed to the sigma instead.
+
+	A band needs its own cells and the two rows of cells beyond them on each side that the blur
+	reaches, and only the pixels that fall into those, so each cell comes out the same whichever
+	band computes it.
+*/
+template <int C>
+static void BilateralGridBand(const unsigned char *input, unsigned char *output, int w, int h, int bpl, int top,
+		int bottom, double sigmaSpatial, double sigmaRange)
+{
+	const int colors = C >= 3 ? 3 : C;
+	const int pad = 2;
+	const int K = colors + 1;
+	double cellSize = max(sigmaSpatial, bilateralMinCell);
+	double levelSize = max(sigmaRange, bilateralMinLevel);
+	float spreadXY = (float)(sigmaSpatial * sigmaSpatial / (cellSize * cellSize));
+	float spreadZ = (float)(sigmaRange * sigmaRange / (levelSize * levelSize));
+
+	// the cells the band reads from, with pad empty or outside cells around them
+	int firstRow = (int)(top / cellSize) - pad;
+	int lastRow = (int)((bottom - 1) / cellSize) + 1 + pad;
+	int nx = (int)((w - 1) / cellSize) + 2 + 2 * pad;
+	int ny = lastRow - firstRow + 1;
+	int nz = (int)(255 / levelSize) + 2 + 2 * pad;
+	size_t cells = (size_t)nx * ny * nz;
+
+	vector<float> grid(cells * K, 0.0f);
+	vector<float> blurred(cells * K);
+
+	int firstY = max(0, (int)((firstRow - 1) * cellSize));
+	int lastY = min(h - 1, (int)((lastRow + 1) * cellSize));
+	for(int y = firstY; y <= lastY; ++y)
+	{
+		int row = (int)(y / cellSize + 0.5) - firstRow;
+		if(row < 0 || row >= ny)
+			continue;
 
-			// set value and increment output pointer
-			*pout++ = min;
+		const unsigned char *p = &input[y * bpl];
+		for(int x = 0; x < w; ++x, p += C)
+		{
+			int column = (int)(x / cellSize + 0.5) + pad;
+			int level = (int)(BilateralLevel<C>(p) / levelSize + 0.5) + pad;
+			float *cell = &grid[(((size_t)row * nx + column) * nz + level) * K];
+			for(int c = 0; c < colors; ++c)
+				cell[c] += p[c];
+			cell[colors] += 1.0f;
 		}
 	}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
+	BlurGridAxis(&grid[0], &blurred[0], nz, K, ny * nx, nz * K, K, spreadZ);
+	BlurGridAxis(&blurred[0], &grid[0], nx, nz * K, ny, nx * nz * K, nz * K, spreadXY);
+	BlurGridAxis(&grid[0], &blurred[0], ny, nx * nz * K, 1, 0, nx * nz * K, spreadXY);
+
+	for(int y = top; y < bottom; ++y)
+	{
+		double gy = y / cellSize - firstRow;
+		int row = (int)gy;
+		float fy = (float)(gy - row);
 
-		for(imgX = 0; imgX < startx; ++imgX)
+		const unsigned char *pin = &input[y * bpl];
+		unsigned char *pout = &output[y * bpl];
+		for(int x = 0; x < w; ++x)
 		{
-			long min = 255;
+			const unsigned char *p = &pin[x * C];
+			double gx = x / cellSize + pad;
+			double gz = BilateralLevel<C>(p) / levelSize + pad;
+			int column = (int)gx;
+			int level = (int)gz;
+			float fx = (float)(gx - column);
+			float fz = (float)(gz - level);
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char g = *pin;
-					if(g < min)
-						min = g;
-				}
+			float values[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for(int corner = 0; corner < 8; ++corner)
+			{
+				int dy = corner >> 2, dx = (corner >> 1) & 1, dz = corner & 1;
+				float weight = (dy ? fy : 1.0f - fy) * (dx ? fx : 1.0f - fx) * (dz ? fz : 1.0f - fz);
+				const float *cell = &blurred[(((size_t)(row + dy) * nx + column + dx) * nz + level + dz) * K];
+				for(int k = 0; k < K; ++k)
+					values[k] += weight * cell[k];
 			}
 
-			// set value and increment output pointer
-			*pout++ = min;
+			// the pixel's own cell is always within reach, so the count can't be 0, but be safe
+			for(int c = 0; c < colors; ++c)
+				pout[x * C + c] = values[colors] > 0.0f ? ToSample<unsigned char>(values[c] / values[colors]) : p[c];
+			if(C == 4)
+				pout[x * C + 3] = p[3];
 		}
 	}
+}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx];
+template <int C>
+void msaFilters::BilateralBytes(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	const int colors = C >= 3 ? 3 : C;
 
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			long min = 255;
+	if(m_bilateral == BilateralMethod::Grid)
+	{
+		// bands of at least 16 rows of cells, so the rows around them are a small part of the work
+		int band = max(bilateralBand, (int)(16 * max(m_sigmaX, bilateralMinCell)));
+		for(int top = 0; top < h; top += band)
+			BilateralGridBand<C>(input, output, w, h, bpl, top, min(h, top + band), m_sigmaX, m_sigmaRange);
+		return;
+	}
+
+	int radius = m_width / 2;
+	int size = 2 * radius + 1;
+	vector<float> spatial(size * size);
+	for(int y = 0; y < size; ++y)
+		for(int x = 0; x < size; ++x)
+			spatial[y * size + x] = (float)exp(-((x - radius) * (x - radius) + (y - radius) * (y - radius)) /
+					(2.0 * m_sigmaX * m_sigmaX));
+	vector<float> range(colors * 255 * 255 + 1);
+	for(int d = 0; d < (int)range.size(); ++d)
+		range[d] = (float)exp(-d / (2.0 * m_sigmaRange * m_sigmaRange));
+
+	for(int top = 0; top < h; top += bilateralBand)
+		BilateralExactBand<C>(input, output, w, h, bpl, top, min(h, top + bilateralBand), radius, &spatial[0],
+				&range[0]);
+}
 
-			int filtX, filtY;
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
-					
-					unsigned char g = *pin++;
-					if(g < min)
-						min = g;
-				}
-			}
+/*
+	FFT convolution for large kernels.  The spatial loops cost the kernel's area per sample, an
+	FFT costs about log2 of the tile's area, so past a few hundred kernel values the FFT wins.
+
+	The image is cut into tiles of valid output, each read with its kernel sized apron, filled in
+	past the edges by the border mode like the spatial loops, into an nx by ny block.  Transforming
+	that, multiplying by the kernel's conjugate spectrum and transforming back correlates it with
+	the kernel, and the part that didn't wrap around is the tile's output (overlap save).  The
+	kernel is real, so two tiles go through each complex transform, one as the real part and one
+	as the imaginary.
+
+	Every sum of integer samples and kernel values is an integer, so rounding the FFT's result
+	gives it exactly as long as the rounding error stays well under a half; the results then match
+	the spatial loops bit for bit.  ChooseFFT() only allows tile sizes where a bound on that error
+	is below 0.05.
+*/
+typedef complex<double> Complex;
 
-			// set value and increment output pointer
-			*pout++ = min;
+// copy a rows by cols block to cols by rows, in small squares to stay in cache; only the first
+//  outRows rows of the result are written
+static void Transpose(const Complex *in, Complex *out, int rows, int cols, int outRows)
+{
+	const int tile = 16;
+	for(int r0 = 0; r0 < rows; r0 += tile)
+	{
+		int r1 = min(r0 + tile, rows);
+		for(int c0 = 0; c0 < outRows; c0 += tile)
+		{
+			int c1 = min(c0 + tile, outRows);
+			for(int r = r0; r < r1; ++r)
+				for(int c = c0; c < c1; ++c)
+					out[c * rows + r] = in[r * cols + c];
 		}
 	}
 }
 
+// transform an nx by ny block along its rows, then along its columns as the rows of its ny by nx
+//  transpose, which is where the spectrum is left
+static void ForwardFFT2D(Complex *block, Complex *transposed, int nx, int ny, msaFFT &fftx, msaFFT &ffty)
+{
+	for(int y = 0; y < ny; ++y)
+		fftx.Forward(&block[y * nx]);
+	Transpose(block, transposed, ny, nx, nx);
+	for(int x = 0; x < nx; ++x)
+		ffty.Forward(&transposed[x * ny]);
+}
 
-void msaFilters::Filter8(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+// and back, though only the first rows lines of the block are needed
+static void InverseFFT2D(Complex *transposed, Complex *block, int nx, int ny, int rows, msaFFT &fftx, msaFFT &ffty)
 {
-	int imgX, imgY;
+	for(int x = 0; x < nx; ++x)
+		ffty.Inverse(&transposed[x * ny]);
+	Transpose(transposed, block, nx, ny, rows);
+	for(int y = 0; y < rows; ++y)
+		fftx.Inverse(&block[y * nx]);
+}
 
-	// do the easy cases first, where the filter doesn't overlap the edge of the data
-	int startx = m_cx;
-	int endx = w - startx - 1;
-	int starty = m_cy;
-	int endy = h - starty - 1;
+// rough costs in nanoseconds, from a release build on a 1080p image: per sample of a tile, plus
+//  per sample and log2 of its size, for the transforms and everything else done to a pair of tiles
+static const double fftCost = 40.0;
+static const double fftLogCost = 1.0;
+// and per kernel value of a spatial sample: 8 bit with and without a SIMD row kernel, and 16 bit,
+//  which is always plain C
+static const double spatialCostSIMD = 0.15;
+static const double spatialCost8 = 0.75;
+static const double spatialCost16 = 0.7;
+
+bool msaFilters::ChooseFFT(int w, int h, int colors, long long maxVal, double spatialCost, const int *values, int &nx,
+		int &ny)
+{
+	if(m_method == ConvolutionMethod::Spatial)
+		return false;
 
-	for(imgY = starty; imgY < endy; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	double kernelSum = 0.0;
+	for(int i = 0; i < m_count; ++i)
+		kernelSum += abs(values[i]);
 
-		for(imgX = startx; imgX < endx; ++imgX)
-		{
-			long sum = m_divisor / 2;	// for rounding purposes
+	// tiles bigger than the whole image with its apron are no use
+	int maxX = msaFFT::GoodSize(w + m_width - 1);
+	int maxY = msaFFT::GoodSize(h + m_height - 1);
 
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
+	double best = -1.0;
+	for(int tx = msaFFT::GoodSize(m_width); tx <= maxX; tx = msaFFT::GoodSize(tx + 1))
+	{
+		for(int ty = msaFFT::GoodSize(m_height); ty <= maxY; ty = msaFFT::GoodSize(ty + 1))
+		{
+			double area = (double)tx * ty;
+			if(area > (1 << 22))
+				break;
+
+			// the error of a double FFT grows with log2 of its size and the root of its size,
+			//  times the largest values going in; this is generous
+			double error = 1.2e-16 * 8.0 * log2(area) * sqrt(area) * maxVal * kernelSum;
+			if(error > 0.05)
+				break;
+
+			int bx = tx - m_width + 1;
+			int by = ty - m_height + 1;
+			double tiles = (double)((w + bx - 1) / bx) * ((h + by - 1) / by) * colors;
+			double cost = (tiles + 1.0) / 2.0 * area * (fftCost + fftLogCost * log2(area));
+			if(best < 0.0 || cost < best)
 			{
-				// start input pointer at upper left of filter window and work down
-				// want to start at upper left of window
-				unsigned char *pin = &input[(imgY - starty + filtY) * bpl + (imgX - startx)];
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-					sum += *pin++ * m_values[filtVal++];
+				best = cost;
+				nx = tx;
+				ny = ty;
 			}
+		}
+	}
 
-			sum /= m_divisor;
+	// nothing was exact enough
+	if(best < 0.0)
+		return false;
 
-			if(sum > 255) sum = 255;
-			if(sum < 0) sum = 0;
+	return m_method == ConvolutionMethod::FFT || best < (double)w * h * colors * m_count * spatialCost;
+}
 
-			// set value and increment output pointer
-			*pout++ = sum;
-		}
-	}
+template <typename T, int C>
+void msaFilters::Convolve(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	const int colors = C == 4 ? 3 : C;
+	double spatialCost = sizeof(T) == 2 ? spatialCost16 :
+			msaDispatch::Kernels().ConvolveRowBytes != NULL ? spatialCostSIMD : spatialCost8;
 
-	// now deal with the edges
+	const int *values = &m_values[0];
+	int divisor = m_divisor;
+	if(sizeof(T) == 1 && m_fixedBits > 0)
+	{
+		values = &m_fixedValues[0];
+		divisor = m_fixedDivisor;
+	}
 
-	// top edge
-	for(imgY = 0; imgY < starty; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+	int nx, ny;
+	if(ChooseFFT(w, h, colors, numeric_limits<T>::max(), spatialCost, values, nx, ny))
+		FilterFFT<T, C>(input, output, w, h, bpl, values, divisor, nx, ny);
+	else
+		FilterN<T, C>(input, output, w, h, bpl, values, divisor);
+}
 
-		for(imgX = startx; imgX < endx; ++imgX)
+template <typename T, int C>
+void msaFilters::FilterFFT(unsigned char *input, unsigned char *output, int w, int h, int bpl, const int *values,
+		int divisor, int nx, int ny)
+{
+	const int colors = C == 4 ? 3 : C;
+	long long maxVal = numeric_limits<T>::max();
+	int area = nx * ny;
+	int bx = nx - m_width + 1;
+	int by = ny - m_height + 1;
+
+	msaFFT fftx, ffty;
+	fftx.Create(nx);
+	ffty.Create(ny);
+	vector<Complex> block(area);
+	vector<Complex> spectrum(area);
+
+	// the kernel's spectrum, conjugated to correlate rather than convolve, like the spatial loops,
+	//  and scaled to undo the unscaled inverse transform
+	vector<Complex> kernel(area);
+	for(int filtY = 0; filtY < m_height; ++filtY)
+		for(int filtX = 0; filtX < m_width; ++filtX)
+			block[filtY * nx + filtX] = values[filtY * m_width + filtX];
+	ForwardFFT2D(&block[0], &kernel[0], nx, ny, fftx, ffty);
+	for(int i = 0; i < area; ++i)
+		kernel[i] = conj(kernel[i]) / (double)area;
+
+	// a job is one color of one tile
+	int tilesX = (w + bx - 1) / bx;
+	int tilesY = (h + by - 1) / by;
+	int jobs = tilesX * tilesY * colors;
+
+	// tiles past the edges are filled in by the border mode; a column of -1 is the constant, and
+	//  lines of it come from a line of constant samples
+	T value = ToSample<T>(m_borderValue);
+	vector<T> constant(w * C, value);
+	vector<int> columns(nx);
+	for(int job = 0; job < jobs; job += 2)
+	{
+		// read the pair's blocks into the real and imaginary parts
+		for(int part = 0; part < 2; ++part)
 		{
-			long sum = m_divisor / 2;	// for rounding purposes
-
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
+			int j = job + part;
+			if(j >= jobs)
 			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					sum += *pin++ * m_values[filtVal++];
-				}
+				for(int i = 0; i < area; ++i)
+					block[i].imag(0.0);
+				break;
 			}
 
-			sum /= m_divisor;
-
-			if(sum > 255) sum = 255;
-			if(sum < 0) sum = 0;
+			int c = j % colors;
+			int startX = (j / colors) % tilesX * bx - m_cx;
+			int startY = (j / colors) / tilesX * by - m_cy;
+			for(int x = 0; x < nx; ++x)
+			{
+				int column = BorderIndex(startX + x, w, m_border);
+				columns[x] = column < 0 ? -1 : column * C + c;
+			}
 
-			// set value and increment output pointer
-			*pout++ = sum;
+			for(int y = 0; y < ny; ++y)
+			{
+				int source = BorderIndex(startY + y, h, m_border);
+				T *line = source < 0 ? &constant[0] : (T *)&input[source * bpl];
+				Complex *pblock = &block[y * nx];
+				if(part == 0)
+					for(int x = 0; x < nx; ++x)
+						pblock[x].real(columns[x] < 0 ? value : line[columns[x]]);
+				else
+					for(int x = 0; x < nx; ++x)
+						pblock[x].imag(columns[x] < 0 ? value : line[columns[x]]);
+			}
 		}
-	}
 
-	// bottom edge
-	for(imgY = endy; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + startx];
+		ForwardFFT2D(&block[0], &spectrum[0], nx, ny, fftx, ffty);
+		for(int i = 0; i < area; ++i)
+		{
+			const Complex &a = spectrum[i];
+			const Complex &b = kernel[i];
+			spectrum[i] = Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+		}
+		InverseFFT2D(&spectrum[0], &block[0], nx, ny, by, fftx, ffty);
 
-		for(imgX = startx; imgX < endx; ++imgX)
+		// the sums are whole numbers, then they're rounded and divided like the spatial loops
+		for(int part = 0; part < 2 && job + part < jobs; ++part)
 		{
-			long sum = m_divisor / 2;	// for rounding purposes
+			int j = job + part;
+			int c = j % colors;
+			int tileX = (j / colors) % tilesX * bx;
+			int tileY = (j / colors) / tilesX * by;
+			int endX = min(tileX + bx, w);
+			int endY = min(tileY + by, h);
 
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
+			for(int y = tileY; y < endY; ++y)
 			{
-				// get a pointer to the input line; this will be clipped verticall, but not horizontally
-				unsigned char *pin = GetClippedValue8(imgX - startx, imgY - starty + filtY, input, w, h, bpl);
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-					sum += *pin++ * m_values[filtVal++];
+				T *pout = (T *)&output[y * bpl];
+				const Complex *pblock = &block[(y - tileY) * nx];
+				for(int x = tileX; x < endX; ++x)
+				{
+					const Complex &value = pblock[x - tileX];
+					long long sum = llround(part == 0 ? value.real() : value.imag());
+					sum = (sum + divisor / 2) / divisor;
+					if(sum > maxVal) sum = maxVal;
+					if(sum < 0) sum = 0;
+					pout[x * C + c] = (T)sum;
+				}
 			}
+		}
+	}
 
-			sum /= m_divisor;
-
-			if(sum > 255) sum = 255;
-			if(sum < 0) sum = 0;
-
-			// set value and increment output pointer
-			*pout++ = sum;
+	// alpha isn't filtered, it comes straight from the center pixel
+	if(C == 4)
+	{
+		for(int y = 0; y < h; ++y)
+		{
+			T *pin = (T *)&input[y * bpl];
+			T *pout = (T *)&output[y * bpl];
+			for(int x = 0; x < w; ++x)
+				pout[x * C + 3] = pin[x * C + 3];
 		}
 	}
+}
 
-	// left edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl];
+template <int C>
+void msaFilters::FilterFloat(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	switch(m_type)
+	{
+	case FilterType::UserDefined:
+	case FilterType::Gaussian:
+	case FilterType::Sharpen:
+		FilterFloatN<C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Box:
+		BoxFilter<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::RecursiveGaussian:
+		RecursiveGaussianN<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::UnsharpMask:
+		UnsharpMaskN<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Bilateral:
+		throw "Bilateral filter is only for 8 bit samples";
+	case FilterType::Dilate:
+		DilateN<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Erode:
+		ErodeN<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Open:
+	case FilterType::Close:
+	case FilterType::TopHat:
+	case FilterType::BlackHat:
+	case FilterType::Gradient:
+		CompoundMorphologyN<float, C>(input, output, w, h, bpl);
+		break;
+	case FilterType::Median:
+		if(C >= 3 && m_median == MedianMode::Vector)
+			VectorMedianN<float, C>(input, output, w, h, bpl);
+		else
+			MedianFilterFloatN<C>(input, output, w, h, bpl);
+		break;
+	default:
+		throw "Invalid filter type";
+	}
+}
 
-		for(imgX = 0; imgX < startx; ++imgX)
-		{
-			long sum = m_divisor / 2;	// for rounding purposes
+/*
+	Float convolution is done a filter value at a time instead of a pixel at a time: each value
+	scales a whole shifted line of the window into an accumulator line, which is a straight
+	multiply add over contiguous samples.  Nothing is clamped, so float pipelines keep their full
+	range.
+*/
+template <int C>
+void msaFilters::FilterFloatN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	vector<float> acc(w * C);
+	BorderedLines<float, C> lines(input, w, h, bpl, m_cx, m_width - 1 - m_cx, m_cy, m_height - 1 - m_cy, m_border,
+			(float)m_borderValue);
 
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		fill(acc.begin(), acc.end(), 0.0f);
+		float *const *window = lines.Window(imgY);
 
-					sum += *pin * m_values[filtVal++];
-				}
+		int filtVal = 0;
+		for(int filtY = 0; filtY < m_height; ++filtY)
+		{
+			for(int filtX = 0; filtX < m_width; ++filtX)
+			{
+				int val = m_values[filtVal++];
+				if(val == 0)
+					continue;
+				MultiplyAddRowFloat(&window[filtY][filtX * C], (float)val / m_divisor, &acc[0], w * C);
 			}
+		}
 
-			sum /= m_divisor;
-
-			if(sum > 255) sum = 255;
-			if(sum < 0) sum = 0;
+		float *in = (float *)&input[imgY * bpl];
+		float *out = (float *)&output[imgY * bpl];
+		memcpy(out, &acc[0], w * C * sizeof(float));
 
-			// set value and increment output pointer
-			*pout++ = sum;
-		}
+		// alpha isn't filtered, it comes straight from the center pixel
+		if(C == 4)
+			for(int x = 0; x < w; ++x)
+				out[x * C + 3] = in[x * C + 3];
 	}
+}
 
-	// right edge
-	for(imgY = 0; imgY < h; ++imgY)
-	{		
-		unsigned char *pout = &output[imgY * bpl + endx];
+// float samples can't be histogrammed, so the median is found by partially sorting the window
+template <int C>
+void msaFilters::MedianFilterFloatN(unsigned char *input, unsigned char *output, int w, int h, int bpl)
+{
+	if(m_width == m_height && (m_width == 3 || m_width == 5))
+	{
+		MedianNetworkN<float, C>(input, output, w, h, bpl, m_width, m_border, (float)m_borderValue);
+		return;
+	}
 
-		for(imgX = endx; imgX < w; ++imgX)
-		{
-			long sum = m_divisor / 2;	// for rounding purposes
+	int startx = m_width / 2;
+	int starty = m_height / 2;
+	int count = m_width * m_height;
 
-			int filtX, filtY;
-			int filtVal = 0;	// use index so we don't need to calculate
-			for(filtY = 0; filtY < m_height; ++filtY)
-			{
-				
-				for(filtX = 0; filtX < m_width; ++filtX)
-				{
-					// get a pointer for each pixel; since it'll clip vertically AND horizontally, can't use lines
-					unsigned char *pin = GetClippedValue8(imgX - startx + filtX, imgY - starty + filtY, input, w, h, bpl);
+	BorderedLines<float, C> lines(input, w, h, bpl, startx, m_width - 1 - startx, starty, m_height - 1 - starty,
+			m_border, (float)m_borderValue);
 
-					sum += *pin * m_values[filtVal++];
-				}
-			}
+	int colors = C >= 3 ? 3 : C;
+	vector<float> window(count);
 
-			sum /= m_divisor;
+	for(int imgY = 0; imgY < h; ++imgY)
+	{
+		float *const *rows = lines.Window(imgY);
+		float *pout = (float *)&output[imgY * bpl];
 
-			if(sum > 255) sum = 255;
-			if(sum < 0) sum = 0;
+		for(int imgX = 0; imgX < w; ++imgX)
+		{
+			for(int c = 0; c < colors; ++c)
+			{
+				int i = 0;
+				for(int filtY = 0; filtY < m_height; ++filtY)
+					for(int filtX = 0; filtX < m_width; ++filtX)
+						window[i++] = rows[filtY][(imgX + filtX) * C + c];
+
+				// same rank as the other median filters, counting down from the top
+				nth_element(window.begin(), window.begin() + count / 2, window.end(), greater<float>());
+				*pout++ = window[count / 2];
+			}
 
-			// set value and increment output pointer
-			*pout++ = sum;
+			if(C == 4)
+			{
+				*pout = ((float *)&input[imgY * bpl])[imgX * C + 3];
+				++pout;
+			}
 		}
 	}
 }
-
@@ -3,11 +3,18 @@
 #include <vector>
 #include "msaImage.h"
 
-class msaFilters
+class MSA_API msaFilters
 {
 public:
 	msaFilters();
 
+	// morphology beyond dilate and erode: Open erodes and then dilates, Close dilates and then
+	//  erodes, TopHat is the image less its opening, BlackHat the closing less the image, and
+	//  Gradient the dilation less the erosion; the second pass of an opening or closing is by the
+	//  element turned half way round, so away from the edges an opening never brightens and a
+	//  closing never darkens
+	// differences are per channel, and bitonal ones keep the pixels set in the first image and
+	//  not the second
 	enum class FilterType
 	{
 		Undefined = 0,
@@ -16,7 +23,81 @@ public:
 		Erode,
 		Median,
 		Gaussian,
-		Sharpen
+		Sharpen,
+		Box,
+		RecursiveGaussian,
+		Open,
+		Close,
+		TopHat,
+		BlackHat,
+		Gradient,
+		UnsharpMask,
+		Bilateral
+	};
+
+	// how convolutions are done: Automatic estimates the cost of the spatial loops and of FFTs of
+	//  overlapping tiles, mostly from the kernel's area, and takes the cheaper; FFT forces the
+	//  tiles, though a kernel whose sums doubles can't hold exactly still runs spatially
+	// results are the same whichever way it's done
+	enum class ConvolutionMethod
+	{
+		Automatic = 0,
+		Spatial,
+		FFT
+	};
+
+	// what the window sees past the edges of the image: Clamp repeats the edge pixels, Reflect
+	//  mirrors the image with the edge pixel repeated (cba|abc|cba), Wrap tiles it and Constant
+	//  fills with one value for every channel
+	enum class BorderMode
+	{
+		Clamp = 0,
+		Reflect,
+		Wrap,
+		Constant
+	};
+
+	// how the median ranks color pixels: Luminance ranks whole pixels by their gray value and takes
+	//  the largest RGB value of those with the median gray, PerChannel takes the median of each
+	//  channel separately, and Vector takes the pixel of the window with the least total distance
+	//  (the sum of the channels' differences) to all the others, so the result is always one of
+	//  the window's pixels; ties go to the first in the window, top to bottom and left to right
+	// only 8 bit interleaved color has a luminance median, other images take the per channel one,
+	//  and planar images are always filtered per channel
+	enum class MedianMode
+	{
+		Luminance = 0,
+		PerChannel,
+		Vector
+	};
+
+	// standard structuring elements for morphology, each filling w by h around its center:
+	//  Disk is the ellipse touching the middles of the edges, so a disk when w and h are equal,
+	//  Diamond joins the middles of the edges with straight lines, and Cross is the center line
+	//  and column; disks and diamonds always have all of their middle lines and columns, two of
+	//  each when the size is even
+	enum class ElementShape
+	{
+		Rectangle = 0,
+		Disk,
+		Diamond,
+		Cross
+	};
+
+	// how the bilateral filter is done: Grid is Paris and Durand's bilateral grid, which averages
+	//  into cells sigmaSpatial pixels across and sigmaRange levels deep, blurs the cells and reads
+	//  each pixel back out of them, so it costs less per pixel the larger the sigmas are; cells are
+	//  at least 2 pixels across and 4 levels deep, so small sigmas don't take huge grids, and are
+	//  blurred less to make up for it, which makes the grid coarser for those than Exact; color
+	//  pixels go into cells by their gray value, so edges between colors of the same brightness
+	//  are smoothed over
+	// Exact sums the whole window for every pixel, with the distance between color pixels taken
+	//  across all three channels; it's the reference the grid approximates, and is only practical
+	//  for small sigmas
+	enum class BilateralMethod
+	{
+		Grid = 0,
+		Exact
 	};
 
 	// read/write access to filter values
@@ -34,12 +115,63 @@ public:
 	int GetHeight() { return m_height; };
 	int GetDivisor() { return m_divisor; };
 	FilterType GetType() { return m_type; };
+	ConvolutionMethod GetConvolutionMethod() { return m_method; };
+	void SetConvolutionMethod(ConvolutionMethod method) { m_method = method; };
+	BorderMode GetBorderMode() { return m_border; };
+	double GetBorderValue() { return m_borderValue; };
+	// the value is in the image's sample range, 0 - 255 for 8 bit samples and so on; the recursive
+	//  Gaussian and bitonal dilate and erode always clamp
+	void SetBorderMode(BorderMode mode, double value = 0.0);
+	MedianMode GetMedianMode() { return m_median; };
+	void SetMedianMode(MedianMode mode) { m_median = mode; };
+	BilateralMethod GetBilateralMethod() { return m_bilateral; };
+	void SetBilateralMethod(BilateralMethod method) { m_bilateral = method; };
+	// fixed point convolution of 8 bit samples: the kernel is scaled to a divisor of 2 to the
+	//  bits, from 1 to 14, so each sum is normalized by a shift, and kernels whose sums then fit
+	//  16 bits use SIMD loops twice as wide; fewer bits fit more kernels but are less accurate
+	// 0, the default, divides by the kernel's own divisor; 16 bit and float images always do
+	void SetFixedPoint(int bits);
+	int GetFixedPoint() { return m_fixedBits; };
+	// the most an 8 bit sample can differ from the result with the kernel's own divisor, which is 0
+	//  when the kernel scales exactly
+	int GetFixedPointError() { return m_fixedError; };
 
 	// user defined convolution filter
 	void SetUserDefined(const int *vals, int w, int h, int cx, int cy, int divisor);
-	// predefiend filters
+	// predefiend filters; a box filter is the mean of a w by h window, which costs the same
+	//  per pixel whatever its size
+	// a recursive Gaussian set this way has the sigma of the w by h Gaussian kernel, about
+	//  w / 5 by h / 5
 	void SetType(FilterType type, int w, int h);
-	// apply filter to the image
+	// recursive Gaussian blur of the given sigmas, at least 0.5; the cost per pixel is the same
+	//  for any sigma, so it suits the large ones the Gaussian kernel is far too slow for
+	// for sigmas from 1.5 up, 8 bit results are within 3 levels of a true Gaussian, see
+	//  RecursiveGaussianN for the accuracy in more detail
+	void SetRecursiveGaussian(double sigmaX, double sigmaY);
+	// unsharp mask: each sample moves away from a Gaussian blur of sigma radius by amount times its
+	//  difference from the blur, unless that difference is under threshold, which is in the
+	//  image's sample range; the blur is the recursive one, so the cost is the same for any radius
+	void SetUnsharpMask(double amount, double radius, double threshold = 0.0);
+	// edge preserving smoothing of 8 bit images: each pixel becomes the mean of the pixels around
+	//  it, weighted by a Gaussian of sigmaSpatial, at least 0.5, on their distance and one of
+	//  sigmaRange, at least 1, on their difference from it in levels; pixels past the edges are
+	//  left out rather than taken from the border mode
+	void SetBilateral(double sigmaSpatial, double sigmaRange);
+	// dilate, erode and the operations made of them by a structuring element of any shape rather
+	//  than a full rectangle; mask is w by h, nonzero where the element is, and the element is
+	//  placed with cx, cy on each pixel
+	// each line of the element is split into runs of pixels, and a run costs the same per pixel
+	//  whatever its length, so a disk costs about its height per pixel rather than its area
+	// bitonal images leave out pixels past the edges rather than clamping, which only differs
+	//  for elements with holes or that don't cover their center
+	void SetStructuringElement(FilterType type, const int *mask, int w, int h, int cx, int cy);
+	void SetStructuringElement(FilterType type, ElementShape shape, int w, int h);
+	// a line through the center about length pixels long, at angle degrees counterclockwise from
+	//  horizontal
+	void SetLineElement(FilterType type, int length, double angle);
+	// apply filter to the image; planar color images are filtered per plane
+	// float images are filtered without clamping
+	// bitonal images only have the morphology
 	void FilterImage(msaImage &input, msaImage &output);
 
 protected:
@@ -53,23 +185,106 @@ protected:
 	int m_cx;
 	int m_cy;
 
+	double m_sigmaX;
+	double m_sigmaY;
+
+	double m_amount;
+	double m_threshold;
+
+	double m_sigmaRange;
+	BilateralMethod m_bilateral;
+
+	ConvolutionMethod m_method;
+
+	BorderMode m_border;
+	double m_borderValue;
+
+	MedianMode m_median;
+
+	// the kernel scaled to a power of two divisor, and its worst error in levels
+	int m_fixedBits;
+	std::vector<int> m_fixedValues;
+	int m_fixedDivisor;
+	int m_fixedError;
+
 	void SetToGaussian(int w, int h);
 	void SetToSharpen(int w, int h);
+	void SetToBox(int w, int h);
 	void SetFilterSize(int w, int h);
+	// rescale the kernel for the fixed point precision, after it or the kernel changes
+	void QuantizeKernel();
+
+	// the structuring element, a full rectangle unless one was set, and its center; reflect turns
+	//  it half way round for the second pass of an opening or closing
+	void ElementMask(std::vector<int> &mask, int &cx, int &cy, bool reflect);
+
+	// bitonal dilate and erode, a word of pixels at a time, and the operations made of them
+	void Dilate1(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	void Erode1(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	void CompoundMorphology1(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+
+	// generic versions for every sample type, T is the sample type and C the number of channels;
+	//  each reads its window through a ring of lines padded by the border mode, so there are no
+	//  separate edge cases
+	template <typename T, int C>
+	void FilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl, const int *values, int divisor);
+	template <typename T, int C>
+	void DilateN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	template <typename T, int C>
+	void ErodeN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// opening, closing, the top-hats and the gradient, with the passes fused a line at a time
+	template <typename T, int C>
+	void CompoundMorphologyN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	template <typename T, int C>
+	void MedianFilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// 8 bit median from sliding histograms, per channel or by luminance
+	template <int C>
+	void MedianFilterBytes(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// vector median of color pixels, for every sample type
+	template <typename T, int C>
+	void VectorMedianN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+
+	// box filter from running sums of the window's columns and rows, for any sample type; float
+	//  images get the plain mean, integer ones are rounded like the convolution
+	template <typename T, int C, typename S>
+	void BoxFilterN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	template <typename T, int C>
+	void BoxFilter(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+
+	// Young and van Vliet's recursive Gaussian, a horizontal pass and then a vertical one
+	template <typename T, int C>
+	void RecursiveGaussianN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// unsharp mask on the recursive Gaussian, sharpening each line of the blur as it comes out
+	template <typename T, int C>
+	void UnsharpMaskN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// bilateral filter of 8 bit samples by either method, a band of lines at a time
+	template <int C>
+	void BilateralBytes(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+
+	// convolve 8 or 16 bit samples with the current kernel, spatially or by FFT; the kernel and
+	//  divisor passed to the functions below are the fixed point ones when that's in use
+	template <typename T, int C>
+	void Convolve(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// pick FFT tile sizes for the kernel on a w by h image with samples up to maxVal, given the
+	//  spatial cost of a kernel value; returns false if the spatial loops should be used
+	bool ChooseFFT(int w, int h, int colors, long long maxVal, double spatialCost, const int *values, int &nx,
+			int &ny);
+	// convolution by overlap save: clamped nx by ny tiles, two at a time as one complex FFT
+	template <typename T, int C>
+	void FilterFFT(unsigned char *input, unsigned char *output, int w, int h, int bpl, const int *values, int divisor,
+			int nx, int ny);
+
+	// run the generic function for the current filter type
+	template <typename T, int C>
+	void FilterGeneric(unsigned char *input, unsigned char *output, int w, int h, int bpl);
 
-	// colorspace specific functions, called by generic functions
-	void Filter8(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Filter24(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Filter32(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Dilate8(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Dilate24(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Dilate32(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Erode8(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Erode24(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void Erode32(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void MedianFilter8(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void MedianFilter24(unsigned char *input, unsigned char *output, int w, int h, int bpl);
-	void MedianFilter32(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	// float versions of the convolution and median, and the dispatch for float images
+	template <int C>
+	void FilterFloatN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	template <int C>
+	void MedianFilterFloatN(unsigned char *input, unsigned char *output, int w, int h, int bpl);
+	template <int C>
+	void FilterFloat(unsigned char *input, unsigned char *output, int w, int h, int bpl);
 };
 #endif
 
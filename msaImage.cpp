@@ -1,5 +1,12 @@
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
 #include "msaImage.h"
 #include "ColorspaceConversion.h"
+#include "msaRowKernels.h"
+#include "msaIntegral.h"
+#include "msaProfile.h"
 
 
 msaImage::msaImage()
@@ -10,6 +17,8 @@ msaImage::msaImage()
 	bytesPerLine = 0;
 	data = NULL;
 	depth = 0;
+	planar = false;
+	isFloat = false;
 }
 
 msaImage::~msaImage()
@@ -54,7 +63,49 @@ unsigned char *msaImage::Data()
 	return data;
 }
 
-void msaImage::UseExternalData(int w, int h, int bpl, int d, unsigned char *pd)
+bool msaImage::Planar()
+{
+	return planar;
+}
+
+int msaImage::Channels()
+{
+	if(depth <= 16) return 1;
+	return depth / BitsPerSample();
+}
+
+int msaImage::BitsPerSample()
+{
+	if(isFloat)
+		return 32;
+
+	switch(depth)
+	{
+		case 1:
+			return 1;
+		case 16:
+		case 48:
+		case 64:
+			return 16;
+		default:
+			return 8;
+	}
+}
+
+bool msaImage::IsFloat()
+{
+	return isFloat;
+}
+
+unsigned char *msaImage::Plane(int channel)
+{
+	if(!planar)
+		return data;
+
+	return &data[channel * height * bytesPerLine];
+}
+
+void msaImage::UseExternalData(int w, int h, int bpl, int d, unsigned char *pd, bool p, bool f)
 {
 	if(ownsData) delete[] data;
 	data = NULL;
@@ -65,9 +116,11 @@ void msaImage::UseExternalData(int w, int h, int bpl, int d, unsigned char *pd)
 	bytesPerLine = bpl;
 	data = pd;
 	ownsData = false;
+	planar = p;
+	isFloat = f;
 }
 
-void msaImage::TakeExternalData(int w, int h, int bpl, int d, unsigned char *pd)
+void msaImage::TakeExternalData(int w, int h, int bpl, int d, unsigned char *pd, bool p, bool f)
 {
 	if(ownsData) delete[] data;
 	data = NULL;
@@ -78,6 +131,21 @@ void msaImage::TakeExternalData(int w, int h, int bpl, int d, unsigned char *pd)
 	bytesPerLine = bpl;
 	data = pd;
 	ownsData = true;
+	planar = p;
+	isFloat = f;
+
+	// buffers handed over inside an operation were allocated by it
+	MSA_PROFILE_ALLOC((planar ? Channels() : 1) * height * bytesPerLine);
+}
+
+// bytes per line for a new image
+static int LineBytes(int w, int depth)
+{
+	// bitonal lines are whole 64 bit words
+	if(depth == 1)
+		return (w + 63) / 64 * 8;
+
+	return ((w * depth / 8) + 3) / 4 * 4; // round up to 4 byte multiple
 }
 
 void msaImage::SetCopyData(int w, int h, int bpl, int d, unsigned char *pd)
@@ -88,30 +156,248 @@ void msaImage::SetCopyData(int w, int h, int bpl, int d, unsigned char *pd)
 	width = w;
 	height = h;
 	depth = d;
-	bytesPerLine = ((w * depth / 8) + 3) / 4 * 4; // round up to 4 byte multiple
+	bytesPerLine = LineBytes(w, depth);
 	ownsData = true;
+	planar = false;
+	isFloat = false;
 
 	data = new unsigned char[height * bytesPerLine];
+	MSA_PROFILE_ALLOC(height * bytesPerLine);
 
 	// copy in line by line so we can adjust to bytesPerLine if needed
+	int copyBytes = bpl < bytesPerLine ? bpl : bytesPerLine;
 	for(int y = 0; y < height; ++y)
 	{
-		memcpy(&data[y * bytesPerLine], &pd[y * bpl], bpl);
+		memcpy(&data[y * bytesPerLine], &pd[y * bpl], copyBytes);
+		memset(&data[y * bytesPerLine + copyBytes], 0, bytesPerLine - copyBytes);
 	}
 }
 
 void msaImage::CreateImage(int w, int h, int d)
 {
+	// if we already own a buffer of exactly this shape, just reuse it
+	if(ownsData && data != NULL && !planar && !isFloat && w == width && h == height && d == depth)
+		return;
+
+	if(ownsData) delete[] data;
+	data = NULL;
+
+	width = w;
+	height = h;
+	depth = d;
+	bytesPerLine = LineBytes(w, depth);
+	ownsData = true;
+	planar = false;
+	isFloat = false;
+
+	data = new unsigned char[height * bytesPerLine];
+	MSA_PROFILE_ALLOC(height * bytesPerLine);
+}
+
+void msaImage::CreatePlanarImage(int w, int h, int d)
+{
+	if(ownsData && data != NULL && planar && !isFloat && w == width && h == height && d == depth)
+		return;
+
 	if(ownsData) delete[] data;
 	data = NULL;
 
 	width = w;
 	height = h;
 	depth = d;
-	bytesPerLine = ((w * depth / 8) + 3) / 4 * 4; // round up to 4 byte multiple
 	ownsData = true;
+	planar = true;
+	isFloat = false;
+
+	// each plane is a grayscale image, lines rounded up to 4 byte multiple
+	bytesPerLine = LineBytes(w, BitsPerSample());
+
+	data = new unsigned char[Channels() * height * bytesPerLine];
+	MSA_PROFILE_ALLOC(Channels() * height * bytesPerLine);
+}
+
+void msaImage::CreateFloatImage(int w, int h, int channels)
+{
+	if(channels != 1 && channels != 3 && channels != 4)
+		throw "Float images must have 1, 3 or 4 channels";
+
+	if(ownsData && data != NULL && !planar && isFloat && w == width && h == height && channels * 32 == depth)
+		return;
+
+	if(ownsData) delete[] data;
+	data = NULL;
+
+	width = w;
+	height = h;
+	depth = channels * 32;
+	bytesPerLine = w * channels * sizeof(float);	// always a 4 byte multiple
+	ownsData = true;
+	planar = false;
+	isFloat = true;
 
 	data = new unsigned char[height * bytesPerLine];
+	MSA_PROFILE_ALLOC(height * bytesPerLine);
+}
+
+void msaImage::CreateMatchingImage(msaImage &output)
+{
+	if(isFloat)
+		output.CreateFloatImage(width, height, Channels());
+	else if(planar)
+		output.CreatePlanarImage(width, height, depth);
+	else
+		output.CreateImage(width, height, depth);
+}
+
+void msaImage::GetSampleLines(int &lines, int &lineBytes)
+{
+	// planes are stacked one after another with the same line length, so a planar image can be
+	//  walked as one tall grayscale image
+	if(planar)
+	{
+		lines = height * Channels();
+		lineBytes = width * BitsPerSample() / 8;
+	}
+	else
+	{
+		lines = height;
+		lineBytes = (width * depth + 7) / 8;
+	}
+}
+
+void msaImage::ToPlanar(msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("ToPlanar", depth, isFloat), (long long)width * height);
+
+	if(isFloat)
+		throw "Float images can only be interleaved";
+
+	output.CreatePlanarImage(width, height, depth);
+
+	if(planar || Channels() == 1)
+	{
+		// nothing to rearrange, just copy
+		int lines, lineBytes;
+		GetSampleLines(lines, lineBytes);
+		for(int y = 0; y < lines; ++y)
+			memcpy(&output.Data()[y * output.BytesPerLine()], &data[y * bytesPerLine], lineBytes);
+		return;
+	}
+
+	if(depth == 24)
+		SplitRGB(output.Plane(0), output.Plane(1), output.Plane(2), output.BytesPerLine());
+	else if(depth == 32)
+		SplitRGBA(output.Plane(0), output.Plane(1), output.Plane(2), output.Plane(3), output.BytesPerLine());
+	else if(depth == 48 || depth == 64)
+	{
+		int channels = Channels();
+		for(int y = 0; y < height; ++y)
+		{
+			unsigned short *in = (unsigned short *)&data[y * bytesPerLine];
+			for(int c = 0; c < channels; ++c)
+			{
+				unsigned short *out = (unsigned short *)&output.Plane(c)[y * output.BytesPerLine()];
+				for(int x = 0; x < width; ++x)
+					out[x] = in[x * channels + c];
+			}
+		}
+	}
+	else
+		throw "Invalid image depth";
+}
+
+void msaImage::ToInterleaved(msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("ToInterleaved", depth, isFloat), (long long)width * height);
+
+	if(isFloat)
+		throw "Float images can only be interleaved";
+
+	if(!planar || Channels() == 1)
+	{
+		output.SetCopyData(width, height, bytesPerLine, depth, data);
+		return;
+	}
+
+	if(depth == 24)
+		output.ComposeRGB(width, height, bytesPerLine, Plane(0), Plane(1), Plane(2));
+	else if(depth == 32)
+		output.ComposeRGBA(width, height, bytesPerLine, Plane(0), Plane(1), Plane(2), Plane(3));
+	else if(depth == 48 || depth == 64)
+	{
+		int channels = Channels();
+		output.CreateImage(width, height, depth);
+		for(int y = 0; y < height; ++y)
+		{
+			unsigned short *out = (unsigned short *)&output.Data()[y * output.BytesPerLine()];
+			for(int c = 0; c < channels; ++c)
+			{
+				unsigned short *in = (unsigned short *)&Plane(c)[y * bytesPerLine];
+				for(int x = 0; x < width; ++x)
+					out[x * channels + c] = in[x];
+			}
+		}
+	}
+	else
+		throw "Invalid image depth";
+}
+
+void msaImage::ToFloat(msaImage &output, float scale)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("ToFloat", depth), (long long)width * height);
+
+	if(isFloat)
+		throw "Image is already float";
+	if(planar && Channels() > 1)
+		throw "ToFloat requires an interleaved image.";
+	if(depth == 1)
+		throw "Invalid image depth";
+
+	bool wide = BitsPerSample() == 16;
+	if(scale == 0.0f)
+		scale = wide ? 1.0f / 65535.0f : 1.0f / 255.0f;
+
+	output.CreateFloatImage(width, height, Channels());
+
+	int samples = width * Channels();
+	for(int y = 0; y < height; ++y)
+	{
+		float *out = (float *)&output.Data()[y * output.BytesPerLine()];
+		if(wide)
+			ShortsToFloat((unsigned short *)&data[y * bytesPerLine], out, scale, samples);
+		else
+			BytesToFloat(&data[y * bytesPerLine], out, scale, samples);
+	}
+}
+
+void msaImage::FromFloat(int newDepth, msaImage &output, float scale)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("FromFloat", depth, true), (long long)width * height);
+
+	if(!isFloat)
+		throw "FromFloat must be used on a float image.";
+
+	bool wide = newDepth == 16 || newDepth == 48 || newDepth == 64;
+	int bits = wide ? 16 : 8;
+	if(newDepth != 8 && newDepth != 24 && newDepth != 32 && !wide)
+		throw "Invalid image depth";
+	if(newDepth / bits != Channels())
+		throw "FromFloat can't change the number of channels.";
+
+	if(scale == 0.0f)
+		scale = wide ? 65535.0f : 255.0f;
+
+	output.CreateImage(width, height, newDepth);
+
+	int samples = width * Channels();
+	for(int y = 0; y < height; ++y)
+	{
+		float *in = (float *)&data[y * bytesPerLine];
+		if(wide)
+			FloatToShorts(in, (unsigned short *)&output.Data()[y * output.BytesPerLine()], scale, samples);
+		else
+			FloatToBytes(in, &output.Data()[y * output.BytesPerLine()], scale, samples);
+	}
 }
 
 void msaImage::CreateImage(int w, int h, int d, const msaPixel &fill)
@@ -122,6 +408,20 @@ void msaImage::CreateImage(int w, int h, int d, const msaPixel &fill)
 	// fill with color
 	switch(d)
 	{
+		case 1:
+		{
+			// white if the fill is at least mid gray; bits past the end of the line stay clear
+			unsigned char bits = fill.r >= 128 ? 0xFF : 0;
+			for(int y = 0; y < height; ++y)
+			{
+				unsigned char *line = &data[y * bytesPerLine];
+				memset(line, 0, bytesPerLine);
+				memset(line, bits, width / 8);
+				if(width % 8 != 0)
+					line[width / 8] = bits & (0xFF << (8 - width % 8));
+			}
+			break;
+		}
 		case 8:
 			for(int y = 0; y < height; ++y)
 			{
@@ -151,6 +451,23 @@ void msaImage::CreateImage(int w, int h, int d, const msaPixel &fill)
 				}
 			}
 			break;
+		case 16:
+		case 48:
+		case 64:
+		{
+			// scale 8 bit fill values to the full 16 bit range
+			int channels = Channels();
+			unsigned short values[4] = { (unsigned short)(fill.r * 257), (unsigned short)(fill.g * 257),
+				(unsigned short)(fill.b * 257), (unsigned short)(fill.a * 257) };
+			for(int y = 0; y < height; ++y)
+			{
+				unsigned short *line = (unsigned short *)&data[y * bytesPerLine];
+				for(int x = 0; x < width; ++x)
+					for(int c = 0; c < channels; ++c)
+						*line++ = values[c];
+			}
+			break;
+		}
 		default:
 			throw "Invalid image depth";
 	}
@@ -158,10 +475,65 @@ void msaImage::CreateImage(int w, int h, int d, const msaPixel &fill)
 
 void msaImage::TransformImage(msaAffineTransform &trans, msaImage &outimg, int quality)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name(planar ? "TransformImage/Planar" : "TransformImage",
+			quality < 34 ? "Fast" : quality < 67 ? "Better" : "Best", depth, isFloat), (long long)width * height);
+
 	unsigned char *output;
-	int newW;
-	int newH;
-	int newBPL;
+	int newW = width;
+	int newH = height;
+	int newBPL = bytesPerLine;
+
+	if(isFloat)
+		throw "Invalid bit depth";
+
+	// bitonal images are transformed as gray, so the better qualities smooth edges, then thresholded
+	if(depth == 1)
+	{
+		msaPixel white = { 255, 255, 255, 255 };
+		msaImage gray, grayOut;
+		SimpleConvert(8, white, gray);
+		gray.TransformImage(trans, grayOut, quality);
+		grayOut.Threshold(128, outimg);
+		return;
+	}
+
+	// planar images are transformed one plane at a time as grayscale images
+	if(planar && Channels() > 1)
+	{
+		if(depth != 24 && depth != 32 && depth != 48 && depth != 64)
+			throw "Invalid bit depth";
+
+		unsigned char *planes = NULL;
+		for(int c = 0; c < Channels(); ++c)
+		{
+			newW = width;
+			newH = height;
+			newBPL = bytesPerLine;
+
+			// pick the out of bounds value for this plane
+			msaAffineTransform planeTrans = trans;
+			if(c == 1) planeTrans.oob_r = trans.oob_g;
+			if(c == 2) planeTrans.oob_r = trans.oob_b;
+			if(c == 3) planeTrans.oob_r = trans.oob_a;
+
+			if(BitsPerSample() == 16)
+				output = transformN<unsigned short, 1>(planeTrans, newW, newH, newBPL, Plane(c), quality);
+			else if(quality < 34)
+				output = transformFast8(planeTrans, newW, newH, newBPL, Plane(c));
+			else if(quality < 67)
+				output = transformBetter8(planeTrans, newW, newH, newBPL, Plane(c));
+			else
+				output = transformBest8(planeTrans, newW, newH, newBPL, Plane(c));
+
+			if(planes == NULL)
+				planes = new unsigned char[Channels() * newH * newBPL];
+			memcpy(&planes[c * newH * newBPL], output, newH * newBPL);
+			delete[] output;
+		}
+
+		outimg.TakeExternalData(newW, newH, newBPL, depth, planes, true);
+		return;
+	}
 
 	// create output data
 	switch(depth)
@@ -190,6 +562,15 @@ void msaImage::TransformImage(msaAffineTransform &trans, msaImage &outimg, int q
 			else
 				output = transformBest32(trans, newW, newH, newBPL, data);
 			break;
+		case 16:
+			output = transformN<unsigned short, 1>(trans, newW, newH, newBPL, data, quality);
+			break;
+		case 48:
+			output = transformN<unsigned short, 3>(trans, newW, newH, newBPL, data, quality);
+			break;
+		case 64:
+			output = transformN<unsigned short, 4>(trans, newW, newH, newBPL, data, quality);
+			break;
 		default:
 			throw "Invalid bit depth";
 	}
@@ -816,7 +1197,7 @@ unsigned char *msaImage::transformBest32(msaAffineTransform &transform, int &wid
 			int b14 = *ptr++; 
 			int a14 = *ptr++; 
 
-			ptr += bpl;		// move down one line
+			ptr += bpl - 16;	// move down one line, back to the first of the 4 pixels
 			int r21 = *ptr++; 	// grab 4 pixels of data
 			int g21 = *ptr++;
 			int b21 = *ptr++;
@@ -837,7 +1218,7 @@ unsigned char *msaImage::transformBest32(msaAffineTransform &transform, int &wid
 			int b24 = *ptr++;
 			int a24 = *ptr++;
 
-			ptr += bpl;		// move down one line
+			ptr += bpl - 16;	// move down one line, back to the first of the 4 pixels
 			int r31 = *ptr++; 	// grab 4 pixels of data
 			int g31 = *ptr++;
 			int b31 = *ptr++;
@@ -858,7 +1239,7 @@ unsigned char *msaImage::transformBest32(msaAffineTransform &transform, int &wid
 			int b34 = *ptr++;
 			int a34 = *ptr++;
 
-			ptr += bpl;		// move down one line
+			ptr += bpl - 16;	// move down one line, back to the first of the 4 pixels
 			int r41 = *ptr++; 	// grab 4 pixels of data
 			int g41 = *ptr++;
 			int b41 = *ptr++;
@@ -1214,6 +1595,25 @@ unsigned char *msaImage::transformBest8(msaAffineTransform &transform, int &widt
 
 void msaImage::SimpleConvert(int newDepth, msaPixel &color, msaImage &output)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name("SimpleConvert", depth, isFloat), (long long)width * height);
+
+	if(planar && Channels() > 1)
+		throw "SimpleConvert requires an interleaved image.";
+	if(isFloat)
+		throw "SimpleConvert can't be used on a float image, use FromFloat.";
+
+	if(depth == 1 || newDepth == 1)
+	{
+		SimpleConvert1(newDepth, color, output);
+		return;
+	}
+
+	if(BitsPerSample() == 16 || newDepth == 16 || newDepth == 48 || newDepth == 64)
+	{
+		SimpleConvert16(newDepth, color, output);
+		return;
+	}
+
 	// if no change in depth, just copy the image
 	if(depth == newDepth)
 	{
@@ -1333,8 +1733,105 @@ void msaImage::SimpleConvert(int newDepth, msaPixel &color, msaImage &output)
 		throw "Invalid image depth";
 }
 
+void msaImage::Threshold(int threshold, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("Threshold", depth), (long long)width * height);
+
+	if(depth != 8)
+		throw "Threshold must be used on an 8 bit image.";
+
+	if(threshold < 0) threshold = 0;
+	// nothing reaches a threshold above 255, but the row kernel works with bytes
+	bool none = threshold > 255;
+
+	output.CreateImage(width, height, 1);
+
+	for(int y = 0; y < height; ++y)
+	{
+		unsigned char *outLine = &output.Data()[y * output.BytesPerLine()];
+		memset(outLine, 0, output.BytesPerLine());
+		if(!none)
+			ThresholdRow(&data[y * bytesPerLine], outLine, (unsigned char)threshold, width);
+	}
+}
+
+void msaImage::AdaptiveThreshold(int w, int h, int offset, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("AdaptiveThreshold", depth), (long long)width * height);
+
+	if(depth != 8)
+		throw "Threshold must be used on an 8 bit image.";
+	if(w < 1 || h < 1)
+		throw "Width and height of threshold window must be at least 1 pixel";
+
+	msaIntegralImage integral;
+	integral.Create(*this, false);
+
+	output.CreateImage(width, height, 1);
+
+	// decide each pixel into a line of 0 or 255, then let the row kernel pack the bits
+	std::vector<unsigned char> line(width);
+	for(int y = 0; y < height; ++y)
+	{
+		int y0 = y - h / 2;
+		int y1 = y0 + h - 1;
+		unsigned char *pin = &data[y * bytesPerLine];
+		for(int x = 0; x < width; ++x)
+		{
+			int x0 = x - w / 2;
+			int x1 = x0 + w - 1;
+			// pin >= sum / count - offset, kept in integers
+			long long count = integral.Count(x0, y0, x1, y1);
+			long long sum = (long long)integral.Sum(x0, y0, x1, y1);
+			line[x] = (pin[x] + offset) * count >= sum ? 255 : 0;
+		}
+
+		unsigned char *outLine = &output.Data()[y * output.BytesPerLine()];
+		memset(outLine, 0, output.BytesPerLine());
+		ThresholdRow(&line[0], outLine, 128, width);
+	}
+}
+
+void msaImage::SauvolaThreshold(int w, int h, double k, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("SauvolaThreshold", depth), (long long)width * height);
+
+	if(depth != 8)
+		throw "Threshold must be used on an 8 bit image.";
+	if(w < 1 || h < 1)
+		throw "Width and height of threshold window must be at least 1 pixel";
+
+	msaIntegralImage integral;
+	integral.Create(*this, true);
+
+	output.CreateImage(width, height, 1);
+
+	std::vector<unsigned char> line(width);
+	for(int y = 0; y < height; ++y)
+	{
+		int y0 = y - h / 2;
+		int y1 = y0 + h - 1;
+		unsigned char *pin = &data[y * bytesPerLine];
+		for(int x = 0; x < width; ++x)
+		{
+			int x0 = x - w / 2;
+			int x1 = x0 + w - 1;
+			double mean = integral.Mean(x0, y0, x1, y1);
+			double stddev = sqrt(integral.Variance(x0, y0, x1, y1));
+			double threshold = mean * (1.0 + k * (stddev / 128.0 - 1.0));
+			line[x] = pin[x] >= threshold ? 255 : 0;
+		}
+
+		unsigned char *outLine = &output.Data()[y * output.BytesPerLine()];
+		memset(outLine, 0, output.BytesPerLine());
+		ThresholdRow(&line[0], outLine, 128, width);
+	}
+}
+
 void msaImage::ColorMap(msaPixel map[256], msaImage &output)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name("ColorMap", depth), (long long)width * height);
+
 	if(depth != 8)
 		throw "ColorMap can only be applied to an 8 bit image.";
 
@@ -1355,10 +1852,12 @@ void msaImage::ColorMap(msaPixel map[256], msaImage &output)
 
 void msaImage::RemapBrightness(unsigned char map[256], msaImage &output)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name("RemapBrightness", depth), (long long)width * height);
+
 	if(depth != 8)
 		throw "RemapBrightness can only be applied to an 8 bit image.";
 
-	output.CreateImage(width, height, 24);
+	output.CreateImage(width, height, 8);
 	
 	for(int y = 0; y < height; ++y)
 	{
@@ -1372,8 +1871,12 @@ void msaImage::RemapBrightness(unsigned char map[256], msaImage &output)
 
 void msaImage::AddAlphaChannel(msaImage &alpha, msaImage &output)
 {
+	MSA_PROFILE_SCOPE(msaProfile::Name("AddAlphaChannel", depth), (long long)width * height);
+
 	if(depth != 24)
 		throw "Alpha channel can only be applied to a 24 bit image.";
+	if(planar)
+		throw "Alpha channel can only be applied to an interleaved image.";
 
 	if(alpha.Depth() != 8)
 		throw "Alpha channel must be an 8 bit image.";
@@ -1397,6 +1900,8 @@ void msaImage::AddAlphaChannel(msaImage &alpha, msaImage &output)
 
 void msaImage::ComposeRGB(msaImage &red, msaImage &green, msaImage &blue)
 {
+	MSA_PROFILE_SCOPE("ComposeRGB", (long long)red.Width() * red.Height());
+
 	if(red.Depth() != 8 || green.Depth() != 8 || blue.Depth() != 8)
 		throw "All composite inputs must be an 8 bit images.";
 
@@ -1412,21 +1917,28 @@ void msaImage::ComposeRGB(msaImage &red, msaImage &green, msaImage &blue)
 	
 	for(int y = 0; y < height; ++y)
 	{
-		unsigned char *rLine = &red.Data()[y * red.BytesPerLine()];
-		unsigned char *gLine = &green.Data()[y * blue.BytesPerLine()];
-		unsigned char *bLine = &blue.Data()[y * blue.BytesPerLine()];
-		unsigned char *outLine = &data[y * bytesPerLine];
-		for(int x = 0; x < width; ++x)
-		{
-			*outLine++ = *rLine++;
-			*outLine++ = *gLine++;
-			*outLine++ = *bLine++;
-		}
+		InterleaveRGB(&red.Data()[y * red.BytesPerLine()], &green.Data()[y * green.BytesPerLine()],
+				&blue.Data()[y * blue.BytesPerLine()], &data[y * bytesPerLine], width);
+	}
+}
+
+void msaImage::ComposeRGB(int w, int h, int planeBpl, unsigned char *red, unsigned char *green, unsigned char *blue)
+{
+	MSA_PROFILE_SCOPE("ComposeRGB/Buffers", (long long)w * h);
+
+	// set up this image as output image; reuses the existing buffer if it's already the right size
+	CreateImage(w, h, 24);
+
+	for(int y = 0; y < height; ++y)
+	{
+		InterleaveRGB(&red[y * planeBpl], &green[y * planeBpl], &blue[y * planeBpl], &data[y * bytesPerLine], width);
 	}
 }
 
 void msaImage::ComposeRGBA(msaImage &red, msaImage &green, msaImage &blue, msaImage &alpha)
 {
+	MSA_PROFILE_SCOPE("ComposeRGBA", (long long)red.Width() * red.Height());
+
 	if(red.Depth() != 8 || green.Depth() != 8 || blue.Depth() != 8 || alpha.Depth() != 8)
 		throw "All composite inputs must be an 8 bit images.";
 
@@ -1442,77 +1954,105 @@ void msaImage::ComposeRGBA(msaImage &red, msaImage &green, msaImage &blue, msaIm
 	
 	for(int y = 0; y < height; ++y)
 	{
-		unsigned char *rLine = &red.Data()[y * red.BytesPerLine()];
-		unsigned char *gLine = &green.Data()[y * blue.BytesPerLine()];
-		unsigned char *bLine = &blue.Data()[y * blue.BytesPerLine()];
-		unsigned char *aLine = &alpha.Data()[y * alpha.BytesPerLine()];
-		unsigned char *outLine = &data[y * bytesPerLine];
-		for(int x = 0; x < width; ++x)
-		{
-			*outLine++ = *rLine++;
-			*outLine++ = *gLine++;
-			*outLine++ = *bLine++;
-			*outLine++ = *aLine++;
-		}
+		InterleaveRGBA(&red.Data()[y * red.BytesPerLine()], &green.Data()[y * green.BytesPerLine()],
+				&blue.Data()[y * blue.BytesPerLine()], &alpha.Data()[y * alpha.BytesPerLine()],
+				&data[y * bytesPerLine], width);
 	}
 }
 
+void msaImage::ComposeRGBA(int w, int h, int planeBpl, unsigned char *red, unsigned char *green, unsigned char *blue,
+		unsigned char *alpha)
+{
+	MSA_PROFILE_SCOPE("ComposeRGBA/Buffers", (long long)w * h);
+
+	CreateImage(w, h, 32);
+
+	for(int y = 0; y < height; ++y)
+	{
+		InterleaveRGBA(&red[y * planeBpl], &green[y * planeBpl], &blue[y * planeBpl], &alpha[y * planeBpl],
+				&data[y * bytesPerLine], width);
+	}
+}
 
 void msaImage::SplitRGB(msaImage &red, msaImage &green, msaImage &blue)
 {
+	MSA_PROFILE_SCOPE("SplitRGB", (long long)width * height);
+
 	if(depth != 24)
 		throw "SplitRGB must be used on a 24 bit image.";
 
-	// set up output images
+	// set up output images; these keep their buffers if they're already the right size
 	red.CreateImage(width, height, 8);
 	green.CreateImage(width, height, 8);
 	blue.CreateImage(width, height, 8);
-	
+
+	// all three were created the same way, so they share a line length
+	SplitRGB(red.Data(), green.Data(), blue.Data(), red.BytesPerLine());
+}
+
+void msaImage::SplitRGB(unsigned char *red, unsigned char *green, unsigned char *blue, int planeBpl)
+{
+	MSA_PROFILE_SCOPE("SplitRGB/Buffers", (long long)width * height);
+
+	if(depth != 24)
+		throw "SplitRGB must be used on a 24 bit image.";
+
 	for(int y = 0; y < height; ++y)
 	{
-		unsigned char *rLine = &red.Data()[y * red.BytesPerLine()];
-		unsigned char *gLine = &green.Data()[y * green.BytesPerLine()];
-		unsigned char *bLine = &blue.Data()[y * blue.BytesPerLine()];
-		unsigned char *rgbLine = &data[y * bytesPerLine];
-		for(int x = 0; x < width; ++x)
+		if(planar)
 		{
-			*rLine++ = *rgbLine++;
-			*gLine++ = *rgbLine++;
-			*bLine++ = *rgbLine++;
+			// planes are already split, just copy them out
+			memcpy(&red[y * planeBpl], &Plane(0)[y * bytesPerLine], width);
+			memcpy(&green[y * planeBpl], &Plane(1)[y * bytesPerLine], width);
+			memcpy(&blue[y * planeBpl], &Plane(2)[y * bytesPerLine], width);
 		}
+		else
+			DeinterleaveRGB(&data[y * bytesPerLine], &red[y * planeBpl], &green[y * planeBpl], &blue[y * planeBpl], width);
 	}
 }
 
 void msaImage::SplitRGBA(msaImage &red, msaImage &green, msaImage &blue, msaImage &alpha)
 {
-	if(depth != 24)
+	MSA_PROFILE_SCOPE("SplitRGBA", (long long)width * height);
+
+	if(depth != 32 || isFloat)
 		throw "SplitRGBA must be used on a 32 bit image.";
 
-	// set up output images
+	// set up output images; these keep their buffers if they're already the right size
 	red.CreateImage(width, height, 8);
 	green.CreateImage(width, height, 8);
 	blue.CreateImage(width, height, 8);
 	alpha.CreateImage(width, height, 8);
-	
+
+	SplitRGBA(red.Data(), green.Data(), blue.Data(), alpha.Data(), red.BytesPerLine());
+}
+
+void msaImage::SplitRGBA(unsigned char *red, unsigned char *green, unsigned char *blue, unsigned char *alpha, int planeBpl)
+{
+	MSA_PROFILE_SCOPE("SplitRGBA/Buffers", (long long)width * height);
+
+	if(depth != 32 || isFloat)
+		throw "SplitRGBA must be used on a 32 bit image.";
+
 	for(int y = 0; y < height; ++y)
 	{
-		unsigned char *rLine = &red.Data()[y * red.BytesPerLine()];
-		unsigned char *gLine = &green.Data()[y * green.BytesPerLine()];
-		unsigned char *bLine = &blue.Data()[y * blue.BytesPerLine()];
-		unsigned char *aLine = &alpha.Data()[y * alpha.BytesPerLine()];
-		unsigned char *rgbaLine = &data[y * bytesPerLine];
-		for(int x = 0; x < width; ++x)
+		if(planar)
 		{
-			*rLine++ = *rgbaLine++;
-			*gLine++ = *rgbaLine++;
-			*bLine++ = *rgbaLine++;
-			*aLine++ = *rgbaLine++;
+			memcpy(&red[y * planeBpl], &Plane(0)[y * bytesPerLine], width);
+			memcpy(&green[y * planeBpl], &Plane(1)[y * bytesPerLine], width);
+			memcpy(&blue[y * planeBpl], &Plane(2)[y * bytesPerLine], width);
+			memcpy(&alpha[y * planeBpl], &Plane(3)[y * bytesPerLine], width);
 		}
+		else
+			DeinterleaveRGBA(&data[y * bytesPerLine], &red[y * planeBpl], &green[y * planeBpl], &blue[y * planeBpl],
+					&alpha[y * planeBpl], width);
 	}
 }
 
 void msaImage::ComposeHSV(msaImage &hue, msaImage &sat, msaImage &vol)
 {
+	MSA_PROFILE_SCOPE("ComposeHSV", (long long)hue.Width() * hue.Height());
+
 	if(hue.Depth() != 8 || sat.Depth() != 8 || vol.Depth() != 8)
 		throw "All composite inputs must be an 8 bit images.";
 
@@ -1550,6 +2090,8 @@ void msaImage::ComposeHSV(msaImage &hue, msaImage &sat, msaImage &vol)
 
 void msaImage::ComposeHSVA(msaImage &hue, msaImage &sat, msaImage &vol, msaImage &alpha)
 {
+	MSA_PROFILE_SCOPE("ComposeHSVA", (long long)hue.Width() * hue.Height());
+
 	if(hue.Depth() != 8 || sat.Depth() != 8 || vol.Depth() != 8 || alpha.Depth() != 8)
 		throw "All composite inputs must be an 8 bit images.";
 
@@ -1589,9 +2131,13 @@ void msaImage::ComposeHSVA(msaImage &hue, msaImage &sat, msaImage &vol, msaImage
 }
 
 void msaImage::SplitHSV(msaImage &hue, msaImage &sat, msaImage &vol)
-{	
+{
+	MSA_PROFILE_SCOPE("SplitHSV", (long long)width * height);
+	
 	if(depth != 24)
 		throw "SplitHSV must be used on a 24 bit image.";
+	if(planar)
+		throw "SplitHSV must be used on an interleaved image.";
 
 	// set up output images
 	hue.CreateImage(width, height, 8);
@@ -1622,8 +2168,12 @@ void msaImage::SplitHSV(msaImage &hue, msaImage &sat, msaImage &vol)
 
 void msaImage::SplitHSVA(msaImage &hue, msaImage &sat, msaImage &vol, msaImage &alpha)
 {
-	if(depth != 32)
+	MSA_PROFILE_SCOPE("SplitHSVA", (long long)width * height);
+
+	if(depth != 32 || isFloat)
 		throw "SplitHSVA must be used on a 32 bit image.";
+	if(planar)
+		throw "SplitHSVA must be used on an interleaved image.";
 
 	// set up output images
 	hue.CreateImage(width, height, 8);
@@ -1656,138 +2206,177 @@ void msaImage::SplitHSVA(msaImage &hue, msaImage &sat, msaImage &vol, msaImage &
 	}
 }
 
-void msaImage::MinImages(msaImage &input, msaImage &output)
+template <typename T, typename Op>
+void msaImage::CombineImages(msaImage &input, msaImage &output, Op op)
 {
 	// make sure input image matches dimensions
 	if(depth != input.Depth() || width != input.Width() || height != input.Height())
 		throw "Input images must match in size and color depth.";
+	if(planar != input.Planar())
+		throw "Input images must have the same layout.";
+	if(isFloat || input.IsFloat())
+		throw "Input images must match in size and color depth.";
 
-	output.CreateImage(width, height, depth);
+	CreateMatchingImage(output);
 
-	for(int y = 0; y < height; ++y)
+	// every sample is treated the same, so walk whole lines (or planes) as flat runs of samples
+	int lines, lineBytes;
+	GetSampleLines(lines, lineBytes);
+	int samples = lineBytes / sizeof(T);
+	int maxVal = (1 << (8 * sizeof(T))) - 1;
+
+	for(int y = 0; y < lines; ++y)
 	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			unsigned char c1 = *in1++;
-			unsigned char c2 = *in2++;
-			*out++ = c1 > c2 ? c2 : c1;
-		}
+		T *in1 = (T *)&data[y * bytesPerLine];
+		T *in2 = (T *)&input.Data()[y * input.BytesPerLine()];
+		T *out = (T *)&output.Data()[y * output.BytesPerLine()];
+		for(int x = 0; x < samples; ++x)
+			*out++ = (T)op(*in1++, *in2++, maxVal);
 	}
 }
 
-void msaImage::MaxImages(msaImage &input, msaImage &output)
+void msaImage::CombineFloatImages(msaImage &input, msaImage &output,
+		void (*rowOp)(const float *a, const float *b, float *out, int count))
 {
-	// make sure input image matches dimensions
-	if(depth != input.Depth() || width != input.Width() || height != input.Height())
+	if(!input.IsFloat() || depth != input.Depth() || width != input.Width() || height != input.Height())
 		throw "Input images must match in size and color depth.";
 
-	output.CreateImage(width, height, depth);
+	CreateMatchingImage(output);
 
+	int samples = width * Channels();
 	for(int y = 0; y < height; ++y)
 	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			unsigned char c1 = *in1++;
-			unsigned char c2 = *in2++;
-			*out++ = c1 > c2 ? c1 : c2;
-		}
+		rowOp((float *)&data[y * bytesPerLine], (float *)&input.Data()[y * input.BytesPerLine()],
+				(float *)&output.Data()[y * output.BytesPerLine()], samples);
 	}
 }
 
+void msaImage::MinImages(msaImage &input, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("MinImages", depth, isFloat), (long long)width * height);
+
+	if(isFloat)
+		CombineFloatImages(input, output, MinRowsFloat);
+	else if(depth == 1)
+		CombineImages<unsigned char>(input, output, [](int a, int b, int) { return a & b; });
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, [](int a, int b, int) { return a > b ? b : a; });
+	else
+		CombineImages<unsigned char>(input, output, [](int a, int b, int) { return a > b ? b : a; });
+}
+
+void msaImage::MaxImages(msaImage &input, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("MaxImages", depth, isFloat), (long long)width * height);
+
+	if(isFloat)
+		CombineFloatImages(input, output, MaxRowsFloat);
+	else if(depth == 1)
+		CombineImages<unsigned char>(input, output, [](int a, int b, int) { return a | b; });
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, [](int a, int b, int) { return a > b ? a : b; });
+	else
+		CombineImages<unsigned char>(input, output, [](int a, int b, int) { return a > b ? a : b; });
+}
+
+// average of the two images
+static inline int SumOp(int a, int b, int)
+{
+	return (a + b) / 2;
+}
+
+// difference centered on mid gray
+static inline int DiffOp(int a, int b, int maxVal)
+{
+	return maxVal / 2 + (a - b) / 2;
+}
+
+// product, scaled so full range times full range is (nearly) full range
+static inline int MultiplyOp(int a, int b, int maxVal)
+{
+	return (int)((long long)a * b / (maxVal + 1));
+}
+
+// ratio, scaled so equal values give (nearly) full range; saturates, and divide by zero gives full range
+static inline int DivideOp(int a, int b, int maxVal)
+{
+	if(b == 0)
+		return maxVal;
+
+	long long d = (long long)a * (maxVal + 1) / b;
+	return d > maxVal ? maxVal : (int)d;
+}
+
 void msaImage::SumImages(msaImage &input, msaImage &output)
 {
-	// make sure input image matches dimensions
-	if(depth != input.Depth() || width != input.Width() || height != input.Height())
-		throw "Input images must match in size and color depth.";
+	MSA_PROFILE_SCOPE(msaProfile::Name("SumImages", depth, isFloat), (long long)width * height);
 
-	output.CreateImage(width, height, depth);
+	if(depth == 1)
+		throw "Invalid image depth";
 
-	for(int y = 0; y < height; ++y)
-	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			int sum = *in1++ + *in2++;
-			*out++ = (unsigned char)sum / 2;
-		}
-	}
+	if(isFloat)
+		CombineFloatImages(input, output, AddRowsFloat);
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, SumOp);
+	else
+		CombineImages<unsigned char>(input, output, SumOp);
 }
 
 void msaImage::DiffImages(msaImage &input, msaImage &output)
 {
-	// make sure input image matches dimensions
-	if(depth != input.Depth() || width != input.Width() || height != input.Height())
-		throw "Input images must match in size and color depth.";
+	MSA_PROFILE_SCOPE(msaProfile::Name("DiffImages", depth, isFloat), (long long)width * height);
 
-	output.CreateImage(width, height, depth);
+	if(depth == 1)
+		throw "Invalid image depth";
 
-	for(int y = 0; y < height; ++y)
-	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			int diff = *in1++ - *in2++;
-			*out++ = (unsigned char)(127 + diff / 2);
-		}
-	}
+	if(isFloat)
+		CombineFloatImages(input, output, SubtractRowsFloat);
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, DiffOp);
+	else
+		CombineImages<unsigned char>(input, output, DiffOp);
 }
 
 void msaImage::MultiplyImages(msaImage &input, msaImage &output)
 {
-	// make sure input image matches dimensions
-	if(depth != input.Depth() || width != input.Width() || height != input.Height())
-		throw "Input images must match in size and color depth.";
+	MSA_PROFILE_SCOPE(msaProfile::Name("MultiplyImages", depth, isFloat), (long long)width * height);
 
-	output.CreateImage(width, height, depth);
+	if(depth == 1)
+		throw "Invalid image depth";
 
-	for(int y = 0; y < height; ++y)
-	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			int m = *in1++ * *in2++;
-			*out++ = (unsigned char)(m / 256);
-		}
-	}
+	if(isFloat)
+		CombineFloatImages(input, output, MultiplyRowsFloat);
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, MultiplyOp);
+	else
+		CombineImages<unsigned char>(input, output, MultiplyOp);
 }
 
 void msaImage::DivideImages(msaImage &input, msaImage &output)
 {
-	// make sure input image matches dimensions
-	if(depth != input.Depth() || width != input.Width() || height != input.Height())
-		throw "Input images must match in size and color depth.";
+	MSA_PROFILE_SCOPE(msaProfile::Name("DivideImages", depth, isFloat), (long long)width * height);
 
-	output.CreateImage(width, height, depth);
+	if(depth == 1)
+		throw "Invalid image depth";
 
-	for(int y = 0; y < height; ++y)
-	{
-		unsigned char *in1 = &data[y * bytesPerLine];
-		unsigned char *in2 = &input.Data()[y * input.BytesPerLine()];
-		unsigned char *out = &output.Data()[y * output.BytesPerLine()];
-		for(int x = 0; x < width; ++x)
-		{
-			int d = *in1++ * 256 / *in2++;
-			*out++ = (unsigned char)d;
-		}
-	}
+	if(isFloat)
+		CombineFloatImages(input, output, DivideRowsFloat);
+	else if(BitsPerSample() == 16)
+		CombineImages<unsigned short>(input, output, DivideOp);
+	else
+		CombineImages<unsigned char>(input, output, DivideOp);
 }
 
 void msaImage::OverlayImage(msaImage &overlay, int destx, int desty, int w, int h)
 {
-	if(depth != overlay.Depth())
+	MSA_PROFILE_SCOPE(msaProfile::Name("OverlayImage", depth, isFloat), (long long)w * h);
+
+	if(depth != overlay.Depth() || isFloat != overlay.IsFloat())
 		throw "Overlay image must match depth of base image";
+	if(isFloat)
+		throw "Overlay images can't be float";
+	if((planar || overlay.Planar()) && depth != 8)
+		throw "Overlay images must be interleaved";
 
 	// for 8 and 24 bit, just copy the data from the overlay image into the destination rectangle
 	if(depth == 8)
@@ -1828,12 +2417,23 @@ void msaImage::OverlayImage(msaImage &overlay, int destx, int desty, int w, int
 			}
 		}
 	}
+	else
+		throw "Invalid image depth";
 }
 
 void msaImage::OverlayImage(msaImage &overlay, msaImage &mask, int destx, int desty, int w, int h)
 {
-	if(depth != overlay.Depth())
+	MSA_PROFILE_SCOPE(msaProfile::Name("OverlayImage", "Mask", depth, isFloat), (long long)w * h);
+
+	if(depth != overlay.Depth() || isFloat != overlay.IsFloat())
 		throw "Overlay image must match depth of base image";
+	if(isFloat)
+		throw "Overlay images can't be float";
+	if((planar || overlay.Planar() || mask.Planar()) && depth != 8)
+		throw "Overlay images must be interleaved";
+
+	if((mask.Depth() != 8 && mask.Depth() != 24 && mask.Depth() != 32) || mask.IsFloat())
+		throw "Mask must be 8, 24 or 32 bit depth";
 
 	if(depth == 8)
 	{
@@ -1847,7 +2447,7 @@ void msaImage::OverlayImage(msaImage &overlay, msaImage &mask, int destx, int de
 				// grab data from overlay, base, and mask
 				unsigned char &g1 = data[(desty + y) * bytesPerLine + (destx + x)];
 				int g2 = overlay.Data()[y * overlay.BytesPerLine() + x];
-				int alpha = overlay.Data()[y * overlay.BytesPerLine() + x];
+				int alpha = mask.Data()[y * mask.BytesPerLine() + x];
 
 				// combine colors in ratio given by alpha channel
 				g2 = ((int)g1 * (255 - alpha) + g2 * alpha) / 255;
@@ -1872,24 +2472,24 @@ void msaImage::OverlayImage(msaImage &overlay, msaImage &mask, int destx, int de
 				int g2 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 1];
 				int b2 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 2];
 
-				int alpha1, alpha2, alpha3;
+				int alpha1 = 0, alpha2 = 0, alpha3 = 0;
 			       
 				if(mask.Depth() == 32)
 				{
-					alpha1 = overlay.Data()[y * overlay.BytesPerLine() + x * 4];
-					alpha2 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 1];
-					alpha3 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 2];
+					alpha1 = mask.Data()[y * mask.BytesPerLine() + x * 4];
+					alpha2 = mask.Data()[y * mask.BytesPerLine() + x * 4 + 1];
+					alpha3 = mask.Data()[y * mask.BytesPerLine() + x * 4 + 2];
 				}
 				else if(mask.Depth() == 24)
 				{
-					alpha1 = overlay.Data()[y * overlay.BytesPerLine() + x * 3];
-					alpha2 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 1];
-					alpha3 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 2];
+					alpha1 = mask.Data()[y * mask.BytesPerLine() + x * 3];
+					alpha2 = mask.Data()[y * mask.BytesPerLine() + x * 3 + 1];
+					alpha3 = mask.Data()[y * mask.BytesPerLine() + x * 3 + 2];
 				}
 				else if(mask.Depth() == 8)
 				{
 					alpha1 = alpha2 = alpha3 = 
-						overlay.Data()[y * overlay.BytesPerLine() + x];
+						mask.Data()[y * mask.BytesPerLine() + x];
 				}
 
 				// combine colors in ratio given by alpha channel
@@ -1919,24 +2519,24 @@ void msaImage::OverlayImage(msaImage &overlay, msaImage &mask, int destx, int de
 				int g2 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 1];
 				int b2 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 2];
 
-				int alpha1, alpha2, alpha3;
+				int alpha1 = 0, alpha2 = 0, alpha3 = 0;
 			       
 				if(mask.Depth() == 32)
 				{
-					alpha1 = overlay.Data()[y * overlay.BytesPerLine() + x * 4];
-					alpha2 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 1];
-					alpha3 = overlay.Data()[y * overlay.BytesPerLine() + x * 4 + 2];
+					alpha1 = mask.Data()[y * mask.BytesPerLine() + x * 4];
+					alpha2 = mask.Data()[y * mask.BytesPerLine() + x * 4 + 1];
+					alpha3 = mask.Data()[y * mask.BytesPerLine() + x * 4 + 2];
 				}
 				else if(mask.Depth() == 24)
 				{
-					alpha1 = overlay.Data()[y * overlay.BytesPerLine() + x * 3];
-					alpha2 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 1];
-					alpha3 = overlay.Data()[y * overlay.BytesPerLine() + x * 3 + 2];
+					alpha1 = mask.Data()[y * mask.BytesPerLine() + x * 3];
+					alpha2 = mask.Data()[y * mask.BytesPerLine() + x * 3 + 1];
+					alpha3 = mask.Data()[y * mask.BytesPerLine() + x * 3 + 2];
 				}
 				else if(mask.Depth() == 8)
 				{
 					alpha1 = alpha2 = alpha3 = 
-						overlay.Data()[y * overlay.BytesPerLine() + x];
+						mask.Data()[y * mask.BytesPerLine() + x];
 				}
 
 				// combine colors in ratio given by alpha channel
@@ -1951,5 +2551,599 @@ void msaImage::OverlayImage(msaImage &overlay, msaImage &mask, int destx, int de
 			}
 		}
 	}
+	else
+		throw "Invalid image depth";
+}
+
+
+void msaImage::SimpleConvert16(int newDepth, msaPixel &color, msaImage &output)
+{
+	int newBits = (newDepth == 16 || newDepth == 48 || newDepth == 64) ? 16 : 8;
+
+	if(BitsPerSample() == 8)
+	{
+		// get to the right number of channels at 8 bits first, then widen the samples
+		msaImage temp;
+		msaImage *source = this;
+		if(depth != newDepth / 2)
+		{
+			SimpleConvert(newDepth / 2, color, temp);
+			source = &temp;
+		}
+
+		output.CreateImage(width, height, newDepth);
+		int samples = width * source->Channels();
+		for(int y = 0; y < height; ++y)
+		{
+			unsigned char *inLine = &source->Data()[y * source->BytesPerLine()];
+			unsigned short *outLine = (unsigned short *)&output.Data()[y * output.BytesPerLine()];
+			for(int x = 0; x < samples; ++x)
+				*outLine++ = *inLine++ * 257;	// 255 maps to 65535
+		}
+		return;
+	}
+
+	if(newBits == 8)
+	{
+		// narrow the samples, then let the 8 bit conversion handle any change in channels
+		msaImage temp;
+		msaImage &narrow = (depth / 2 == newDepth) ? output : temp;
+
+		narrow.CreateImage(width, height, depth / 2);
+		int samples = width * Channels();
+		for(int y = 0; y < height; ++y)
+		{
+			unsigned short *inLine = (unsigned short *)&data[y * bytesPerLine];
+			unsigned char *outLine = &narrow.Data()[y * narrow.BytesPerLine()];
+			for(int x = 0; x < samples; ++x)
+				*outLine++ = *inLine++ >> 8;
+		}
+
+		if(&narrow == &temp)
+			temp.SimpleConvert(newDepth, color, output);
+		return;
+	}
+
+	// 16 bit to 16 bit
+	if(depth == newDepth)
+	{
+		output.SetCopyData(width, height, bytesPerLine, depth, data);
+		return;
+	}
+
+	output.CreateImage(width, height, newDepth);
+	int inChannels = Channels();
+	int outChannels = output.Channels();
+
+	for(int y = 0; y < height; ++y)
+	{
+		unsigned short *in = (unsigned short *)&data[y * bytesPerLine];
+		unsigned short *out = (unsigned short *)&output.Data()[y * output.BytesPerLine()];
+		for(int x = 0; x < width; ++x)
+		{
+			if(outChannels == 1)
+			{
+				// relative brightness of each color component, same 20/70/10 weights as the 8 bit tables
+				*out++ = (unsigned short)((in[0] * 13107LL + in[1] * 45875LL + in[2] * 6554LL + 32768) >> 16);
+			}
+			else if(inChannels == 1)
+			{
+				// assume color corresponds to white, scale between that and black
+				*out++ = in[0] * color.r / 255;
+				*out++ = in[0] * color.g / 255;
+				*out++ = in[0] * color.b / 255;
+				if(outChannels == 4)
+					*out++ = color.a * 257;
+			}
+			else
+			{
+				// copy r, g, b, then drop or add alpha
+				*out++ = in[0];
+				*out++ = in[1];
+				*out++ = in[2];
+				if(outChannels == 4)
+					*out++ = color.a * 257;
+			}
+			in += inChannels;
+		}
+	}
+}
+
+// out of bounds color for each channel, widened to the sample type
+template <typename T>
+static inline void GetOutOfBoundsValues(msaAffineTransform &transform, T oob[4])
+{
+	int scale = (int)(((1LL << (8 * sizeof(T))) - 1) / 255);
+	oob[0] = transform.oob_r * scale;
+	oob[1] = transform.oob_g * scale;
+	oob[2] = transform.oob_b * scale;
+	oob[3] = transform.oob_a * scale;
+}
+
+template <typename T, int C>
+unsigned char *msaImage::transformN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input,
+		int quality)
+{
+	if(quality < 34)
+		return transformFastN<T, C>(transform, width, height, bpl, input);
+	else if(quality < 67)
+		return transformBetterN<T, C>(transform, width, height, bpl, input);
+	else
+		return transformBestN<T, C>(transform, width, height, bpl, input);
+}
+
+// use nearest source pixel, no interpolation
+template <typename T, int C>
+unsigned char *msaImage::transformFastN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input)
+{
+	int newH = height;
+	int newW = width;
+	int newBPL = (newW * C * (int)sizeof(T) + 3) / 4 * 4;
+
+	// allocate space for output data
+	unsigned char *output = new unsigned char[newH * newBPL];
+
+	T oob[4];
+	GetOutOfBoundsValues<T>(transform, oob);
+
+	for(int y = 0; y < newH; ++y)
+	{
+		T *out = (T *)&output[y * newBPL];
+		for(int x = 0; x < newW; ++x)
+		{
+			double nx = x;
+			double ny = y;
+			transform.InvTransform(nx, ny);
+
+			if(nx < 0 || ny < 0 || (int)nx >= width || (int)ny >= height)
+			{
+				for(int c = 0; c < C; ++c)
+					*out++ = oob[c];
+			}
+			else
+			{
+				T *in = (T *)&input[(int)ny * bpl] + (int)nx * C;
+				for(int c = 0; c < C; ++c)
+					*out++ = in[c];
+			}
+		}
+	}
+
+	// return new values
+	width = newW;
+	height = newH;
+	bpl = newBPL;
+	return output;
+}
+
+// cosine curve for interpolation between two points on each axis
+template <typename T, int C>
+unsigned char *msaImage::transformBetterN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input)
+{
+	int newH = height;
+	int newW = width;
+	int newBPL = (newW * C * (int)sizeof(T) + 3) / 4 * 4;
+
+	// allocate space for output data
+	unsigned char *output = new unsigned char[newH * newBPL];
+
+	T oob[4];
+	GetOutOfBoundsValues<T>(transform, oob);
+
+	for(int y = 0; y < newH; ++y)
+	{
+		T *out = (T *)&output[y * newBPL];
+		for(int x = 0; x < newW; ++x)
+		{
+			double nx = x;
+			double ny = y;
+			transform.InvTransform(nx, ny);
+
+			if(nx < 0 || ny < 0 || (int)nx > width - 2 || (int)ny > height - 2)
+			{
+				for(int c = 0; c < C; ++c)
+					*out++ = oob[c];
+				continue;
+			}
+
+			int wholeX = (int)nx;
+			int fracX = (int)(256.0 * nx) - 256 * wholeX;
+			int wholeY = (int)ny;
+			int fracY = (int)(256.0 * ny) - 256 * wholeY;
+
+			// 16 bit samples times 16 bit weights need 64 bit intermediates
+			T *top = (T *)&input[wholeY * bpl] + wholeX * C;
+			T *bottom = (T *)&input[(wholeY + 1) * bpl] + wholeX * C;
+			for(int c = 0; c < C; ++c)
+			{
+				long long v1 = (top[c] * (long long)fastCos[fracX] + top[c + C] * (long long)fastCosInv[fracX]) >> 16;
+				long long v2 = (bottom[c] * (long long)fastCos[fracX] + bottom[c + C] * (long long)fastCosInv[fracX]) >> 16;
+				*out++ = (T)((v1 * fastCos[fracY] + v2 * fastCosInv[fracY]) >> 16);
+			}
+		}
+	}
+
+	// return new values
+	width = newW;
+	height = newH;
+	bpl = newBPL;
+	return output;
+}
+
+// bicubic interpolation between four points along each axis
+template <typename T, int C>
+unsigned char *msaImage::transformBestN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input)
+{
+	int newH = height;
+	int newW = width;
+	int newBPL = (newW * C * (int)sizeof(T) + 3) / 4 * 4;
+	long long maxVal = (1LL << (8 * sizeof(T))) - 1;
+
+	// allocate space for output data
+	unsigned char *output = new unsigned char[newH * newBPL];
+
+	T oob[4];
+	GetOutOfBoundsValues<T>(transform, oob);
+
+	for(int y = 0; y < newH; ++y)
+	{
+		T *out = (T *)&output[y * newBPL];
+		for(int x = 0; x < newW; ++x)
+		{
+			double nx = x;
+			double ny = y;
+			transform.InvTransform(nx, ny);
+
+			if(nx < 1 || ny < 1 || (int)nx >= width - 2 || (int)ny >= height - 2)
+			{
+				for(int c = 0; c < C; ++c)
+					*out++ = oob[c];
+				continue;
+			}
+
+			int wholeX = (int)nx;
+			int fracX = (int)(256.0 * nx) - 256 * wholeX;
+			int wholeY = (int)ny;
+			int fracY = (int)(256.0 * ny) - 256 * wholeY;
+
+			for(int c = 0; c < C; ++c)
+			{
+				// do horizontal interpolation on each of the four lines
+				long long rows[4];
+				for(int line = 0; line < 4; ++line)
+				{
+					T *ptr = (T *)&input[(wholeY - 1 + line) * bpl] + (wholeX - 1) * C + c;
+					rows[line] = (ptr[0] * (long long)bcint1[fracX] + ptr[C] * (long long)bcint2[fracX] +
+						ptr[2 * C] * (long long)bcint3[fracX] + ptr[3 * C] * (long long)bcint4[fracX]) >> 16;
+				}
+
+				// do vertical interpolation
+				long long v = (rows[0] * bcint1[fracY] + rows[1] * bcint2[fracY] + rows[2] * bcint3[fracY] +
+					rows[3] * bcint4[fracY]) >> 16;
+
+				// clip values (bicubic interpolation can overflow and underflow)
+				if(v < 0) v = 0;
+				if(v > maxVal) v = maxVal;
+
+				*out++ = (T)v;
+			}
+		}
+	}
+
+	// return new values
+	width = newW;
+	height = newH;
+	bpl = newBPL;
+	return output;
+}
+
+void msaImage::SimpleConvert1(int newDepth, msaPixel &color, msaImage &output)
+{
+	if(depth == 1 && newDepth == 1)
+	{
+		output.SetCopyData(width, height, bytesPerLine, depth, data);
+		return;
+	}
+
+	if(depth == 1)
+	{
+		// expand to gray, then let the usual conversion take it the rest of the way
+		msaImage gray;
+		msaImage &target = newDepth == 8 ? output : gray;
+		target.CreateImage(width, height, 8);
+		for(int y = 0; y < height; ++y)
+			ExpandBitsRow(&data[y * bytesPerLine], &target.Data()[y * target.BytesPerLine()], 0, 255, width);
+
+		if(newDepth != 8)
+			gray.SimpleConvert(newDepth, color, output);
+		return;
+	}
+
+	if(depth == 8)
+	{
+		Threshold(128, output);
+		return;
+	}
+
+	msaImage gray;
+	SimpleConvert(8, color, gray);
+	gray.Threshold(128, output);
+}
+
+/*
+	Resizing is separable: each output line is a weighted sum of a few input lines, and each
+	output pixel of that a weighted sum of a few of its pixels.  The taps and weights of every
+	output line and column are worked out once, the same number for each so the loops are plain,
+	and each output line goes down the columns and then across, so nothing bigger than a line is
+	kept in between.  Going down the columns first means a reduction only works across the lines
+	it keeps.
+
+	The column sums are float, so Lanczos3's negative lobes carry through to the pass across and
+	samples are rounded and clamped just once, at the end.  Each input line is converted to float
+	once, into a ring of as many lines as there are taps, and the column sums go through the
+	dispatched multiply add row kernel a whole line of samples at a time.  The pass across stays
+	plain C++: each output pixel reads its own few pixels of the line, at a fractional step, which
+	the straight line row kernels have no way to gather.
+*/
+struct ResizeTaps
+{
+	int taps;
+	// taps entries per output pixel: input indices, clamped, and weights summing to 1
+	std::vector<int> index;
+	std::vector<float> weights;
+};
+
+static double Lanczos3(double x)
+{
+	if(x == 0.0)
+		return 1.0;
+	if(x <= -3.0 || x >= 3.0)
+		return 0.0;
+	double px = M_PI * x;
+	return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
 }
 
+// the taps of each of outSize pixels from inSize; input pixel j spans j to j + 1
+static void GetResizeTaps(int inSize, int outSize, msaImage::ResizeFilter filter, ResizeTaps &taps)
+{
+	double scale = (double)inSize / outSize;
+	double stretch = std::max(scale, 1.0);
+	bool area = filter == msaImage::ResizeFilter::Area;
+	// an output pixel covers scale input pixels, so touches at most one more than that
+	taps.taps = area ? (int)ceil(scale) + 1 : (int)ceil(6.0 * stretch) + 1;
+	taps.index.resize(outSize * taps.taps);
+	taps.weights.resize(outSize * taps.taps);
+
+	std::vector<double> weights(taps.taps);
+	for(int i = 0; i < outSize; ++i)
+	{
+		double center = (i + 0.5) * scale;
+		int first = area ? (int)floor(i * scale) : (int)floor(center - 3.0 * stretch);
+		double total = 0.0;
+		for(int k = 0; k < taps.taps; ++k)
+		{
+			int j = first + k;
+			if(area)
+				weights[k] = std::max(0.0, std::min(j + 1.0, (i + 1) * scale) - std::max((double)j, i * scale));
+			else
+				weights[k] = Lanczos3((j + 0.5 - center) / stretch);
+			total += weights[k];
+		}
+
+		for(int k = 0; k < taps.taps; ++k)
+		{
+			taps.index[i * taps.taps + k] = std::min(std::max(first + k, 0), inSize - 1);
+			taps.weights[i * taps.taps + k] = (float)(weights[k] / total);
+		}
+	}
+}
+
+// an input line as float, converted into buffer, or the line itself if it's float already
+static inline const float *ResizeLine(const unsigned char *in, float *buffer, int count)
+{
+	BytesToFloat(in, buffer, 1.0f, count);
+	return buffer;
+}
+
+static inline const float *ResizeLine(const unsigned short *in, float *buffer, int count)
+{
+	ShortsToFloat(in, buffer, 1.0f, count);
+	return buffer;
+}
+
+static inline const float *ResizeLine(const float *in, float *, int)
+{
+	return in;
+}
+
+// round and clamp a resized sample, float samples are stored as they are
+template <typename T>
+static inline T ResizedSample(float v)
+{
+	if(std::is_floating_point<T>::value)
+		return (T)v;
+	if(v <= 0.0f)
+		return 0;
+	if(v >= (float)std::numeric_limits<T>::max())
+		return std::numeric_limits<T>::max();
+	return (T)(v + 0.5f);
+}
+
+template <typename T, int C>
+unsigned char *msaImage::resizeN(int newW, int newH, ResizeFilter filter, int &newBPL, unsigned char *input)
+{
+	int lineSamples = width * C;
+	newBPL = (newW * C * sizeof(T) + 3) / 4 * 4;
+	unsigned char *output = new unsigned char[newH * newBPL];
+
+	// whole number reductions by area are the mean of each block, summed exactly
+	if(filter == ResizeFilter::Area && width % newW == 0 && height % newH == 0)
+	{
+		typedef typename std::conditional<std::is_floating_point<T>::value, double, unsigned long long>::type S;
+		int factorX = width / newW;
+		int factorY = height / newH;
+		S count = (S)factorX * factorY;
+		std::vector<S> columns(lineSamples);
+		for(int y = 0; y < newH; ++y)
+		{
+			std::fill(columns.begin(), columns.end(), 0);
+			for(int filtY = 0; filtY < factorY; ++filtY)
+			{
+				const T *pin = (const T *)&input[(y * factorY + filtY) * bytesPerLine];
+				for(int s = 0; s < lineSamples; ++s)
+					columns[s] += pin[s];
+			}
+
+			T *pout = (T *)&output[y * newBPL];
+			for(int x = 0; x < newW; ++x)
+			{
+				for(int c = 0; c < C; ++c)
+				{
+					S sum = 0;
+					for(int filtX = 0; filtX < factorX; ++filtX)
+						sum += columns[(x * factorX + filtX) * C + c];
+					if(std::is_floating_point<T>::value)
+						pout[x * C + c] = (T)(sum / count);
+					else
+						pout[x * C + c] = (T)((sum + count / 2) / count);
+				}
+			}
+		}
+		return output;
+	}
+
+	ResizeTaps across, down;
+	GetResizeTaps(width, newW, filter, across);
+	GetResizeTaps(height, newH, filter, down);
+
+	// input line i is held in slot i % taps, which no other line a window reaches shares
+	std::vector<float> ring(down.taps * lineSamples);
+	std::vector<const float *> held(down.taps, NULL);
+	std::vector<int> heldLine(down.taps, -1);
+	std::vector<float> column(lineSamples);
+	for(int y = 0; y < newH; ++y)
+	{
+		std::fill(column.begin(), column.end(), 0.0f);
+		for(int k = 0; k < down.taps; ++k)
+		{
+			int line = down.index[y * down.taps + k];
+			int slot = line % down.taps;
+			if(heldLine[slot] != line)
+			{
+				held[slot] = ResizeLine((const T *)&input[line * bytesPerLine], &ring[slot * lineSamples], lineSamples);
+				heldLine[slot] = line;
+			}
+			MultiplyAddRowFloat(held[slot], down.weights[y * down.taps + k], &column[0], lineSamples);
+		}
+
+		T *pout = (T *)&output[y * newBPL];
+		for(int x = 0; x < newW; ++x)
+		{
+			const int *index = &across.index[x * across.taps];
+			const float *weights = &across.weights[x * across.taps];
+			float sums[C] = {};
+			for(int k = 0; k < across.taps; ++k)
+			{
+				const float *pin = &column[index[k] * C];
+				for(int c = 0; c < C; ++c)
+					sums[c] += weights[k] * pin[c];
+			}
+			for(int c = 0; c < C; ++c)
+				pout[x * C + c] = ResizedSample<T>(sums[c]);
+		}
+	}
+	return output;
+}
+
+void msaImage::Resize(int newW, int newH, ResizeFilter filter, msaImage &outimg)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name(planar ? "Resize/Planar" : "Resize",
+			filter == ResizeFilter::Area ? "Area" : "Lanczos3", depth, isFloat), (long long)newW * newH);
+
+	if(newW < 1 || newH < 1)
+		throw "Width and height of resized image must be at least 1 pixel";
+
+	unsigned char *output;
+	int newBPL;
+
+	// bitonal images are resized as gray, so reductions come out as the share of white, then
+	//  thresholded
+	if(depth == 1)
+	{
+		msaPixel white = { 255, 255, 255, 255 };
+		msaImage gray, grayOut;
+		SimpleConvert(8, white, gray);
+		gray.Resize(newW, newH, filter, grayOut);
+		grayOut.Threshold(128, outimg);
+		return;
+	}
+
+	// planar images are resized one plane at a time as grayscale images
+	if(planar && Channels() > 1)
+	{
+		if(depth != 24 && depth != 32 && depth != 48 && depth != 64)
+			throw "Invalid bit depth";
+
+		unsigned char *planes = NULL;
+		for(int c = 0; c < Channels(); ++c)
+		{
+			if(BitsPerSample() == 16)
+				output = resizeN<unsigned short, 1>(newW, newH, filter, newBPL, Plane(c));
+			else
+				output = resizeN<unsigned char, 1>(newW, newH, filter, newBPL, Plane(c));
+
+			if(planes == NULL)
+				planes = new unsigned char[Channels() * newH * newBPL];
+			memcpy(&planes[c * newH * newBPL], output, newH * newBPL);
+			delete[] output;
+		}
+
+		outimg.TakeExternalData(newW, newH, newBPL, depth, planes, true);
+		return;
+	}
+
+	if(isFloat)
+	{
+		switch(Channels())
+		{
+			case 1:
+				output = resizeN<float, 1>(newW, newH, filter, newBPL, data);
+				break;
+			case 3:
+				output = resizeN<float, 3>(newW, newH, filter, newBPL, data);
+				break;
+			case 4:
+				output = resizeN<float, 4>(newW, newH, filter, newBPL, data);
+				break;
+			default:
+				throw "Invalid bit depth";
+		}
+		outimg.TakeExternalData(newW, newH, newBPL, depth, output, false, true);
+		return;
+	}
+
+	switch(depth)
+	{
+		case 8:
+			output = resizeN<unsigned char, 1>(newW, newH, filter, newBPL, data);
+			break;
+		case 24:
+			output = resizeN<unsigned char, 3>(newW, newH, filter, newBPL, data);
+			break;
+		case 32:
+			output = resizeN<unsigned char, 4>(newW, newH, filter, newBPL, data);
+			break;
+		case 16:
+			output = resizeN<unsigned short, 1>(newW, newH, filter, newBPL, data);
+			break;
+		case 48:
+			output = resizeN<unsigned short, 3>(newW, newH, filter, newBPL, data);
+			break;
+		case 64:
+			output = resizeN<unsigned short, 4>(newW, newH, filter, newBPL, data);
+			break;
+		default:
+			throw "Invalid bit depth";
+	}
+	outimg.TakeExternalData(newW, newH, newBPL, depth, output);
+}
@@ -1,8 +1,9 @@
 #ifndef _msaImage_included
 #define _msaImage_included
 #include "msaAffine.h"
+#include "msaExport.h"
 
-class msaPixel
+class MSA_API msaPixel
 {
 public:
 	unsigned char r;
@@ -12,7 +13,15 @@ public:
 };
 
 // depths 1 for bitonal, 8 for grayscale, 24 for RGB, 32 for RGBA
-class msaImage
+// bitonal images are packed 8 pixels to a byte, first pixel in the high bit, with set bits white;
+//  their lines are padded to whole 64 bit words so they can be processed a word at a time
+// high bit depths 16 for grayscale, 48 for RGB, 64 for RGBA use 16 bit native endian samples
+//  (their lines, like those of float images, must start on a whole sample boundary)
+// float images have 32 bit float samples, depths 32 for grayscale, 96 for RGB, 128 for RGBA; they are
+//  marked by IsFloat() since depth 32 alone would be RGBA, and samples aren't clamped to any range
+// color images are normally interleaved (RGBRGB...), but may also be planar, where each channel
+//  is stored as a contiguous plane of height * bytesPerLine bytes (RRR...GGG...BBB...)
+class MSA_API msaImage
 {
 protected:
 	int width;
@@ -21,11 +30,24 @@ protected:
 	unsigned char *data;
 	int depth;
 	bool ownsData;
+	bool planar;
+	bool isFloat;
 
 public:
 	msaImage();
 	~msaImage();
 
+	// how Resize() weighs the input pixels: Area averages the input pixels each output pixel
+	//  covers by how much of each it covers, and whole number factors both ways take the exact
+	//  mean of each block; Lanczos3 is the sinc windowed over 3 lobes, stretched to the output's
+	//  pixel size when shrinking so nothing aliases, sharper than Area but with a little ringing
+	//  at hard edges
+	enum class ResizeFilter
+	{
+		Area = 0,
+		Lanczos3
+	};
+
 	// accessor functions
 	bool OwnsData();
 	int Width();
@@ -33,26 +55,70 @@ public:
 	int Depth();
 	int BytesPerLine();
 	unsigned char *Data();
+	bool Planar();
+	int Channels();
+	int BitsPerSample();
+	bool IsFloat();
+	// first line of the given channel; for interleaved images this is just the image data
+	unsigned char *Plane(int channel);
 	
-	// create a blank image
+	// create a blank image; an owned buffer that already has this shape is reused
 	void CreateImage(int width, int height, int depth);
-	// create solid color image
+	// create solid color image; 16 bit per channel images scale the fill color up to full range
 	void CreateImage(int width, int height, int depth, const msaPixel &fill);
+	// create a blank image with each channel in its own plane
+	void CreatePlanarImage(int width, int height, int depth);
+	// create a blank interleaved float image with 1, 3 or 4 channels
+	void CreateFloatImage(int width, int height, int channels);
 
 	// point to data in an external buffer, don't own the buffer
-	void UseExternalData(int width, int height, int bytesPerLine, int depth, unsigned char *data);
+	void UseExternalData(int width, int height, int bytesPerLine, int depth, unsigned char *data, bool planar = false,
+			bool isFloat = false);
 	// point to data in an external buffer, do own the buffer (buffer must be allocated with new[]
-	void TakeExternalData(int width, int height, int bytesPerLine, int depth, unsigned char *data);
+	void TakeExternalData(int width, int height, int bytesPerLine, int depth, unsigned char *data, bool planar = false,
+			bool isFloat = false);
 	// copy data in from an external buffer
 	void SetCopyData(int width, int height, int bytesPerLine, int depth, unsigned char *data);
 
+	// convert between interleaved and planar layouts
+	void ToPlanar(msaImage &output);
+	void ToInterleaved(msaImage &output);
+
+	// convert an 8 or 16 bit per channel image to float with the same channels, multiplying each
+	//  sample by scale; a scale of 0 maps the full sample range to 0.0 - 1.0
+	void ToFloat(msaImage &output, float scale = 0.0f);
+	// convert a float image to newDepth, which must have the same number of channels; samples are
+	//  multiplied by scale, rounded and clamped, and a scale of 0 maps 0.0 - 1.0 to the full range
+	void FromFloat(int newDepth, msaImage &output, float scale = 0.0f);
+
 	void TransformImage(msaAffineTransform &trans, msaImage &output, int quality);
+	// scale to newWidth by newHeight, down the columns and then across the lines, with the weights
+	//  of every output line and column worked out once; unlike a transform, the output is the new
+	//  size, and the filter widens with the scale so large reductions don't alias
+	// pixels past the edges repeat the edge pixels, and every channel, alpha included, is filtered;
+	//  planar images are resized per plane and bitonal ones as gray, then thresholded
+	// samples are kept in float between the passes and rounded and clamped once at the end, so
+	//  Lanczos3 overshoot on the first pass carries through to the second
+	void Resize(int newWidth, int newHeight, ResizeFilter filter, msaImage &output);
 
 	// going from 8 bit to 24 or 32 bit, use color as white point, and scale accordingly
 	// going from to 32 bit, copy alpha channel from color to whole image
 	// going from color to 8 bit, use color as relative brightness of each color component
+	// going between 8 and 16 bits per channel, scale samples to the full range of the new depth
+	// going from 1 bit, white is 255 in gray, and is then treated as above
+	// going to 1 bit, convert to gray and threshold at mid gray
 	void SimpleConvert(int newDepth, msaPixel &color, msaImage &output);
 
+	// convert an 8 bit gray image to bitonal, pixels at or above threshold become white
+	void Threshold(int threshold, msaImage &output);
+	// convert an 8 bit gray image to bitonal against the mean of the w by h window around each
+	//  pixel; pixels at or above the local mean less offset become white
+	void AdaptiveThreshold(int w, int h, int offset, msaImage &output);
+	// same, with Sauvola's threshold mean * (1 + k * (stddev / 128 - 1)), which follows the local
+	//  contrast so faint text on a clean background survives; k is typically 0.2 to 0.5
+	// windows are clipped at the image edges, so edge pixels use the part of the window inside
+	void SauvolaThreshold(int w, int h, double k, msaImage &output);
+
 	// gray to 24 bit color conversion with 256 element array of pixels, to do false color mapping
 	void ColorMap(msaPixel map[256], msaImage &output);
 
@@ -65,10 +131,17 @@ public:
 	// compositing functions add 3 or 4 8 bit images to make a 24 or 32 bit image
 	void ComposeRGB(msaImage &red, msaImage &green, msaImage &blue);
 	void ComposeRGBA(msaImage &red, msaImage &green, msaImage &blue, msaImage &alpha);
+	// same, from caller owned planes that share a line length
+	void ComposeRGB(int width, int height, int planeBpl, unsigned char *red, unsigned char *green, unsigned char *blue);
+	void ComposeRGBA(int width, int height, int planeBpl, unsigned char *red, unsigned char *green, unsigned char *blue,
+			unsigned char *alpha);
 
 	// splitting functions to break 24 and 32 bit images down into RGB/RGBA planes
 	void SplitRGB(msaImage &red, msaImage &green, msaImage &blue);
 	void SplitRGBA(msaImage &red, msaImage &green, msaImage &blue, msaImage &alpha);
+	// same, into caller owned planes of at least height * planeBpl bytes, so nothing is allocated
+	void SplitRGB(unsigned char *red, unsigned char *green, unsigned char *blue, int planeBpl);
+	void SplitRGBA(unsigned char *red, unsigned char *green, unsigned char *blue, unsigned char *alpha, int planeBpl);
 
 	// compositing functions add 3 or 4 8 bit images to make a 24 or 32 bit image
 	void ComposeHSV(msaImage &hue, msaImage &sat, msaImage &vol);
@@ -78,7 +151,10 @@ public:
 	void SplitHSV(msaImage &hue, msaImage &saturation, msaImage &volume);
 	void SplitHSVA(msaImage &hue, msaImage &saturation, msaImage &volume, msaImage &alpha);
 
-	// image combination functions
+	// image combination functions; both images must have the same layout, output will match
+	// for bitonal images min and max are bitwise and and or, the others aren't supported
+	// for float images there's no rescaling: sum is a + b, diff is a - b, multiply is a * b and
+	//  divide is a / b, with divide by zero giving 0
 	void MinImages(msaImage &input, msaImage &output);
 	void MaxImages(msaImage &input, msaImage &output);
 	void SumImages(msaImage &input, msaImage &output);
@@ -95,6 +171,11 @@ public:
 	void OverlayImage(msaImage &overlay, msaImage &mask, int x, int y, int w, int h);
 
 protected:
+	// create an uninitialized image matching this one in size, depth and layout
+	void CreateMatchingImage(msaImage &output);
+	// number of lines and bytes per line of sample data, treating planes as extra lines
+	void GetSampleLines(int &lines, int &lineBytes);
+
 	// apply a transform to the given data type
 	unsigned char *transformFast32(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
 	unsigned char *transformBetter32(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
@@ -107,6 +188,34 @@ protected:
 	unsigned char *transformFast8(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
 	unsigned char *transformBetter8(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
 	unsigned char *transformBest8(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
+
+	// generic versions for wider sample types, T is the sample type and C the number of channels
+	template <typename T, int C>
+	unsigned char *transformFastN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
+	template <typename T, int C>
+	unsigned char *transformBetterN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
+	template <typename T, int C>
+	unsigned char *transformBestN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input);
+
+	// apply one of the generic transforms based on quality
+	template <typename T, int C>
+	unsigned char *transformN(msaAffineTransform &transform, int &width, int &height, int &bpl, unsigned char *input, int quality);
+
+	// resize samples of type T with C channels from input, which is laid out like this image
+	template <typename T, int C>
+	unsigned char *resizeN(int newW, int newH, ResizeFilter filter, int &newBPL, unsigned char *input);
+
+	// sample by sample combination of two images, used by the image combination functions
+	template <typename T, typename Op>
+	void CombineImages(msaImage &input, msaImage &output, Op op);
+	// same for float images, using a row kernel
+	void CombineFloatImages(msaImage &input, msaImage &output,
+			void (*rowOp)(const float *a, const float *b, float *out, int count));
+
+	// SimpleConvert for images with 16 bits per channel
+	void SimpleConvert16(int newDepth, msaPixel &color, msaImage &output);
+	// SimpleConvert to and from bitonal
+	void SimpleConvert1(int newDepth, msaPixel &color, msaImage &output);
 };
 #endif
 
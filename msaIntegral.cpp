@@ -0,0 +1,135 @@
+#include "msaIntegral.h"
+#include "msaProfile.h"
+
+msaIntegralImage::msaIntegralImage()
+{
+	m_width = 0;
+	m_height = 0;
+	m_channels = 0;
+}
+
+void msaIntegralImage::Create(msaImage &image, bool squares)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("IntegralImage", image.Depth()), (long long)image.Width() * image.Height());
+
+	if(image.IsFloat() || (image.Depth() != 8 && image.Depth() != 24 && image.Depth() != 32))
+		throw "Invalid image depth";
+
+	m_width = image.Width();
+	m_height = image.Height();
+	m_channels = image.Channels();
+
+	int stride = (m_width + 1) * m_channels;
+	size_t entries = (size_t)stride * (m_height + 1);
+	m_sums.assign(entries, 0);
+	m_squares.clear();
+	if(squares)
+		m_squares.assign(entries, 0);
+	MSA_PROFILE_ALLOC((long long)entries * sizeof(unsigned long long) * (squares ? 2 : 1));
+
+	// interleaved samples are channels apart, planar ones are next to each other in their plane
+	int step = image.Planar() ? 1 : m_channels;
+	int bpl = image.BytesPerLine();
+
+	for(int c = 0; c < m_channels; ++c)
+	{
+		const unsigned char *plane = image.Plane(c) + (image.Planar() ? 0 : c);
+
+		for(int y = 0; y < m_height; ++y)
+		{
+			const unsigned char *pin = plane + y * bpl;
+			const unsigned long long *above = &m_sums[y * stride + c];
+			unsigned long long *sum = &m_sums[(y + 1) * stride + c];
+			// running sums along the line, added to the line of totals above
+			unsigned long long lineSum = 0;
+			for(int x = 1; x <= m_width; ++x, pin += step)
+			{
+				lineSum += *pin;
+				sum[x * m_channels] = above[x * m_channels] + lineSum;
+			}
+
+			if(squares)
+			{
+				pin = plane + y * bpl;
+				above = &m_squares[y * stride + c];
+				sum = &m_squares[(y + 1) * stride + c];
+				lineSum = 0;
+				for(int x = 1; x <= m_width; ++x, pin += step)
+				{
+					lineSum += *pin * *pin;
+					sum[x * m_channels] = above[x * m_channels] + lineSum;
+				}
+			}
+		}
+	}
+}
+
+bool msaIntegralImage::Clip(int &x0, int &y0, int &x1, int &y1)
+{
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 >= m_width) x1 = m_width - 1;
+	if(y1 >= m_height) y1 = m_height - 1;
+	return x0 <= x1 && y0 <= y1;
+}
+
+unsigned long long msaIntegralImage::Lookup(const std::vector<unsigned long long> &table, int x0, int y0, int x1,
+		int y1, int channel)
+{
+	if(channel < 0 || channel >= m_channels)
+		throw "Invalid channel";
+	if(!Clip(x0, y0, x1, y1))
+		return 0;
+
+	int stride = (m_width + 1) * m_channels;
+	const unsigned long long *top = &table[y0 * stride + channel];
+	const unsigned long long *bottom = &table[(y1 + 1) * stride + channel];
+	return bottom[(x1 + 1) * m_channels] - bottom[x0 * m_channels] - top[(x1 + 1) * m_channels] + top[x0 * m_channels];
+}
+
+int msaIntegralImage::Count(int x0, int y0, int x1, int y1)
+{
+	if(!Clip(x0, y0, x1, y1))
+		return 0;
+	return (x1 - x0 + 1) * (y1 - y0 + 1);
+}
+
+unsigned long long msaIntegralImage::Sum(int x0, int y0, int x1, int y1, int channel)
+{
+	return Lookup(m_sums, x0, y0, x1, y1, channel);
+}
+
+unsigned long long msaIntegralImage::SumSquares(int x0, int y0, int x1, int y1, int channel)
+{
+	if(m_squares.empty())
+		throw "Integral image was created without squares";
+	return Lookup(m_squares, x0, y0, x1, y1, channel);
+}
+
+double msaIntegralImage::Mean(int x0, int y0, int x1, int y1, int channel)
+{
+	int count = Count(x0, y0, x1, y1);
+	if(count == 0)
+		return 0.0;
+	return (double)Sum(x0, y0, x1, y1, channel) / count;
+}
+
+double msaIntegralImage::Variance(int x0, int y0, int x1, int y1, int channel)
+{
+	int count = Count(x0, y0, x1, y1);
+	if(count == 0)
+		return 0.0;
+
+	unsigned long long sum = Sum(x0, y0, x1, y1, channel);
+	unsigned long long squares = SumSquares(x0, y0, x1, y1, channel);
+	double n = count;
+
+	// n * sum of squares - sum^2 is exact in 64 bits up to 2^24 pixels, so there's no cancellation
+	//  to go negative; beyond that fall back on doubles and clamp
+	if(count <= (1 << 24))
+		return (double)(squares * count - sum * sum) / (n * n);
+
+	double mean = sum / n;
+	double variance = squares / n - mean * mean;
+	return variance > 0.0 ? variance : 0.0;
+}
@@ -0,0 +1,55 @@
+#ifndef _msaIntegral_included
+#define _msaIntegral_included
+#include <vector>
+#include "msaImage.h"
+
+/*
+	Summed area tables for 8 bit per channel images.  Once built, the sum, mean and variance of
+	any rectangle of the image cost four table lookups each, however large the rectangle, which
+	is what local thresholding needs at every pixel.
+
+	Each table has a row and column of zeros ahead of the image, so entry (x, y) holds the sum of
+	all samples above and to the left of pixel (x, y).  Sums of squares are kept in a second table
+	when variance is wanted.  Rectangles are inclusive of both corners and are clipped to the
+	image, so a window hanging off an edge covers only the pixels inside it, and Count() says how
+	many that is.
+*/
+
+class MSA_API msaIntegralImage
+{
+public:
+	msaIntegralImage();
+
+	// build the tables from an 8, 24 or 32 bit image, interleaved or planar; leave out the
+	//  squares if only sums and means will be asked for
+	void Create(msaImage &image, bool squares = true);
+
+	int Width() { return m_width; };
+	int Height() { return m_height; };
+	int Channels() { return m_channels; };
+	bool HasSquares() { return !m_squares.empty(); };
+
+	// number of pixels in the rectangle x0, y0 to x1, y1 after clipping, possibly 0
+	int Count(int x0, int y0, int x1, int y1);
+	// sum of the samples, or of their squares, of one channel in the rectangle
+	unsigned long long Sum(int x0, int y0, int x1, int y1, int channel = 0);
+	unsigned long long SumSquares(int x0, int y0, int x1, int y1, int channel = 0);
+	// mean and population variance of one channel in the rectangle, 0 if it's empty
+	double Mean(int x0, int y0, int x1, int y1, int channel = 0);
+	double Variance(int x0, int y0, int x1, int y1, int channel = 0);
+
+protected:
+	int m_width;
+	int m_height;
+	int m_channels;
+	// (width + 1) * (height + 1) entries per channel, channels interleaved
+	std::vector<unsigned long long> m_sums;
+	std::vector<unsigned long long> m_squares;
+
+	// clip the rectangle, returns false if nothing is left
+	bool Clip(int &x0, int &y0, int &x1, int &y1);
+	unsigned long long Lookup(const std::vector<unsigned long long> &table, int x0, int y0, int x1, int y1,
+			int channel);
+};
+
+#endif
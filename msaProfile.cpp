@@ -0,0 +1,144 @@
+#include <chrono>
+#include <map>
+#include <mutex>
+#include "msaProfile.h"
+
+using namespace std;
+
+#ifdef MSA_PROFILE
+static mutex counterLock;
+static map<string, msaProfileCounter> counters;
+
+// innermost scope on each thread, so allocations can be charged to it
+static thread_local msaProfileScope *currentScope = NULL;
+
+static long long NowNanoseconds()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+msaProfileScope::msaProfileScope(const string &n, long long p)
+{
+	name = n;
+	pixels = p;
+	bytes = 0;
+	outer = currentScope;
+	currentScope = this;
+	start = NowNanoseconds();
+}
+
+msaProfileScope::~msaProfileScope()
+{
+	long long elapsed = NowNanoseconds() - start;
+	currentScope = outer;
+
+	// nested allocations count toward the outer operation too
+	if(outer != NULL)
+		outer->bytes += bytes;
+
+	lock_guard<mutex> lock(counterLock);
+	msaProfileCounter &counter = counters[name];
+	if(counter.name.empty())
+	{
+		counter.name = name;
+		counter.calls = 0;
+		counter.nanoseconds = 0;
+		counter.pixels = 0;
+		counter.bytesAllocated = 0;
+	}
+	counter.calls++;
+	counter.nanoseconds += elapsed;
+	counter.pixels += pixels;
+	counter.bytesAllocated += bytes;
+}
+
+void msaProfileScope::Allocated(long long b)
+{
+	if(currentScope != NULL)
+		currentScope->bytes += b;
+}
+
+bool msaProfile::Enabled()
+{
+	return true;
+}
+
+void msaProfile::Reset()
+{
+	lock_guard<mutex> lock(counterLock);
+	counters.clear();
+}
+
+vector<msaProfileCounter> msaProfile::GetCounters()
+{
+	lock_guard<mutex> lock(counterLock);
+	vector<msaProfileCounter> result;
+	for(map<string, msaProfileCounter>::iterator it = counters.begin(); it != counters.end(); ++it)
+		result.push_back(it->second);
+	return result;
+}
+
+bool msaProfile::GetCounter(const string &name, msaProfileCounter &counter)
+{
+	lock_guard<mutex> lock(counterLock);
+	map<string, msaProfileCounter>::iterator it = counters.find(name);
+	if(it == counters.end())
+		return false;
+	counter = it->second;
+	return true;
+}
+#else
+bool msaProfile::Enabled()
+{
+	return false;
+}
+
+void msaProfile::Reset()
+{
+}
+
+vector<msaProfileCounter> msaProfile::GetCounters()
+{
+	return vector<msaProfileCounter>();
+}
+
+bool msaProfile::GetCounter(const string &, msaProfileCounter &)
+{
+	return false;
+}
+#endif
+
+string msaProfile::ToJSON()
+{
+	vector<msaProfileCounter> list = GetCounters();
+	string json = "[";
+	for(size_t i = 0; i < list.size(); ++i)
+	{
+		char line[512];
+		snprintf(line, sizeof(line), "%s\n  {\"name\": \"%s\", \"calls\": %llu, \"nanoseconds\": %llu, "
+				"\"pixels\": %llu, \"bytes_allocated\": %llu}", i == 0 ? "" : ",", list[i].name.c_str(),
+				list[i].calls, list[i].nanoseconds, list[i].pixels, list[i].bytesAllocated);
+		json += line;
+	}
+	json += list.empty() ? "]" : "\n]";
+	return json;
+}
+
+void msaProfile::DumpJSON(FILE *fp)
+{
+	fprintf(fp, "%s\n", ToJSON().c_str());
+}
+
+string msaProfile::Name(const char *operation, const char *variant, int depth, bool isFloat)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%s/%s%d", operation, variant, isFloat ? "f" : "", depth);
+	return name;
+}
+
+string msaProfile::Name(const char *operation, int depth, bool isFloat)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%s%d", operation, isFloat ? "f" : "", depth);
+	return name;
+}
@@ -0,0 +1,78 @@
+#ifndef _msaProfile_included
+#define _msaProfile_included
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "msaExport.h"
+
+/*
+	Opt in profiling counters for msaImage and msaFilters operations.  Build with -DMSA_PROFILE
+	and each instrumented operation records its call count, time, pixels processed and bytes
+	allocated under a name like "FilterImage/Gaussian/24".  Without MSA_PROFILE the macros expand
+	to nothing, so the operations carry no overhead at all; the query functions still exist and
+	just report no counters.
+
+	Times include any operations called from inside an operation, so a bitonal transform also
+	counts toward the conversions it uses.  Counters are shared by all threads.
+*/
+
+class MSA_API msaProfileCounter
+{
+public:
+	std::string name;
+	unsigned long long calls;
+	unsigned long long nanoseconds;
+	unsigned long long pixels;
+	unsigned long long bytesAllocated;
+};
+
+class MSA_API msaProfile
+{
+public:
+	// true if the library was built with MSA_PROFILE
+	static bool Enabled();
+
+	// clear all counters
+	static void Reset();
+
+	// snapshot of all counters, sorted by name
+	static std::vector<msaProfileCounter> GetCounters();
+	// a single counter, returns false if that operation hasn't been recorded
+	static bool GetCounter(const std::string &name, msaProfileCounter &counter);
+
+	// all counters as a JSON array of objects
+	static std::string ToJSON();
+	static void DumpJSON(FILE *fp);
+
+	// counter names are the operation, an optional variant, and the depth, with f marking float
+	static std::string Name(const char *operation, const char *variant, int depth, bool isFloat = false);
+	static std::string Name(const char *operation, int depth, bool isFloat = false);
+};
+
+#ifdef MSA_PROFILE
+// times the enclosing scope and adds it to the named counter when it ends
+class MSA_API msaProfileScope
+{
+public:
+	msaProfileScope(const std::string &name, long long pixels);
+	~msaProfileScope();
+
+	// charge an allocation to the innermost scope on this thread
+	static void Allocated(long long bytes);
+
+protected:
+	std::string name;
+	long long pixels;
+	long long bytes;
+	long long start;
+	msaProfileScope *outer;
+};
+
+#define MSA_PROFILE_SCOPE(name, pixels) msaProfileScope msaProfileScope_(name, pixels)
+#define MSA_PROFILE_ALLOC(bytes) msaProfileScope::Allocated(bytes)
+#else
+#define MSA_PROFILE_SCOPE(name, pixels)
+#define MSA_PROFILE_ALLOC(bytes)
+#endif
+
+#endif
@@ -0,0 +1,486 @@
+#include <memory.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include "msaPyramid.h"
+#include "msaProfile.h"
+
+using namespace std;
+
+msaPyramid::msaPyramid()
+{
+	m_type = PyramidType::Gaussian;
+	m_sourceDepth = 0;
+	m_sourceFloat = false;
+	m_depth = 0;
+	m_isFloat = false;
+}
+
+// round and clamp to an integer sample, float samples are stored as they are
+template <typename T>
+static inline T ToSample(float v)
+{
+	if(is_floating_point<T>::value)
+		return (T)v;
+	if(v <= 0.0f)
+		return 0;
+	if(v >= numeric_limits<T>::max())
+		return numeric_limits<T>::max();
+	return (T)(v + 0.5f);
+}
+
+// bytes per line of a level, rounded up to 4 bytes like msaImage's own lines
+static int LevelBytes(int w, int channels, int sampleSize)
+{
+	return (w * channels * sampleSize + 3) / 4 * 4;
+}
+
+// the image to work from: planar ones are converted into copy, bitonal ones can't be used
+static msaImage &Interleaved(msaImage &image, msaImage &copy)
+{
+	if(image.Depth() == 1)
+		throw "Invalid image depth";
+	if(!image.Planar() || image.Channels() == 1)
+		return image;
+	image.ToInterleaved(copy);
+	return copy;
+}
+
+// run op.Run<T, C>() for the sample type and channels of an image of the given depth
+template <typename Op>
+static void Dispatch(int depth, bool isFloat, Op &op)
+{
+	int bits = isFloat ? 32 : (depth == 16 || depth == 48 || depth == 64 ? 16 : 8);
+	int channels = depth / bits;
+	if(channels != 1 && channels != 3 && channels != 4)
+		throw "Invalid image depth";
+
+	if(isFloat)
+	{
+		if(channels == 1) op.template Run<float, 1>();
+		else if(channels == 3) op.template Run<float, 3>();
+		else op.template Run<float, 4>();
+	}
+	else if(bits == 16)
+	{
+		if(channels == 1) op.template Run<unsigned short, 1>();
+		else if(channels == 3) op.template Run<unsigned short, 3>();
+		else op.template Run<unsigned short, 4>();
+	}
+	else
+	{
+		if(channels == 1) op.template Run<unsigned char, 1>();
+		else if(channels == 3) op.template Run<unsigned char, 3>();
+		else op.template Run<unsigned char, 4>();
+	}
+}
+
+// the 1 4 6 4 1 sums both ways total 256
+static inline int ReduceSum(int sum)
+{
+	return (sum + 128) >> 8;
+}
+
+static inline float ReduceSum(float sum)
+{
+	return sum / 256;
+}
+
+/*
+	Blur and decimate in one pass.  For each line kept, the five lines around its source line are
+	summed down the columns by 1 4 6 4 1, the sums padded by the edge pixels, and only every
+	second column of that is summed across.  Integer samples sum exactly in an int and are
+	rounded once at the end, dividing by 256.
+*/
+template <typename T, int C>
+static void ReduceN(const unsigned char *input, int w, int h, int inBpl, unsigned char *output, int outBpl)
+{
+	typedef typename conditional<is_floating_point<T>::value, float, int>::type S;
+	int cw = (w + 1) / 2;
+	int ch = (h + 1) / 2;
+	int lineSamples = w * C;
+
+	vector<S> columns((w + 4) * C);
+	S *sums = &columns[2 * C];
+	for(int y = 0; y < ch; ++y)
+	{
+		const T *p[5];
+		for(int k = 0; k < 5; ++k)
+			p[k] = (const T *)&input[min(max(2 * y - 2 + k, 0), h - 1) * inBpl];
+		for(int i = 0; i < lineSamples; ++i)
+			sums[i] = p[0][i] + p[4][i] + 4 * (p[1][i] + p[3][i]) + 6 * (S)p[2][i];
+		for(int c = 0; c < C; ++c)
+		{
+			sums[c - 2 * C] = sums[c - C] = sums[c];
+			sums[lineSamples + C + c] = sums[lineSamples + c] = sums[lineSamples - C + c];
+		}
+
+		T *pout = (T *)&output[y * outBpl];
+		for(int x = 0; x < cw; ++x)
+		{
+			const S *s = &sums[2 * x * C];
+			for(int c = 0; c < C; ++c)
+			{
+				S sum = s[c - 2 * C] + s[c + 2 * C] + 4 * (s[c - C] + s[c + C]) + 6 * s[c];
+				pout[x * C + c] = (T)ReduceSum(sum);
+			}
+		}
+	}
+}
+
+/*
+	Expand from cw by ch up to w by h.  A pixel that lands on a coarse pixel is 1 6 1 of it and
+	its neighbors, over 8, and one that falls between two is their mean; this is the 1 4 6 4 1
+	kernel over the coarse pixels spread out with zeros between them.  Coarse lines are expanded
+	across into a ring of three as they're needed, and each output line is made from two or three
+	of those and handed to finish(y, line) in float.
+*/
+template <typename T, int C, typename Finish>
+static void ExpandPasses(const unsigned char *input, int cw, int ch, int inBpl, int w, int h, Finish finish)
+{
+	int lineSamples = w * C;
+	vector<float> rows(3 * lineSamples);
+	int held[3] = { -1, -1, -1 };
+	vector<float> line(lineSamples);
+
+	auto Row = [&](int y) -> const float *
+	{
+		y = min(max(y, 0), ch - 1);
+		float *row = &rows[(y % 3) * lineSamples];
+		if(held[y % 3] == y)
+			return row;
+
+		const T *pin = (const T *)&input[y * inBpl];
+		for(int x = 0; x < w; ++x)
+		{
+			int i = x >> 1;
+			const T *left = &pin[max(i - 1, 0) * C];
+			const T *center = &pin[i * C];
+			const T *right = &pin[min(i + 1, cw - 1) * C];
+			for(int c = 0; c < C; ++c)
+			{
+				if(x & 1)
+					row[x * C + c] = ((float)center[c] + right[c]) * 0.5f;
+				else
+					row[x * C + c] = ((float)left[c] + 6.0f * center[c] + right[c]) * 0.125f;
+			}
+		}
+		held[y % 3] = y;
+		return row;
+	};
+
+	for(int y = 0; y < h; ++y)
+	{
+		int i = y >> 1;
+		if(y & 1)
+		{
+			const float *center = Row(i);
+			const float *below = Row(i + 1);
+			for(int s = 0; s < lineSamples; ++s)
+				line[s] = (center[s] + below[s]) * 0.5f;
+		}
+		else
+		{
+			const float *above = Row(i - 1);
+			const float *center = Row(i);
+			const float *below = Row(i + 1);
+			for(int s = 0; s < lineSamples; ++s)
+				line[s] = (above[s] + 6.0f * center[s] + below[s]) * 0.125f;
+		}
+		finish(y, &line[0]);
+	}
+}
+
+struct ReduceOp
+{
+	msaImage &input;
+	unsigned char *output;
+	int outBpl;
+
+	template <typename T, int C>
+	void Run()
+	{
+		ReduceN<T, C>(input.Data(), input.Width(), input.Height(), input.BytesPerLine(), output, outBpl);
+	}
+};
+
+void msaPyramid::Reduce(msaImage &input, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("PyramidReduce", input.Depth(), input.IsFloat()),
+			(long long)input.Width() * input.Height());
+
+	msaImage copy;
+	msaImage &image = Interleaved(input, copy);
+	int cw = (image.Width() + 1) / 2;
+	int ch = (image.Height() + 1) / 2;
+	int bpl = LevelBytes(cw, image.Channels(), image.BitsPerSample() / 8);
+
+	// the output is only handed over at the end, so it can be the input
+	ReduceOp op = { image, new unsigned char[ch * bpl], bpl };
+	Dispatch(image.Depth(), image.IsFloat(), op);
+	output.TakeExternalData(cw, ch, bpl, image.Depth(), op.output, false, image.IsFloat());
+}
+
+struct ExpandOp
+{
+	msaImage &input;
+	int w;
+	int h;
+	unsigned char *output;
+	int outBpl;
+
+	template <typename T, int C>
+	void Run()
+	{
+		unsigned char *out = output;
+		int bpl = outBpl;
+		int lineSamples = w * C;
+		ExpandPasses<T, C>(input.Data(), input.Width(), input.Height(), input.BytesPerLine(), w, h,
+				[&](int y, const float *line)
+		{
+			T *pout = (T *)&out[y * bpl];
+			for(int s = 0; s < lineSamples; ++s)
+				pout[s] = ToSample<T>(line[s]);
+		});
+	}
+};
+
+void msaPyramid::Expand(msaImage &input, int w, int h, msaImage &output)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("PyramidExpand", input.Depth(), input.IsFloat()), (long long)w * h);
+
+	if(w < 1 || h < 1 || (w + 1) / 2 != input.Width() || (h + 1) / 2 != input.Height())
+		throw "Expanded size must halve to the size of the image";
+
+	msaImage copy;
+	msaImage &image = Interleaved(input, copy);
+	int bpl = LevelBytes(w, image.Channels(), image.BitsPerSample() / 8);
+
+	ExpandOp op = { image, w, h, new unsigned char[h * bpl], bpl };
+	Dispatch(image.Depth(), image.IsFloat(), op);
+	output.TakeExternalData(w, h, bpl, image.Depth(), op.output, false, image.IsFloat());
+}
+
+/*
+	Gaussian levels are reduced straight from one level to the next in the buffer.  A Laplacian
+	pyramid needs the Gaussian levels only two at a time, in their own sample type so the
+	differences are from what the Gaussian pyramid would hold: each is reduced, expanded back up
+	and taken from the level above it, and the smaller then becomes the larger.
+*/
+struct BuildOp
+{
+	msaPyramid::PyramidType type;
+	msaImage &image;
+	vector<unsigned char> &data;
+	const vector<size_t> &offsets;
+	const vector<int> &widths;
+	const vector<int> &heights;
+	const vector<int> &bpls;
+
+	template <typename T, int C>
+	void Run()
+	{
+		int levels = (int)widths.size();
+		int w = image.Width();
+		int h = image.Height();
+
+		if(type == msaPyramid::PyramidType::Gaussian)
+		{
+			for(int y = 0; y < h; ++y)
+				memcpy(&data[offsets[0] + y * bpls[0]], &image.Data()[y * image.BytesPerLine()], w * C * sizeof(T));
+			for(int level = 1; level < levels; ++level)
+				ReduceN<T, C>(&data[offsets[level - 1]], widths[level - 1], heights[level - 1], bpls[level - 1],
+						&data[offsets[level]], bpls[level]);
+			return;
+		}
+
+		vector<unsigned char> larger;
+		vector<unsigned char> smaller;
+		const unsigned char *current = image.Data();
+		int currentBpl = image.BytesPerLine();
+		for(int level = 0; level < levels; ++level)
+		{
+			float *out = (float *)&data[offsets[level]];
+			int outSamples = bpls[level] / sizeof(float);
+			int lineSamples = widths[level] * C;
+
+			if(level == levels - 1)
+			{
+				for(int y = 0; y < heights[level]; ++y)
+				{
+					const T *pin = (const T *)&current[y * currentBpl];
+					for(int s = 0; s < lineSamples; ++s)
+						out[y * outSamples + s] = pin[s];
+				}
+				break;
+			}
+
+			int cw = widths[level + 1];
+			int ch = heights[level + 1];
+			int smallerBpl = LevelBytes(cw, C, sizeof(T));
+			smaller.resize(ch * smallerBpl);
+			ReduceN<T, C>(current, widths[level], heights[level], currentBpl, &smaller[0], smallerBpl);
+			ExpandPasses<T, C>(&smaller[0], cw, ch, smallerBpl, widths[level], heights[level],
+					[&](int y, const float *line)
+			{
+				const T *pin = (const T *)&current[y * currentBpl];
+				for(int s = 0; s < lineSamples; ++s)
+					out[y * outSamples + s] = pin[s] - line[s];
+			});
+
+			larger.swap(smaller);
+			current = &larger[0];
+			currentBpl = smallerBpl;
+		}
+	}
+};
+
+void msaPyramid::Build(msaImage &input, PyramidType type, int levels)
+{
+	MSA_PROFILE_SCOPE(msaProfile::Name("Pyramid", input.Depth(), input.IsFloat()),
+			(long long)input.Width() * input.Height());
+
+	if(levels < 0)
+		throw "Number of pyramid levels must not be negative";
+
+	msaImage copy;
+	msaImage &image = Interleaved(input, copy);
+	int channels = image.Channels();
+	int sampleSize = type == PyramidType::Laplacian ? sizeof(float) : image.BitsPerSample() / 8;
+
+	m_type = type;
+	m_sourceDepth = image.Depth();
+	m_sourceFloat = image.IsFloat();
+	m_depth = type == PyramidType::Laplacian ? channels * 32 : image.Depth();
+	m_isFloat = type == PyramidType::Laplacian || image.IsFloat();
+
+	m_widths.clear();
+	m_heights.clear();
+	m_bpls.clear();
+	m_offsets.clear();
+	size_t total = 0;
+	int w = image.Width();
+	int h = image.Height();
+	while(true)
+	{
+		m_widths.push_back(w);
+		m_heights.push_back(h);
+		m_bpls.push_back(LevelBytes(w, channels, sampleSize));
+		m_offsets.push_back(total);
+		total += (size_t)h * m_bpls.back();
+
+		if((levels > 0 && (int)m_widths.size() == levels) || (w == 1 && h == 1))
+			break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	m_data.resize(total);
+	MSA_PROFILE_ALLOC((long long)total);
+
+	BuildOp op = { type, image, m_data, m_offsets, m_widths, m_heights, m_bpls };
+	Dispatch(image.Depth(), image.IsFloat(), op);
+}
+
+static void CheckLevel(int level, int levels)
+{
+	if(level < 0 || level >= levels)
+		throw "Invalid pyramid level";
+}
+
+int msaPyramid::Width(int level)
+{
+	CheckLevel(level, Levels());
+	return m_widths[level];
+}
+
+int msaPyramid::Height(int level)
+{
+	CheckLevel(level, Levels());
+	return m_heights[level];
+}
+
+void msaPyramid::Level(int level, msaImage &image)
+{
+	CheckLevel(level, Levels());
+	image.UseExternalData(m_widths[level], m_heights[level], m_bpls[level], m_depth, &m_data[m_offsets[level]],
+			false, m_isFloat);
+}
+
+/*
+	Collapsing runs from the smallest level up, in float: each sum so far is expanded to the next
+	level's size and that level added in.  Only the last sum is rounded and clamped, so the levels
+	can be changed freely in between, and an untouched pyramid of integer samples gives its image
+	back exactly.
+*/
+struct ReconstructOp
+{
+	const vector<unsigned char> &data;
+	const vector<size_t> &offsets;
+	const vector<int> &widths;
+	const vector<int> &heights;
+	const vector<int> &bpls;
+	unsigned char *output;
+	int outBpl;
+
+	template <typename T, int C>
+	void Run()
+	{
+		int levels = (int)widths.size();
+		int top = levels - 1;
+		int sumSamples = widths[top] * C;
+		vector<float> sum(heights[top] * sumSamples);
+		for(int y = 0; y < heights[top]; ++y)
+			memcpy(&sum[y * sumSamples], &data[offsets[top] + y * bpls[top]], sumSamples * sizeof(float));
+
+		vector<float> next;
+		for(int level = top - 1; level >= 0; --level)
+		{
+			int lineSamples = widths[level] * C;
+			int inSamples = bpls[level] / sizeof(float);
+			const float *in = (const float *)&data[offsets[level]];
+			next.resize(heights[level] * lineSamples);
+			ExpandPasses<float, C>((const unsigned char *)&sum[0], widths[level + 1], heights[level + 1],
+					sumSamples * sizeof(float), widths[level], heights[level], [&](int y, const float *line)
+			{
+				for(int s = 0; s < lineSamples; ++s)
+					next[y * lineSamples + s] = in[y * inSamples + s] + line[s];
+			});
+			sum.swap(next);
+			sumSamples = lineSamples;
+		}
+
+		for(int y = 0; y < heights[0]; ++y)
+		{
+			T *pout = (T *)&output[y * outBpl];
+			for(int s = 0; s < sumSamples; ++s)
+				pout[s] = ToSample<T>(sum[y * sumSamples + s]);
+		}
+	}
+};
+
+void msaPyramid::Reconstruct(msaImage &output)
+{
+	if(m_widths.empty())
+		throw "Pyramid has not been built";
+
+	MSA_PROFILE_SCOPE(msaProfile::Name("PyramidReconstruct", m_sourceDepth, m_sourceFloat),
+			(long long)m_widths[0] * m_heights[0]);
+
+	int w = m_widths[0];
+	int h = m_heights[0];
+	if(m_type == PyramidType::Gaussian)
+	{
+		unsigned char *data = new unsigned char[h * m_bpls[0]];
+		memcpy(data, &m_data[0], h * m_bpls[0]);
+		output.TakeExternalData(w, h, m_bpls[0], m_depth, data, false, m_isFloat);
+		return;
+	}
+
+	// the levels are float, the output is in the source's sample type
+	int bpl = LevelBytes(w, m_depth / 32, m_sourceFloat ? 4 : (m_sourceDepth / (m_depth / 32)) / 8);
+
+	ReconstructOp op = { m_data, m_offsets, m_widths, m_heights, m_bpls, new unsigned char[h * bpl], bpl };
+	Dispatch(m_sourceDepth, m_sourceFloat, op);
+	output.TakeExternalData(w, h, bpl, m_sourceDepth, op.output, false, m_sourceFloat);
+}
@@ -0,0 +1,71 @@
+#ifndef _msaPyramid_included
+#define _msaPyramid_included
+#include <vector>
+#include "msaImage.h"
+
+/*
+	Gaussian and Laplacian pyramids.  Each level is half the size of the one before, rounded up,
+	made by blurring with 1 4 6 4 1 both ways and keeping every second pixel and line; the two are
+	one pass that only works out the pixels kept, so building a whole Gaussian pyramid costs about
+	a third of the base image more than the base image itself.  All the levels are kept in one
+	buffer, level 0 first, and stay there until the next build.
+
+	A Gaussian pyramid's levels have the sample type of the image it was built from.  A Laplacian
+	pyramid's levels are float, each the difference between that Gaussian level and the next one
+	expanded back up, with the last level the smallest Gaussian level itself; adding them back up
+	gives the image again.  Every channel, alpha included, is treated alike, and pixels past the
+	edges repeat the edge pixels.
+
+	Planar images are converted to interleaved first, and everything that comes out is
+	interleaved.
+*/
+
+class MSA_API msaPyramid
+{
+public:
+	enum class PyramidType
+	{
+		Gaussian = 0,
+		Laplacian
+	};
+
+	msaPyramid();
+
+	// build a pyramid of the given number of levels, level 0 being the image itself; 0 levels, or
+	//  more than fit, goes down to 1 by 1
+	void Build(msaImage &image, PyramidType type, int levels = 0);
+
+	PyramidType Type() { return m_type; };
+	int Levels() { return (int)m_widths.size(); };
+	int Width(int level);
+	int Height(int level);
+	// point image at a level, which stays in the pyramid; the samples can be changed in place,
+	//  to blend pyramids before reconstructing, but the image is only valid until the next build
+	void Level(int level, msaImage &image);
+
+	// add a Laplacian pyramid back up into an image of the depth it was built from, rounding and
+	//  clamping just once at the end; a Gaussian pyramid gives a copy of level 0
+	void Reconstruct(msaImage &output);
+
+	// a single step down, blurring and dropping every second pixel and line in one pass
+	static void Reduce(msaImage &input, msaImage &output);
+	// a single step up to w by h, which must halve to the input's size, by the 1 4 6 4 1 kernel
+	//  spread over the pixels between
+	static void Expand(msaImage &input, int w, int h, msaImage &output);
+
+protected:
+	PyramidType m_type;
+	// the depth and float flag of the image built from, and of the levels
+	int m_sourceDepth;
+	bool m_sourceFloat;
+	int m_depth;
+	bool m_isFloat;
+
+	std::vector<unsigned char> m_data;
+	std::vector<size_t> m_offsets;
+	std::vector<int> m_widths;
+	std::vector<int> m_heights;
+	std::vector<int> m_bpls;
+};
+
+#endif
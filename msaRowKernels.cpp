@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "msaRowKernels.h"
+#include "msaRowKernelsISA.h"
+#include "msaDispatch.h"
+#include "msaSortNetworks.h"
+
+// each function runs the bound SIMD kernel, if there is one, and then finishes off whatever it
+//  didn't cover; the plain loops here are the reference the SIMD kernels have to match exactly
+
+void DeinterleaveRGB(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.DeinterleaveRGB != NULL ? k.DeinterleaveRGB(rgb, r, g, b, count) : 0;
+	for(rgb += x * 3; x < count; ++x)
+	{
+		r[x] = *rgb++;
+		g[x] = *rgb++;
+		b[x] = *rgb++;
+	}
+}
+
+void DeinterleaveRGBA(const unsigned char *rgba, unsigned char *r, unsigned char *g, unsigned char *b,
+		unsigned char *a, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.DeinterleaveRGBA != NULL ? k.DeinterleaveRGBA(rgba, r, g, b, a, count) : 0;
+	for(rgba += x * 4; x < count; ++x)
+	{
+		r[x] = *rgba++;
+		g[x] = *rgba++;
+		b[x] = *rgba++;
+		a[x] = *rgba++;
+	}
+}
+
+void InterleaveRGB(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.InterleaveRGB != NULL ? k.InterleaveRGB(r, g, b, rgb, count) : 0;
+	for(rgb += x * 3; x < count; ++x)
+	{
+		*rgb++ = r[x];
+		*rgb++ = g[x];
+		*rgb++ = b[x];
+	}
+}
+
+void InterleaveRGBA(const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a,
+		unsigned char *rgba, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.InterleaveRGBA != NULL ? k.InterleaveRGBA(r, g, b, a, rgba, count) : 0;
+	for(rgba += x * 4; x < count; ++x)
+	{
+		*rgba++ = r[x];
+		*rgba++ = g[x];
+		*rgba++ = b[x];
+		*rgba++ = a[x];
+	}
+}
+
+// run the bound kernel for a two input float row function, leaving x where the scalar loop picks up
+#define FLOAT_ROW_KERNEL(name) \
+	const msaRowKernelTable &k = msaDispatch::Kernels(); \
+	int x = k.name != NULL ? k.name(a, b, out, count) : 0;
+
+void AddRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(AddRowsFloat)
+	for(; x < count; ++x)
+		out[x] = a[x] + b[x];
+}
+
+void SubtractRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(SubtractRowsFloat)
+	for(; x < count; ++x)
+		out[x] = a[x] - b[x];
+}
+
+void MultiplyRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(MultiplyRowsFloat)
+	for(; x < count; ++x)
+		out[x] = a[x] * b[x];
+}
+
+void DivideRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(DivideRowsFloat)
+	for(; x < count; ++x)
+		out[x] = b[x] == 0.0f ? 0.0f : a[x] / b[x];
+}
+
+// the scalar versions are written the same way minps and maxps work, so results match exactly
+void MinRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(MinRowsFloat)
+	for(; x < count; ++x)
+		out[x] = a[x] < b[x] ? a[x] : b[x];
+}
+
+void MaxRowsFloat(const float *a, const float *b, float *out, int count)
+{
+	FLOAT_ROW_KERNEL(MaxRowsFloat)
+	for(; x < count; ++x)
+		out[x] = a[x] > b[x] ? a[x] : b[x];
+}
+
+#undef FLOAT_ROW_KERNEL
+
+void MultiplyAddRowFloat(const float *in, float weight, float *acc, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.MultiplyAddRowFloat != NULL ? k.MultiplyAddRowFloat(in, weight, acc, count) : 0;
+	for(; x < count; ++x)
+		acc[x] += in[x] * weight;
+}
+
+void BytesToFloat(const unsigned char *in, float *out, float scale, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.BytesToFloat != NULL ? k.BytesToFloat(in, out, scale, count) : 0;
+	for(; x < count; ++x)
+		out[x] = in[x] * scale;
+}
+
+// min and max are written so that NaN ends up at maxVal, as it does with SSE
+static inline float ClampRound(float v, float maxVal)
+{
+	v = v < maxVal ? v : maxVal;
+	v = v > 0.0f ? v : 0.0f;
+	return v + 0.5f;
+}
+
+void FloatToBytes(const float *in, unsigned char *out, float scale, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.FloatToBytes != NULL ? k.FloatToBytes(in, out, scale, count) : 0;
+	for(; x < count; ++x)
+		out[x] = (unsigned char)ClampRound(in[x] * scale, 255.0f);
+}
+
+void ShortsToFloat(const unsigned short *in, float *out, float scale, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.ShortsToFloat != NULL ? k.ShortsToFloat(in, out, scale, count) : 0;
+	for(; x < count; ++x)
+		out[x] = in[x] * scale;
+}
+
+void FloatToShorts(const float *in, unsigned short *out, float scale, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.FloatToShorts != NULL ? k.FloatToShorts(in, out, scale, count) : 0;
+	for(; x < count; ++x)
+		out[x] = (unsigned short)ClampRound(in[x] * scale, 65535.0f);
+}
+
+void ThresholdRow(const unsigned char *in, unsigned char *bits, unsigned char threshold, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.ThresholdRow != NULL ? k.ThresholdRow(in, bits, threshold, count) : 0;
+	// x is a multiple of 8 here, so finish a byte at a time
+	for(; x < count; x += 8)
+	{
+		unsigned char b = 0;
+		for(int i = 0; i < 8 && x + i < count; ++i)
+			if(in[x + i] >= threshold)
+				b |= 0x80 >> i;
+		bits[x / 8] = b;
+	}
+}
+
+void ExpandBitsRow(const unsigned char *bits, unsigned char *out, unsigned char zero, unsigned char one, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.ExpandBitsRow != NULL ? k.ExpandBitsRow(bits, out, zero, one, count) : 0;
+	for(; x < count; ++x)
+		out[x] = (bits[x / 8] & (0x80 >> (x % 8))) ? one : zero;
+}
+
+void MinRowsBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.MinRowsBytes != NULL ? k.MinRowsBytes(a, b, out, count) : 0;
+	for(; x < count; ++x)
+		out[x] = a[x] < b[x] ? a[x] : b[x];
+}
+
+void MaxRowsBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.MaxRowsBytes != NULL ? k.MaxRowsBytes(a, b, out, count) : 0;
+	for(; x < count; ++x)
+		out[x] = a[x] > b[x] ? a[x] : b[x];
+}
+
+bool ConvolutionFitsInt(const int *kernel, int taps, int divisor)
+{
+	long long bound = divisor / 2;
+	if(bound < 0)
+		bound = -bound;
+	for(int i = 0; i < taps; ++i)
+		bound += 255LL * (kernel[i] < 0 ? -(long long)kernel[i] : kernel[i]);
+	return bound <= INT_MAX;
+}
+
+int DivisorShift(int divisor)
+{
+	if(divisor <= 0 || (divisor & (divisor - 1)) != 0)
+		return -1;
+	int shift = 0;
+	while((1 << shift) < divisor)
+		++shift;
+	return shift;
+}
+
+bool ConvolutionFitsShort(const int *kernel, int taps, int divisor)
+{
+	if(DivisorShift(divisor) < 0)
+		return false;
+
+	// the sum ends up between 255 times the negative taps and 255 times the positive ones, plus
+	//  the rounding; wrapping on the way there doesn't matter, the low 16 bits are still right
+	long long positive = divisor / 2;
+	long long negative = 0;
+	for(int i = 0; i < taps; ++i)
+	{
+		if(kernel[i] > 0)
+			positive += 255LL * kernel[i];
+		else
+			negative -= 255LL * kernel[i];
+	}
+
+	// without negative taps the sums are unsigned, and once shifted they fit the signed pack
+	if(negative == 0 && divisor > 1)
+		return positive <= 65535;
+	return positive <= 32767 && negative <= 32768;
+}
+
+// the plain loop from sample x on; KW and KH fix the kernel size so the taps unroll completely,
+//  with the kernel copied where stores to out can't alias it, or are 0 for any size
+template <int KW, int KH>
+static void ConvolveRowBytesN(const unsigned char *const *lines, const int *values, int kw, int kh, int step,
+		int divisor, unsigned char *out, int x, int count)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	int taps[KW * KH > 0 ? KW * KH : 1];
+	const int *kernel = values;
+	if(KW * KH > 0)
+	{
+		for(int i = 0; i < KW * KH; ++i)
+			taps[i] = values[i];
+		kernel = taps;
+	}
+
+	// a power of two divisor is a shift, which rounds down rather than toward zero, but the
+	//  results only differ below zero, where both clamp to 0
+	int shift = DivisorShift(divisor);
+
+	for(; x < count; ++x)
+	{
+		long sum = divisor / 2;	// for rounding purposes
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			const unsigned char *pin = lines[filtY] + x;
+			for(int filtX = 0; filtX < width; ++filtX)
+			{
+				sum += *pin * kernel[filtVal++];
+				pin += step;
+			}
+		}
+
+		if(shift >= 0)
+			sum >>= shift;
+		else
+			sum /= divisor;
+
+		if(sum > 255) sum = 255;
+		if(sum < 0) sum = 0;
+
+		out[x] = sum;
+	}
+}
+
+void ConvolveRowBytes(const unsigned char *const *lines, const int *kernel, int kw, int kh, int step, int divisor,
+		unsigned char *out, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.ConvolveRowBytes != NULL ? k.ConvolveRowBytes(lines, kernel, kw, kh, step, divisor, out, count) : 0;
+	if(x == count)
+		return;
+
+	if(kw == 3 && kh == 3)
+		ConvolveRowBytesN<3, 3>(lines, kernel, kw, kh, step, divisor, out, x, count);
+	else if(kw == 5 && kh == 5)
+		ConvolveRowBytesN<5, 5>(lines, kernel, kw, kh, step, divisor, out, x, count);
+	else if(kw == 7 && kh == 7)
+		ConvolveRowBytesN<7, 7>(lines, kernel, kw, kh, step, divisor, out, x, count);
+	else
+		ConvolveRowBytesN<0, 0>(lines, kernel, kw, kh, step, divisor, out, x, count);
+}
+
+void MedianRowBytes(const unsigned char *const *lines, int size, int step, unsigned char *out, int count)
+{
+	const msaRowKernelTable &k = msaDispatch::Kernels();
+	int x = k.MedianRowBytes != NULL ? k.MedianRowBytes(lines, size, step, out, count) : 0;
+
+	int p[25];
+	for(; x < count; ++x)
+	{
+		for(int filtY = 0; filtY < size; ++filtY)
+			for(int filtX = 0; filtX < size; ++filtX)
+				p[filtY * size + filtX] = lines[filtY][x + filtX * step];
+
+		out[x] = size == 3 ? Median9<int, ScalarMinMax<int> >(p) : Median25<int, ScalarMinMax<int> >(p);
+	}
+}
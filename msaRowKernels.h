@@ -0,0 +1,58 @@
+#ifndef _msaRowKernels_included
+#define _msaRowKernels_included
+
+/*
+	Row level pixel kernels shared by msaImage; each works on a single line of count pixels, so
+	callers can point them at image lines or their own buffers.  SIMD versions are picked at run
+	time by msaDispatch, with plain C++ loops covering the rest.
+*/
+
+// split interleaved RGB or RGBA pixels into separate channel lines in a single pass
+void DeinterleaveRGB(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, int count);
+void DeinterleaveRGBA(const unsigned char *rgba, unsigned char *r, unsigned char *g, unsigned char *b,
+		unsigned char *a, int count);
+
+// merge separate channel lines into interleaved RGB or RGBA pixels in a single pass
+void InterleaveRGB(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, int count);
+void InterleaveRGBA(const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a,
+		unsigned char *rgba, int count);
+
+// sample by sample float arithmetic on count samples, so any channel count can use them;
+//  divide gives 0 where the divisor is 0
+void AddRowsFloat(const float *a, const float *b, float *out, int count);
+void SubtractRowsFloat(const float *a, const float *b, float *out, int count);
+void MultiplyRowsFloat(const float *a, const float *b, float *out, int count);
+void DivideRowsFloat(const float *a, const float *b, float *out, int count);
+void MinRowsFloat(const float *a, const float *b, float *out, int count);
+void MaxRowsFloat(const float *a, const float *b, float *out, int count);
+
+// acc += in * weight, the inner step of float convolution
+void MultiplyAddRowFloat(const float *in, float weight, float *acc, int count);
+
+// convert count samples to and from float, multiplying by scale; conversion back rounds and clamps
+void BytesToFloat(const unsigned char *in, float *out, float scale, int count);
+void FloatToBytes(const float *in, unsigned char *out, float scale, int count);
+void ShortsToFloat(const unsigned short *in, float *out, float scale, int count);
+void FloatToShorts(const float *in, unsigned short *out, float scale, int count);
+
+// pack count gray pixels into bitonal bits, most significant bit first, setting the bit where the
+//  value is at least threshold; the unused bits of the last byte are cleared
+void ThresholdRow(const unsigned char *in, unsigned char *bits, unsigned char threshold, int count);
+// expand count bitonal pixels to gray, set bits become one and clear bits zero
+void ExpandBitsRow(const unsigned char *bits, unsigned char *out, unsigned char zero, unsigned char one, int count);
+
+// sample by sample min and max of two lines of bytes
+void MinRowsBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, int count);
+void MaxRowsBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, int count);
+
+// one output line of an integer convolution: lines holds the kh input lines under the kernel,
+//  each pointing at the top left tap of the first output sample, and taps are step bytes apart
+//  so interleaved channels convolve separately; out[i] is the sum of the taps plus divisor / 2,
+//  divided by divisor and clamped to 0 - 255, the same as the 8 bit filters
+void ConvolveRowBytes(const unsigned char *const *lines, const int *kernel, int kw, int kh, int step, int divisor,
+		unsigned char *out, int count);
+// one output line of a size by size median, size 3 or 5, with lines and step as for
+//  ConvolveRowBytes(); each sample is the middle one of its window, by a sorting network
+void MedianRowBytes(const unsigned char *const *lines, int size, int step, unsigned char *out, int count);
+
+#endif
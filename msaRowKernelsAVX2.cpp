@@ -0,0 +1,381 @@
+#include "msaRowKernelsISA.h"
+
+/*
+	AVX2 row kernels, twice the width of the SSE2 ones; the kernels not replaced here stay bound
+	to their SSE2 and SSSE3 versions.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#pragma GCC target("avx2")
+#include <immintrin.h>
+// after the target pragma, so the networks are built for this instruction set
+#include "msaSortNetworks.h"
+
+// a two input float row kernel doing 8 samples at a time of a and b, storing expr
+#define FLOAT_ROW_AVX2(name, expr) \
+	static int name##_AVX2(const float *a, const float *b, float *out, int count) \
+	{ \
+		int x = 0; \
+		for(; x + 8 <= count; x += 8) \
+		{ \
+			__m256 va = _mm256_loadu_ps(a + x); \
+			__m256 vb = _mm256_loadu_ps(b + x); \
+			_mm256_storeu_ps(out + x, expr); \
+		} \
+		return x; \
+	}
+
+FLOAT_ROW_AVX2(AddRowsFloat, _mm256_add_ps(va, vb))
+FLOAT_ROW_AVX2(SubtractRowsFloat, _mm256_sub_ps(va, vb))
+FLOAT_ROW_AVX2(MultiplyRowsFloat, _mm256_mul_ps(va, vb))
+// mask off the lanes that divided by zero
+FLOAT_ROW_AVX2(DivideRowsFloat, _mm256_and_ps(_mm256_div_ps(va, vb), _mm256_cmp_ps(vb, _mm256_setzero_ps(), _CMP_NEQ_UQ)))
+FLOAT_ROW_AVX2(MinRowsFloat, _mm256_min_ps(va, vb))
+FLOAT_ROW_AVX2(MaxRowsFloat, _mm256_max_ps(va, vb))
+
+#undef FLOAT_ROW_AVX2
+
+// a separate multiply and add, not fma, so the result matches the other levels
+static int MultiplyAddRowFloat_AVX2(const float *in, float weight, float *acc, int count)
+{
+	int x = 0;
+	__m256 vw = _mm256_set1_ps(weight);
+	for(; x + 8 <= count; x += 8)
+		_mm256_storeu_ps(acc + x, _mm256_add_ps(_mm256_loadu_ps(acc + x), _mm256_mul_ps(_mm256_loadu_ps(in + x), vw)));
+	return x;
+}
+
+static int BytesToFloat_AVX2(const unsigned char *in, float *out, float scale, int count)
+{
+	int x = 0;
+	__m256 vs = _mm256_set1_ps(scale);
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		_mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), vs));
+		_mm256_storeu_ps(out + x + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))), vs));
+	}
+	return x;
+}
+
+// scale, clamp to 0 - maxVal and round 8 floats, the same way the scalar loops do
+static inline __m256i ScaleClampRound(const float *in, __m256 vs, __m256 vmax)
+{
+	__m256 v = _mm256_mul_ps(_mm256_loadu_ps(in), vs);
+	v = _mm256_max_ps(_mm256_min_ps(v, vmax), _mm256_setzero_ps());
+	return _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+}
+
+static int FloatToBytes_AVX2(const float *in, unsigned char *out, float scale, int count)
+{
+	int x = 0;
+	__m256 vs = _mm256_set1_ps(scale);
+	__m256 vmax = _mm256_set1_ps(255.0f);
+	// the packs work within each 128 bit lane, so put the 4 byte groups back in order afterward
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	for(; x + 32 <= count; x += 32)
+	{
+		__m256i a = ScaleClampRound(in + x, vs, vmax);
+		__m256i b = ScaleClampRound(in + x + 8, vs, vmax);
+		__m256i c = ScaleClampRound(in + x + 16, vs, vmax);
+		__m256i d = ScaleClampRound(in + x + 24, vs, vmax);
+		__m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_permutevar8x32_epi32(packed, order));
+	}
+	return x;
+}
+
+static int ShortsToFloat_AVX2(const unsigned short *in, float *out, float scale, int count)
+{
+	int x = 0;
+	__m256 vs = _mm256_set1_ps(scale);
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(in + x));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(in + x + 8));
+		_mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(lo)), vs));
+		_mm256_storeu_ps(out + x + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(hi)), vs));
+	}
+	return x;
+}
+
+static int FloatToShorts_AVX2(const float *in, unsigned short *out, float scale, int count)
+{
+	int x = 0;
+	__m256 vs = _mm256_set1_ps(scale);
+	__m256 vmax = _mm256_set1_ps(65535.0f);
+	for(; x + 16 <= count; x += 16)
+	{
+		__m256i a = ScaleClampRound(in + x, vs, vmax);
+		__m256i b = ScaleClampRound(in + x + 8, vs, vmax);
+		// unsigned pack within lanes, then swap the middle 64 bit groups back into order
+		__m256i packed = _mm256_packus_epi32(a, b);
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return x;
+}
+
+// movemask puts the first pixel in the low bit, bitonal images want it in the high bit
+static inline unsigned char ReverseBits(unsigned char b)
+{
+	b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+	return b;
+}
+
+static int ThresholdRow_AVX2(const unsigned char *in, unsigned char *bits, unsigned char threshold, int count)
+{
+	int x = 0;
+	__m256i vt = _mm256_set1_epi8((char)threshold);
+	for(; x + 32 <= count; x += 32)
+	{
+		// v >= t exactly when max(v, t) == v
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + x));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, vt), v));
+		for(int i = 0; i < 4; ++i)
+			bits[x / 8 + i] = ReverseBits((mask >> (i * 8)) & 0xFF);
+	}
+	return x;
+}
+
+static int MinRowsBytes_AVX2(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 32 <= count; x += 32)
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_min_epu8(_mm256_loadu_si256((const __m256i *)(a + x)),
+				_mm256_loadu_si256((const __m256i *)(b + x))));
+	return x;
+}
+
+static int MaxRowsBytes_AVX2(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 32 <= count; x += 32)
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_max_epu8(_mm256_loadu_si256((const __m256i *)(a + x)),
+				_mm256_loadu_si256((const __m256i *)(b + x))));
+	return x;
+}
+
+// divide 8 sums by the divisor, truncating toward zero like integer division, see the SSE2 version
+static inline __m128i DivideSums(__m256i sums, __m256d vdiv, __m128i &hi)
+{
+	hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sums, 1)), vdiv));
+	return _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sums)), vdiv));
+}
+
+// 16 samples at a time with 32 bit products; KW and KH fix the kernel size so the taps unroll
+//  completely, with the kernel copied where stores to out can't alias it, or are 0 for any size
+template <int KW, int KH>
+static int ConvolveRowBytesN_AVX2(const unsigned char *const *lines, const int *values, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	int taps[KW * KH > 0 ? KW * KH : 1];
+	const int *kernel = values;
+	if(KW * KH > 0)
+	{
+		for(int i = 0; i < KW * KH; ++i)
+			taps[i] = values[i];
+		kernel = taps;
+	}
+
+	__m256i round = _mm256_set1_epi32(divisor / 2);
+	__m256d vdiv = _mm256_set1_pd(divisor);
+	int shift = DivisorShift(divisor);
+	__m128i vshift = _mm_cvtsi32_si128(shift);
+
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m256i sum0 = round;
+		__m256i sum1 = round;
+
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			const unsigned char *pin = lines[filtY] + x;
+			for(int filtX = 0; filtX < width; ++filtX, pin += step)
+			{
+				int k = kernel[filtVal++];
+				if(k == 0)
+					continue;
+
+				__m128i v = _mm_loadu_si128((const __m128i *)pin);
+				__m256i vk = _mm256_set1_epi32(k);
+				sum0 = _mm256_add_epi32(sum0, _mm256_mullo_epi32(_mm256_cvtepu8_epi32(v), vk));
+				sum1 = _mm256_add_epi32(sum1, _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)), vk));
+			}
+		}
+
+		// the saturating packs clamp to 0 - 255, so a shift rounding down below zero is no different
+		__m128i lo0, hi0, lo1, hi1;
+		if(shift >= 0)
+		{
+			sum0 = _mm256_sra_epi32(sum0, vshift);
+			sum1 = _mm256_sra_epi32(sum1, vshift);
+			lo0 = _mm256_castsi256_si128(sum0);
+			hi0 = _mm256_extracti128_si256(sum0, 1);
+			lo1 = _mm256_castsi256_si128(sum1);
+			hi1 = _mm256_extracti128_si256(sum1, 1);
+		}
+		else
+		{
+			lo0 = DivideSums(sum0, vdiv, hi0);
+			lo1 = DivideSums(sum1, vdiv, hi1);
+		}
+		__m128i q = _mm_packus_epi16(_mm_packs_epi32(lo0, hi0), _mm_packs_epi32(lo1, hi1));
+		_mm_storeu_si128((__m128i *)(out + x), q);
+	}
+	return x;
+}
+
+// 32 samples at a time with 16 bit sums, see the SSE2 version; unpacking and packing both work
+//  within each 128 bit half, so the samples come back out in order
+template <int KW, int KH>
+static int ConvolveRowShortsN_AVX2(const unsigned char *const *lines, const int *values, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	int taps[KW * KH > 0 ? KW * KH : 1];
+	const int *kernel = values;
+	if(KW * KH > 0)
+	{
+		for(int i = 0; i < KW * KH; ++i)
+			taps[i] = values[i];
+		kernel = taps;
+	}
+
+	bool negative = false;
+	for(int i = 0; i < width * height; ++i)
+		negative |= kernel[i] < 0;
+
+	__m256i zero = _mm256_setzero_si256();
+	__m256i round = _mm256_set1_epi16((short)(divisor / 2));
+	__m128i vshift = _mm_cvtsi32_si128(DivisorShift(divisor));
+
+	int x = 0;
+	for(; x + 32 <= count; x += 32)
+	{
+		__m256i sum0 = round;
+		__m256i sum1 = round;
+
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			const unsigned char *pin = lines[filtY] + x;
+			for(int filtX = 0; filtX < width; ++filtX, pin += step)
+			{
+				int k = kernel[filtVal++];
+				if(k == 0)
+					continue;
+
+				__m256i v = _mm256_loadu_si256((const __m256i *)pin);
+				__m256i vk = _mm256_set1_epi16((short)k);
+				sum0 = _mm256_add_epi16(sum0, _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), vk));
+				sum1 = _mm256_add_epi16(sum1, _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), vk));
+			}
+		}
+
+		if(negative)
+		{
+			sum0 = _mm256_sra_epi16(sum0, vshift);
+			sum1 = _mm256_sra_epi16(sum1, vshift);
+		}
+		else
+		{
+			sum0 = _mm256_srl_epi16(sum0, vshift);
+			sum1 = _mm256_srl_epi16(sum1, vshift);
+		}
+
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_packus_epi16(sum0, sum1));
+	}
+	return x;
+}
+
+static int ConvolveRowBytes_AVX2(const unsigned char *const *lines, const int *kernel, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	if(!ConvolutionFitsInt(kernel, kw * kh, divisor))
+		return 0;
+
+	// rows too short for 32 at a time still get 16 at a time with 32 bit sums
+	if(count >= 32 && ConvolutionFitsShort(kernel, kw * kh, divisor))
+	{
+		if(kw == 3 && kh == 3)
+			return ConvolveRowShortsN_AVX2<3, 3>(lines, kernel, kw, kh, step, divisor, out, count);
+		if(kw == 5 && kh == 5)
+			return ConvolveRowShortsN_AVX2<5, 5>(lines, kernel, kw, kh, step, divisor, out, count);
+		if(kw == 7 && kh == 7)
+			return ConvolveRowShortsN_AVX2<7, 7>(lines, kernel, kw, kh, step, divisor, out, count);
+		return ConvolveRowShortsN_AVX2<0, 0>(lines, kernel, kw, kh, step, divisor, out, count);
+	}
+
+	if(kw == 3 && kh == 3)
+		return ConvolveRowBytesN_AVX2<3, 3>(lines, kernel, kw, kh, step, divisor, out, count);
+	if(kw == 5 && kh == 5)
+		return ConvolveRowBytesN_AVX2<5, 5>(lines, kernel, kw, kh, step, divisor, out, count);
+	if(kw == 7 && kh == 7)
+		return ConvolveRowBytesN_AVX2<7, 7>(lines, kernel, kw, kh, step, divisor, out, count);
+	return ConvolveRowBytesN_AVX2<0, 0>(lines, kernel, kw, kh, step, divisor, out, count);
+}
+
+// unsigned byte min and max for the sorting networks, 32 windows at a time
+struct BytesMinMax_AVX2
+{
+	static __m256i Min(__m256i a, __m256i b) { return _mm256_min_epu8(a, b); }
+	static __m256i Max(__m256i a, __m256i b) { return _mm256_max_epu8(a, b); }
+};
+
+template <int S>
+static int MedianRowBytesN_AVX2(const unsigned char *const *lines, int step, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 32 <= count; x += 32)
+	{
+		__m256i p[25];
+		for(int filtY = 0; filtY < S; ++filtY)
+			for(int filtX = 0; filtX < S; ++filtX)
+				p[filtY * S + filtX] = _mm256_loadu_si256((const __m256i *)(lines[filtY] + x + filtX * step));
+
+		__m256i median = S == 3 ? Median9<__m256i, BytesMinMax_AVX2>(p) : Median25<__m256i, BytesMinMax_AVX2>(p);
+		_mm256_storeu_si256((__m256i *)(out + x), median);
+	}
+	return x;
+}
+
+static int MedianRowBytes_AVX2(const unsigned char *const *lines, int size, int step, unsigned char *out, int count)
+{
+	if(size == 3)
+		return MedianRowBytesN_AVX2<3>(lines, step, out, count);
+	if(size == 5)
+		return MedianRowBytesN_AVX2<5>(lines, step, out, count);
+	return 0;
+}
+
+void BindRowKernelsAVX2(msaRowKernelTable &table)
+{
+	table.AddRowsFloat = AddRowsFloat_AVX2;
+	table.SubtractRowsFloat = SubtractRowsFloat_AVX2;
+	table.MultiplyRowsFloat = MultiplyRowsFloat_AVX2;
+	table.DivideRowsFloat = DivideRowsFloat_AVX2;
+	table.MinRowsFloat = MinRowsFloat_AVX2;
+	table.MaxRowsFloat = MaxRowsFloat_AVX2;
+	table.MultiplyAddRowFloat = MultiplyAddRowFloat_AVX2;
+	table.BytesToFloat = BytesToFloat_AVX2;
+	table.FloatToBytes = FloatToBytes_AVX2;
+	table.ShortsToFloat = ShortsToFloat_AVX2;
+	table.FloatToShorts = FloatToShorts_AVX2;
+	table.ThresholdRow = ThresholdRow_AVX2;
+	table.MinRowsBytes = MinRowsBytes_AVX2;
+	table.MaxRowsBytes = MaxRowsBytes_AVX2;
+	table.ConvolveRowBytes = ConvolveRowBytes_AVX2;
+	table.MedianRowBytes = MedianRowBytes_AVX2;
+}
+#else
+void BindRowKernelsAVX2(msaRowKernelTable &)
+{
+}
+#endif
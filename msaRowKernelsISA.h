@@ -0,0 +1,61 @@
+#ifndef _msaRowKernelsISA_included
+#define _msaRowKernelsISA_included
+
+/*
+	Internal to the library: the table of SIMD row kernels that msaDispatch binds.  Each entry
+	handles as much of a line as its vector width allows and returns how many pixels or samples
+	it did; the functions in msaRowKernels.h finish the rest with plain C++, which also covers
+	entries left NULL.  Each instruction set has its own source file, compiled for that
+	instruction set, with a Bind function that fills in the entries it implements.
+*/
+
+struct msaRowKernelTable
+{
+	int (*DeinterleaveRGB)(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, int count);
+	int (*DeinterleaveRGBA)(const unsigned char *rgba, unsigned char *r, unsigned char *g, unsigned char *b,
+			unsigned char *a, int count);
+	int (*InterleaveRGB)(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb,
+			int count);
+	int (*InterleaveRGBA)(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			const unsigned char *a, unsigned char *rgba, int count);
+
+	int (*AddRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*SubtractRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*MultiplyRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*DivideRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*MinRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*MaxRowsFloat)(const float *a, const float *b, float *out, int count);
+	int (*MultiplyAddRowFloat)(const float *in, float weight, float *acc, int count);
+
+	int (*BytesToFloat)(const unsigned char *in, float *out, float scale, int count);
+	int (*FloatToBytes)(const float *in, unsigned char *out, float scale, int count);
+	int (*ShortsToFloat)(const unsigned short *in, float *out, float scale, int count);
+	int (*FloatToShorts)(const float *in, unsigned short *out, float scale, int count);
+
+	// these two work a whole byte of bits at a time, so return a multiple of 8
+	int (*ThresholdRow)(const unsigned char *in, unsigned char *bits, unsigned char threshold, int count);
+	int (*ExpandBitsRow)(const unsigned char *bits, unsigned char *out, unsigned char zero, unsigned char one,
+			int count);
+
+	int (*MinRowsBytes)(const unsigned char *a, const unsigned char *b, unsigned char *out, int count);
+	int (*MaxRowsBytes)(const unsigned char *a, const unsigned char *b, unsigned char *out, int count);
+	int (*ConvolveRowBytes)(const unsigned char *const *lines, const int *kernel, int kw, int kh, int step,
+			int divisor, unsigned char *out, int count);
+	int (*MedianRowBytes)(const unsigned char *const *lines, int size, int step, unsigned char *out, int count);
+};
+
+void BindRowKernelsSSE2(msaRowKernelTable &table);
+void BindRowKernelsSSSE3(msaRowKernelTable &table);
+void BindRowKernelsAVX2(msaRowKernelTable &table);
+
+// true if 32 bit accumulators can't overflow convolving bytes with kernel; the SIMD convolutions
+//  fall back to the 64 bit scalar loop otherwise
+bool ConvolutionFitsInt(const int *kernel, int taps, int divisor);
+// log2 of a divisor that is a power of two, so dividing can be a shift, otherwise -1
+int DivisorShift(int divisor);
+// true if the divisor is a power of two and every sum of bytes and kernel fits a 16 bit
+//  accumulator, so the SIMD convolutions can do twice as many samples at once; the sums are
+//  unsigned if no tap is negative, signed otherwise
+bool ConvolutionFitsShort(const int *kernel, int taps, int divisor);
+
+#endif
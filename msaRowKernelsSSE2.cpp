@@ -0,0 +1,461 @@
+#include "msaRowKernelsISA.h"
+
+/*
+	SSE2 row kernels, the x86-64 baseline.  Each returns the number of pixels or samples it
+	handled, see msaRowKernelsISA.h.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#pragma GCC target("sse2")
+#include <emmintrin.h>
+// after the target pragma, so the networks are built for this instruction set
+#include "msaSortNetworks.h"
+
+// RGBA only needs byte unpacking, which is plain SSE2; three rounds of unpacking turn
+//  4 pixel registers into 8 pixel channel runs
+static int DeinterleaveRGBA_SSE2(const unsigned char *rgba, unsigned char *r, unsigned char *g, unsigned char *b,
+		unsigned char *a, int count)
+{
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(rgba + x * 4));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(rgba + x * 4 + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(rgba + x * 4 + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(rgba + x * 4 + 48));
+
+		// pixels 0..7
+		__m128i t0 = _mm_unpacklo_epi8(v0, v1);
+		__m128i t1 = _mm_unpackhi_epi8(v0, v1);
+		__m128i u0 = _mm_unpacklo_epi8(t0, t1);
+		__m128i u1 = _mm_unpackhi_epi8(t0, t1);
+		__m128i rg0 = _mm_unpacklo_epi8(u0, u1);	// r0..r7 g0..g7
+		__m128i ba0 = _mm_unpackhi_epi8(u0, u1);	// b0..b7 a0..a7
+
+		// pixels 8..15
+		t0 = _mm_unpacklo_epi8(v2, v3);
+		t1 = _mm_unpackhi_epi8(v2, v3);
+		u0 = _mm_unpacklo_epi8(t0, t1);
+		u1 = _mm_unpackhi_epi8(t0, t1);
+		__m128i rg1 = _mm_unpacklo_epi8(u0, u1);
+		__m128i ba1 = _mm_unpackhi_epi8(u0, u1);
+
+		_mm_storeu_si128((__m128i *)(r + x), _mm_unpacklo_epi64(rg0, rg1));
+		_mm_storeu_si128((__m128i *)(g + x), _mm_unpackhi_epi64(rg0, rg1));
+		_mm_storeu_si128((__m128i *)(b + x), _mm_unpacklo_epi64(ba0, ba1));
+		_mm_storeu_si128((__m128i *)(a + x), _mm_unpackhi_epi64(ba0, ba1));
+	}
+	return x;
+}
+
+static int InterleaveRGBA_SSE2(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+		const unsigned char *a, unsigned char *rgba, int count)
+{
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+		__m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+
+		__m128i rgLo = _mm_unpacklo_epi8(vr, vg);	// r0 g0 r1 g1 ...
+		__m128i rgHi = _mm_unpackhi_epi8(vr, vg);
+		__m128i baLo = _mm_unpacklo_epi8(vb, va);	// b0 a0 b1 a1 ...
+		__m128i baHi = _mm_unpackhi_epi8(vb, va);
+
+		_mm_storeu_si128((__m128i *)(rgba + x * 4), _mm_unpacklo_epi16(rgLo, baLo));
+		_mm_storeu_si128((__m128i *)(rgba + x * 4 + 16), _mm_unpackhi_epi16(rgLo, baLo));
+		_mm_storeu_si128((__m128i *)(rgba + x * 4 + 32), _mm_unpacklo_epi16(rgHi, baHi));
+		_mm_storeu_si128((__m128i *)(rgba + x * 4 + 48), _mm_unpackhi_epi16(rgHi, baHi));
+	}
+	return x;
+}
+
+// a two input float row kernel doing 4 samples at a time of a and b, storing expr
+#define FLOAT_ROW_SSE2(name, expr) \
+	static int name##_SSE2(const float *a, const float *b, float *out, int count) \
+	{ \
+		int x = 0; \
+		for(; x + 4 <= count; x += 4) \
+		{ \
+			__m128 va = _mm_loadu_ps(a + x); \
+			__m128 vb = _mm_loadu_ps(b + x); \
+			_mm_storeu_ps(out + x, expr); \
+		} \
+		return x; \
+	}
+
+FLOAT_ROW_SSE2(AddRowsFloat, _mm_add_ps(va, vb))
+FLOAT_ROW_SSE2(SubtractRowsFloat, _mm_sub_ps(va, vb))
+FLOAT_ROW_SSE2(MultiplyRowsFloat, _mm_mul_ps(va, vb))
+// mask off the lanes that divided by zero
+FLOAT_ROW_SSE2(DivideRowsFloat, _mm_and_ps(_mm_div_ps(va, vb), _mm_cmpneq_ps(vb, _mm_setzero_ps())))
+FLOAT_ROW_SSE2(MinRowsFloat, _mm_min_ps(va, vb))
+FLOAT_ROW_SSE2(MaxRowsFloat, _mm_max_ps(va, vb))
+
+#undef FLOAT_ROW_SSE2
+
+static int MultiplyAddRowFloat_SSE2(const float *in, float weight, float *acc, int count)
+{
+	int x = 0;
+	__m128 vw = _mm_set1_ps(weight);
+	for(; x + 4 <= count; x += 4)
+		_mm_storeu_ps(acc + x, _mm_add_ps(_mm_loadu_ps(acc + x), _mm_mul_ps(_mm_loadu_ps(in + x), vw)));
+	return x;
+}
+
+static int BytesToFloat_SSE2(const unsigned char *in, float *out, float scale, int count)
+{
+	int x = 0;
+	__m128 vs = _mm_set1_ps(scale);
+	__m128i zero = _mm_setzero_si128();
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), vs));
+		_mm_storeu_ps(out + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), vs));
+		_mm_storeu_ps(out + x + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), vs));
+		_mm_storeu_ps(out + x + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), vs));
+	}
+	return x;
+}
+
+// scale, clamp to 0 - maxVal and round 4 floats, the same way the scalar loops do
+static inline __m128i ScaleClampRound(const float *in, __m128 vs, __m128 vmax)
+{
+	__m128 v = _mm_mul_ps(_mm_loadu_ps(in), vs);
+	v = _mm_max_ps(_mm_min_ps(v, vmax), _mm_setzero_ps());
+	return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+
+static int FloatToBytes_SSE2(const float *in, unsigned char *out, float scale, int count)
+{
+	int x = 0;
+	__m128 vs = _mm_set1_ps(scale);
+	__m128 vmax = _mm_set1_ps(255.0f);
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i a = ScaleClampRound(in + x, vs, vmax);
+		__m128i b = ScaleClampRound(in + x + 4, vs, vmax);
+		__m128i c = ScaleClampRound(in + x + 8, vs, vmax);
+		__m128i d = ScaleClampRound(in + x + 12, vs, vmax);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+	return x;
+}
+
+static int ShortsToFloat_SSE2(const unsigned short *in, float *out, float scale, int count)
+{
+	int x = 0;
+	__m128 vs = _mm_set1_ps(scale);
+	__m128i zero = _mm_setzero_si128();
+	for(; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		_mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), vs));
+		_mm_storeu_ps(out + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), vs));
+	}
+	return x;
+}
+
+static int FloatToShorts_SSE2(const float *in, unsigned short *out, float scale, int count)
+{
+	int x = 0;
+	__m128 vs = _mm_set1_ps(scale);
+	__m128 vmax = _mm_set1_ps(65535.0f);
+	// SSE2 only has a signed 32 to 16 bit pack, so shift into signed range and back
+	__m128i bias32 = _mm_set1_epi32(32768);
+	__m128i bias16 = _mm_set1_epi16((short)0x8000);
+	for(; x + 8 <= count; x += 8)
+	{
+		__m128i a = _mm_sub_epi32(ScaleClampRound(in + x, vs, vmax), bias32);
+		__m128i b = _mm_sub_epi32(ScaleClampRound(in + x + 4, vs, vmax), bias32);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_xor_si128(_mm_packs_epi32(a, b), bias16));
+	}
+	return x;
+}
+
+// movemask puts the first pixel in the low bit, bitonal images want it in the high bit
+static inline unsigned char ReverseBits(unsigned char b)
+{
+	b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+	return b;
+}
+
+static int ThresholdRow_SSE2(const unsigned char *in, unsigned char *bits, unsigned char threshold, int count)
+{
+	int x = 0;
+	__m128i vt = _mm_set1_epi8((char)threshold);
+	for(; x + 16 <= count; x += 16)
+	{
+		// there's no unsigned compare, but v >= t exactly when max(v, t) == v
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, vt), v));
+		bits[x / 8] = ReverseBits(mask & 0xFF);
+		bits[x / 8 + 1] = ReverseBits(mask >> 8);
+	}
+	return x;
+}
+
+static int ExpandBitsRow_SSE2(const unsigned char *bits, unsigned char *out, unsigned char zero, unsigned char one,
+		int count)
+{
+	int x = 0;
+	// each lane tests its own bit of a byte repeated 8 times
+	__m128i vbit = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+	__m128i vzero = _mm_set1_epi8((char)zero);
+	__m128i vone = _mm_set1_epi8((char)one);
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i b = _mm_unpacklo_epi64(_mm_set1_epi8((char)bits[x / 8]), _mm_set1_epi8((char)bits[x / 8 + 1]));
+		__m128i set = _mm_cmpeq_epi8(_mm_and_si128(b, vbit), vbit);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(_mm_and_si128(set, vone), _mm_andnot_si128(set, vzero)));
+	}
+	return x;
+}
+
+static int MinRowsBytes_SSE2(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+		_mm_storeu_si128((__m128i *)(out + x), _mm_min_epu8(_mm_loadu_si128((const __m128i *)(a + x)),
+				_mm_loadu_si128((const __m128i *)(b + x))));
+	return x;
+}
+
+static int MaxRowsBytes_SSE2(const unsigned char *a, const unsigned char *b, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+		_mm_storeu_si128((__m128i *)(out + x), _mm_max_epu8(_mm_loadu_si128((const __m128i *)(a + x)),
+				_mm_loadu_si128((const __m128i *)(b + x))));
+	return x;
+}
+
+// divide 4 sums by the divisor, truncating toward zero like integer division; a double holds
+//  the quotient of two ints closely enough that truncating it is always exact
+static inline __m128i DivideSums(__m128i sums, __m128d vdiv)
+{
+	__m128i lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(sums), vdiv));
+	__m128i hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(sums, sums)), vdiv));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+// 8 samples at a time, with 32 bit products built from the low and high halves of 16 bit ones;
+//  KW and KH fix the kernel size so the taps unroll completely, as in the AVX2 version
+template <int KW, int KH>
+static int ConvolveRowBytesN_SSE2(const unsigned char *const *lines, const int *values, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	int taps[KW * KH > 0 ? KW * KH : 1];
+	const int *kernel = values;
+	if(KW * KH > 0)
+	{
+		for(int i = 0; i < KW * KH; ++i)
+			taps[i] = values[i];
+		kernel = taps;
+	}
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(divisor / 2);
+	__m128d vdiv = _mm_set1_pd(divisor);
+	int shift = DivisorShift(divisor);
+	__m128i vshift = _mm_cvtsi32_si128(shift);
+
+	int x = 0;
+	for(; x + 8 <= count; x += 8)
+	{
+		__m128i sum0 = round;
+		__m128i sum1 = round;
+
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			const unsigned char *pin = lines[filtY] + x;
+			for(int filtX = 0; filtX < width; ++filtX, pin += step)
+			{
+				int k = kernel[filtVal++];
+				if(k == 0)
+					continue;
+
+				__m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pin), zero);
+				__m128i vk = _mm_set1_epi16((short)k);
+				__m128i lo = _mm_mullo_epi16(v, vk);
+				__m128i hi = _mm_mulhi_epi16(v, vk);
+				sum0 = _mm_add_epi32(sum0, _mm_unpacklo_epi16(lo, hi));
+				sum1 = _mm_add_epi32(sum1, _mm_unpackhi_epi16(lo, hi));
+			}
+		}
+
+		// the saturating packs clamp to 0 - 255, so a shift rounding down below zero is no different
+		__m128i q;
+		if(shift >= 0)
+			q = _mm_packs_epi32(_mm_sra_epi32(sum0, vshift), _mm_sra_epi32(sum1, vshift));
+		else
+			q = _mm_packs_epi32(DivideSums(sum0, vdiv), DivideSums(sum1, vdiv));
+		_mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(q, q));
+	}
+	return x;
+}
+
+// 16 samples at a time with 16 bit sums, for kernels ConvolutionFitsShort() passes; the sums may
+//  wrap on the way, but the last one fits, so its low 16 bits are all that's needed, shifted as
+//  unsigned when no tap is negative
+template <int KW, int KH>
+static int ConvolveRowShortsN_SSE2(const unsigned char *const *lines, const int *values, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	const int width = KW ? KW : kw;
+	const int height = KH ? KH : kh;
+	int taps[KW * KH > 0 ? KW * KH : 1];
+	const int *kernel = values;
+	if(KW * KH > 0)
+	{
+		for(int i = 0; i < KW * KH; ++i)
+			taps[i] = values[i];
+		kernel = taps;
+	}
+
+	bool negative = false;
+	for(int i = 0; i < width * height; ++i)
+		negative |= kernel[i] < 0;
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi16((short)(divisor / 2));
+	__m128i vshift = _mm_cvtsi32_si128(DivisorShift(divisor));
+
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i sum0 = round;
+		__m128i sum1 = round;
+
+		int filtVal = 0;
+		for(int filtY = 0; filtY < height; ++filtY)
+		{
+			const unsigned char *pin = lines[filtY] + x;
+			for(int filtX = 0; filtX < width; ++filtX, pin += step)
+			{
+				int k = kernel[filtVal++];
+				if(k == 0)
+					continue;
+
+				__m128i v = _mm_loadu_si128((const __m128i *)pin);
+				__m128i vk = _mm_set1_epi16((short)k);
+				sum0 = _mm_add_epi16(sum0, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), vk));
+				sum1 = _mm_add_epi16(sum1, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), vk));
+			}
+		}
+
+		if(negative)
+		{
+			sum0 = _mm_sra_epi16(sum0, vshift);
+			sum1 = _mm_sra_epi16(sum1, vshift);
+		}
+		else
+		{
+			sum0 = _mm_srl_epi16(sum0, vshift);
+			sum1 = _mm_srl_epi16(sum1, vshift);
+		}
+
+		_mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(sum0, sum1));
+	}
+	return x;
+}
+
+static int ConvolveRowBytes_SSE2(const unsigned char *const *lines, const int *kernel, int kw, int kh, int step,
+		int divisor, unsigned char *out, int count)
+{
+	for(int i = 0; i < kw * kh; ++i)
+		if(kernel[i] < -32768 || kernel[i] > 32767)
+			return 0;
+	if(!ConvolutionFitsInt(kernel, kw * kh, divisor))
+		return 0;
+
+	if(ConvolutionFitsShort(kernel, kw * kh, divisor))
+	{
+		if(kw == 3 && kh == 3)
+			return ConvolveRowShortsN_SSE2<3, 3>(lines, kernel, kw, kh, step, divisor, out, count);
+		if(kw == 5 && kh == 5)
+			return ConvolveRowShortsN_SSE2<5, 5>(lines, kernel, kw, kh, step, divisor, out, count);
+		if(kw == 7 && kh == 7)
+			return ConvolveRowShortsN_SSE2<7, 7>(lines, kernel, kw, kh, step, divisor, out, count);
+		return ConvolveRowShortsN_SSE2<0, 0>(lines, kernel, kw, kh, step, divisor, out, count);
+	}
+
+	if(kw == 3 && kh == 3)
+		return ConvolveRowBytesN_SSE2<3, 3>(lines, kernel, kw, kh, step, divisor, out, count);
+	if(kw == 5 && kh == 5)
+		return ConvolveRowBytesN_SSE2<5, 5>(lines, kernel, kw, kh, step, divisor, out, count);
+	if(kw == 7 && kh == 7)
+		return ConvolveRowBytesN_SSE2<7, 7>(lines, kernel, kw, kh, step, divisor, out, count);
+	return ConvolveRowBytesN_SSE2<0, 0>(lines, kernel, kw, kh, step, divisor, out, count);
+}
+
+// unsigned byte min and max for the sorting networks, 16 windows at a time
+struct BytesMinMax_SSE2
+{
+	static __m128i Min(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+	static __m128i Max(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+};
+
+template <int S>
+static int MedianRowBytesN_SSE2(const unsigned char *const *lines, int step, unsigned char *out, int count)
+{
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i p[25];
+		for(int filtY = 0; filtY < S; ++filtY)
+			for(int filtX = 0; filtX < S; ++filtX)
+				p[filtY * S + filtX] = _mm_loadu_si128((const __m128i *)(lines[filtY] + x + filtX * step));
+
+		__m128i median = S == 3 ? Median9<__m128i, BytesMinMax_SSE2>(p) : Median25<__m128i, BytesMinMax_SSE2>(p);
+		_mm_storeu_si128((__m128i *)(out + x), median);
+	}
+	return x;
+}
+
+static int MedianRowBytes_SSE2(const unsigned char *const *lines, int size, int step, unsigned char *out, int count)
+{
+	if(size == 3)
+		return MedianRowBytesN_SSE2<3>(lines, step, out, count);
+	if(size == 5)
+		return MedianRowBytesN_SSE2<5>(lines, step, out, count);
+	return 0;
+}
+
+void BindRowKernelsSSE2(msaRowKernelTable &table)
+{
+	table.DeinterleaveRGBA = DeinterleaveRGBA_SSE2;
+	table.InterleaveRGBA = InterleaveRGBA_SSE2;
+	table.AddRowsFloat = AddRowsFloat_SSE2;
+	table.SubtractRowsFloat = SubtractRowsFloat_SSE2;
+	table.MultiplyRowsFloat = MultiplyRowsFloat_SSE2;
+	table.DivideRowsFloat = DivideRowsFloat_SSE2;
+	table.MinRowsFloat = MinRowsFloat_SSE2;
+	table.MaxRowsFloat = MaxRowsFloat_SSE2;
+	table.MultiplyAddRowFloat = MultiplyAddRowFloat_SSE2;
+	table.BytesToFloat = BytesToFloat_SSE2;
+	table.FloatToBytes = FloatToBytes_SSE2;
+	table.ShortsToFloat = ShortsToFloat_SSE2;
+	table.FloatToShorts = FloatToShorts_SSE2;
+	table.ThresholdRow = ThresholdRow_SSE2;
+	table.ExpandBitsRow = ExpandBitsRow_SSE2;
+	table.MinRowsBytes = MinRowsBytes_SSE2;
+	table.MaxRowsBytes = MaxRowsBytes_SSE2;
+	table.ConvolveRowBytes = ConvolveRowBytes_SSE2;
+	table.MedianRowBytes = MedianRowBytes_SSE2;
+}
+#else
+void BindRowKernelsSSE2(msaRowKernelTable &)
+{
+}
+#endif
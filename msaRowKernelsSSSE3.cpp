@@ -0,0 +1,116 @@
+#include "msaRowKernelsISA.h"
+
+/*
+	SSSE3 row kernels; pshufb makes the three byte RGB layout practical to split and merge.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#pragma GCC target("ssse3")
+#include <tmmintrin.h>
+
+#define X -1
+// shuffle masks to pull one channel out of each of the three registers holding 16 RGB pixels
+static const signed char deintR[3][16] =
+{
+	{ 0, 3, 6, 9, 12, 15, X, X, X, X, X, X, X, X, X, X },
+	{ X, X, X, X, X, X, 2, 5, 8, 11, 14, X, X, X, X, X },
+	{ X, X, X, X, X, X, X, X, X, X, X, 1, 4, 7, 10, 13 }
+};
+static const signed char deintG[3][16] =
+{
+	{ 1, 4, 7, 10, 13, X, X, X, X, X, X, X, X, X, X, X },
+	{ X, X, X, X, X, 0, 3, 6, 9, 12, 15, X, X, X, X, X },
+	{ X, X, X, X, X, X, X, X, X, X, X, 2, 5, 8, 11, 14 }
+};
+static const signed char deintB[3][16] =
+{
+	{ 2, 5, 8, 11, 14, X, X, X, X, X, X, X, X, X, X, X },
+	{ X, X, X, X, X, 1, 4, 7, 10, 13, X, X, X, X, X, X },
+	{ X, X, X, X, X, X, X, X, X, X, 0, 3, 6, 9, 12, 15 }
+};
+
+// shuffle masks to spread each channel register into the three output registers
+static const signed char intR[3][16] =
+{
+	{ 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X, X, 5 },
+	{ X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X, 10, X },
+	{ X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15, X, X }
+};
+static const signed char intG[3][16] =
+{
+	{ X, 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X, X },
+	{ 5, X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X, 10 },
+	{ X, X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15, X }
+};
+static const signed char intB[3][16] =
+{
+	{ X, X, 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X },
+	{ X, 5, X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X },
+	{ 10, X, X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15 }
+};
+#undef X
+
+static inline __m128i LoadMask(const signed char *mask)
+{
+	return _mm_loadu_si128((const __m128i *)mask);
+}
+
+// 16 pixels per pass
+static int DeinterleaveRGB_SSSE3(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, int count)
+{
+	__m128i mr0 = LoadMask(deintR[0]), mr1 = LoadMask(deintR[1]), mr2 = LoadMask(deintR[2]);
+	__m128i mg0 = LoadMask(deintG[0]), mg1 = LoadMask(deintG[1]), mg2 = LoadMask(deintG[2]);
+	__m128i mb0 = LoadMask(deintB[0]), mb1 = LoadMask(deintB[1]), mb2 = LoadMask(deintB[2]);
+
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(rgb + x * 3));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(rgb + x * 3 + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(rgb + x * 3 + 32));
+
+		__m128i vr = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, mr0), _mm_shuffle_epi8(v1, mr1)), _mm_shuffle_epi8(v2, mr2));
+		__m128i vg = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, mg0), _mm_shuffle_epi8(v1, mg1)), _mm_shuffle_epi8(v2, mg2));
+		__m128i vb = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, mb0), _mm_shuffle_epi8(v1, mb1)), _mm_shuffle_epi8(v2, mb2));
+
+		_mm_storeu_si128((__m128i *)(r + x), vr);
+		_mm_storeu_si128((__m128i *)(g + x), vg);
+		_mm_storeu_si128((__m128i *)(b + x), vb);
+	}
+	return x;
+}
+
+static int InterleaveRGB_SSSE3(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, int count)
+{
+	__m128i mr0 = LoadMask(intR[0]), mr1 = LoadMask(intR[1]), mr2 = LoadMask(intR[2]);
+	__m128i mg0 = LoadMask(intG[0]), mg1 = LoadMask(intG[1]), mg2 = LoadMask(intG[2]);
+	__m128i mb0 = LoadMask(intB[0]), mb1 = LoadMask(intB[1]), mb2 = LoadMask(intB[2]);
+
+	int x = 0;
+	for(; x + 16 <= count; x += 16)
+	{
+		__m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+		__m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+
+		__m128i v0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, mr0), _mm_shuffle_epi8(vg, mg0)), _mm_shuffle_epi8(vb, mb0));
+		__m128i v1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, mr1), _mm_shuffle_epi8(vg, mg1)), _mm_shuffle_epi8(vb, mb1));
+		__m128i v2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, mr2), _mm_shuffle_epi8(vg, mg2)), _mm_shuffle_epi8(vb, mb2));
+
+		_mm_storeu_si128((__m128i *)(rgb + x * 3), v0);
+		_mm_storeu_si128((__m128i *)(rgb + x * 3 + 16), v1);
+		_mm_storeu_si128((__m128i *)(rgb + x * 3 + 32), v2);
+	}
+	return x;
+}
+
+void BindRowKernelsSSSE3(msaRowKernelTable &table)
+{
+	table.DeinterleaveRGB = DeinterleaveRGB_SSSE3;
+	table.InterleaveRGB = InterleaveRGB_SSSE3;
+}
+#else
+void BindRowKernelsSSSE3(msaRowKernelTable &)
+{
+}
+#endif
@@ -0,0 +1,82 @@
+#ifndef _msaSortNetworks_included
+#define _msaSortNetworks_included
+
+/*
+	Internal to the library: medians of 9 and 25 values by fixed networks of compare exchanges,
+	from Devillard's "Fast median search".  There are no branches, only mins and maxes, so the
+	same network works on plain samples or on SIMD registers of them, a window per lane.  Ops
+	supplies Min and Max for the type V.  Only the exchanges leading to the middle value are
+	kept, and the compiler drops the halves of them whose results aren't used.
+*/
+
+template <typename V, typename Ops>
+inline void SortPair(V &a, V &b)
+{
+	V low = Ops::Min(a, b);
+	b = Ops::Max(a, b);
+	a = low;
+}
+
+// the middle of 9 values, in 19 exchanges; p is reordered
+template <typename V, typename Ops>
+inline V Median9(V *p)
+{
+	SortPair<V, Ops>(p[1], p[2]); SortPair<V, Ops>(p[4], p[5]); SortPair<V, Ops>(p[7], p[8]);
+	SortPair<V, Ops>(p[0], p[1]); SortPair<V, Ops>(p[3], p[4]); SortPair<V, Ops>(p[6], p[7]);
+	SortPair<V, Ops>(p[1], p[2]); SortPair<V, Ops>(p[4], p[5]); SortPair<V, Ops>(p[7], p[8]);
+	SortPair<V, Ops>(p[0], p[3]); SortPair<V, Ops>(p[5], p[8]); SortPair<V, Ops>(p[4], p[7]);
+	SortPair<V, Ops>(p[3], p[6]); SortPair<V, Ops>(p[1], p[4]); SortPair<V, Ops>(p[2], p[5]);
+	SortPair<V, Ops>(p[4], p[7]); SortPair<V, Ops>(p[4], p[2]); SortPair<V, Ops>(p[6], p[4]);
+	SortPair<V, Ops>(p[4], p[2]);
+	return p[4];
+}
+
+// the middle of 25 values, in 99 exchanges; p is reordered
+template <typename V, typename Ops>
+inline V Median25(V *p)
+{
+	SortPair<V, Ops>(p[0], p[1]); SortPair<V, Ops>(p[3], p[4]); SortPair<V, Ops>(p[2], p[4]);
+	SortPair<V, Ops>(p[2], p[3]); SortPair<V, Ops>(p[6], p[7]); SortPair<V, Ops>(p[5], p[7]);
+	SortPair<V, Ops>(p[5], p[6]); SortPair<V, Ops>(p[9], p[10]); SortPair<V, Ops>(p[8], p[10]);
+	SortPair<V, Ops>(p[8], p[9]); SortPair<V, Ops>(p[12], p[13]); SortPair<V, Ops>(p[11], p[13]);
+	SortPair<V, Ops>(p[11], p[12]); SortPair<V, Ops>(p[15], p[16]); SortPair<V, Ops>(p[14], p[16]);
+	SortPair<V, Ops>(p[14], p[15]); SortPair<V, Ops>(p[18], p[19]); SortPair<V, Ops>(p[17], p[19]);
+	SortPair<V, Ops>(p[17], p[18]); SortPair<V, Ops>(p[21], p[22]); SortPair<V, Ops>(p[20], p[22]);
+	SortPair<V, Ops>(p[20], p[21]); SortPair<V, Ops>(p[23], p[24]); SortPair<V, Ops>(p[2], p[5]);
+	SortPair<V, Ops>(p[3], p[6]); SortPair<V, Ops>(p[0], p[6]); SortPair<V, Ops>(p[0], p[3]);
+	SortPair<V, Ops>(p[4], p[7]); SortPair<V, Ops>(p[1], p[7]); SortPair<V, Ops>(p[1], p[4]);
+	SortPair<V, Ops>(p[11], p[14]); SortPair<V, Ops>(p[8], p[14]); SortPair<V, Ops>(p[8], p[11]);
+	SortPair<V, Ops>(p[12], p[15]); SortPair<V, Ops>(p[9], p[15]); SortPair<V, Ops>(p[9], p[12]);
+	SortPair<V, Ops>(p[13], p[16]); SortPair<V, Ops>(p[10], p[16]); SortPair<V, Ops>(p[10], p[13]);
+	SortPair<V, Ops>(p[20], p[23]); SortPair<V, Ops>(p[17], p[23]); SortPair<V, Ops>(p[17], p[20]);
+	SortPair<V, Ops>(p[21], p[24]); SortPair<V, Ops>(p[18], p[24]); SortPair<V, Ops>(p[18], p[21]);
+	SortPair<V, Ops>(p[19], p[22]); SortPair<V, Ops>(p[8], p[17]); SortPair<V, Ops>(p[9], p[18]);
+	SortPair<V, Ops>(p[0], p[18]); SortPair<V, Ops>(p[0], p[9]); SortPair<V, Ops>(p[10], p[19]);
+	SortPair<V, Ops>(p[1], p[19]); SortPair<V, Ops>(p[1], p[10]); SortPair<V, Ops>(p[11], p[20]);
+	SortPair<V, Ops>(p[2], p[20]); SortPair<V, Ops>(p[2], p[11]); SortPair<V, Ops>(p[12], p[21]);
+	SortPair<V, Ops>(p[3], p[21]); SortPair<V, Ops>(p[3], p[12]); SortPair<V, Ops>(p[13], p[22]);
+	SortPair<V, Ops>(p[4], p[22]); SortPair<V, Ops>(p[4], p[13]); SortPair<V, Ops>(p[14], p[23]);
+	SortPair<V, Ops>(p[5], p[23]); SortPair<V, Ops>(p[5], p[14]); SortPair<V, Ops>(p[15], p[24]);
+	SortPair<V, Ops>(p[6], p[24]); SortPair<V, Ops>(p[6], p[15]); SortPair<V, Ops>(p[7], p[16]);
+	SortPair<V, Ops>(p[7], p[19]); SortPair<V, Ops>(p[13], p[21]); SortPair<V, Ops>(p[15], p[23]);
+	SortPair<V, Ops>(p[7], p[13]); SortPair<V, Ops>(p[7], p[15]); SortPair<V, Ops>(p[1], p[9]);
+	SortPair<V, Ops>(p[3], p[11]); SortPair<V, Ops>(p[5], p[17]); SortPair<V, Ops>(p[11], p[17]);
+	SortPair<V, Ops>(p[9], p[17]); SortPair<V, Ops>(p[4], p[10]); SortPair<V, Ops>(p[6], p[12]);
+	SortPair<V, Ops>(p[7], p[14]); SortPair<V, Ops>(p[4], p[6]); SortPair<V, Ops>(p[4], p[7]);
+	SortPair<V, Ops>(p[12], p[14]); SortPair<V, Ops>(p[10], p[14]); SortPair<V, Ops>(p[6], p[7]);
+	SortPair<V, Ops>(p[10], p[12]); SortPair<V, Ops>(p[6], p[10]); SortPair<V, Ops>(p[6], p[17]);
+	SortPair<V, Ops>(p[12], p[17]); SortPair<V, Ops>(p[7], p[17]); SortPair<V, Ops>(p[7], p[10]);
+	SortPair<V, Ops>(p[12], p[18]); SortPair<V, Ops>(p[7], p[12]); SortPair<V, Ops>(p[10], p[18]);
+	SortPair<V, Ops>(p[12], p[20]); SortPair<V, Ops>(p[10], p[20]); SortPair<V, Ops>(p[10], p[12]);
+	return p[12];
+}
+
+// Min and Max for plain samples
+template <typename T>
+struct ScalarMinMax
+{
+	static T Min(T a, T b) { return a < b ? a : b; }
+	static T Max(T a, T b) { return a < b ? b : a; }
+};
+
+#endif
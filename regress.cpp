@@ -0,0 +1,1181 @@
+/*
+	imgregress - golden output regression tests for msaImage and msaFilters
+
+	usage: imgregress [--update] [--golden file] [--verbose]
+
+	Every case runs an operation on deterministic synthetic images and hashes the meaningful
+	bytes of the result, so line padding and the unused bits at the end of bitonal lines are
+	skipped.  Hashes are compared against the golden file, regress.golden by default, and
+	--update rewrites it from the current code.  Operations that throw record the exception
+	message instead, so the cases that aren't supported stay unsupported.
+
+	Checks are cases with a documented bound, like how far an approximation may be from what it
+	approximates; they pass or fail on their own, aren't in the golden file, and still fail while
+	updating it.
+
+	Images come in odd widths and in strides that aren't a multiple of 4, with the stride padding
+	filled with junk, so kernels that read past the end of a line show up as mismatches.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "msaImage.h"
+#include "msaFilters.h"
+#include "msaEdges.h"
+#include "msaPyramid.h"
+
+using namespace std;
+
+// 64 bit FNV-1a
+class Hasher
+{
+public:
+	unsigned long long hash;
+
+	Hasher() { hash = 0xcbf29ce484222325ULL; }
+
+	void Add(const void *bytes, int count)
+	{
+		const unsigned char *p = (const unsigned char *)bytes;
+		for(int i = 0; i < count; ++i)
+		{
+			hash ^= p[i];
+			hash *= 0x100000001b3ULL;
+		}
+	}
+
+	void Add(int value)
+	{
+		Add(&value, sizeof(value));
+	}
+
+	void Add(const char *text)
+	{
+		Add(text, strlen(text));
+	}
+
+	// shape and the meaningful bytes of every line of every plane
+	void Add(msaImage &image)
+	{
+		Add(image.Width());
+		Add(image.Height());
+		Add(image.Depth());
+		Add(image.IsFloat() ? 1 : 0);
+		Add(image.Planar() ? 1 : 0);
+
+		int planes = image.Planar() ? image.Channels() : 1;
+		int bits = image.Planar() ? image.BitsPerSample() : image.Depth();
+		int lineBits = image.Width() * bits;
+
+		for(int c = 0; c < planes; ++c)
+		{
+			for(int y = 0; y < image.Height(); ++y)
+			{
+				unsigned char *line = &image.Plane(c)[y * image.BytesPerLine()];
+				Add(line, lineBits / 8);
+				if(lineBits % 8 != 0)
+				{
+					unsigned char last = line[lineBits / 8] & (0xFF << (8 - lineBits % 8));
+					Add(&last, 1);
+				}
+			}
+		}
+	}
+};
+
+struct TestSize
+{
+	int width;
+	int height;
+	int padding;	// extra bytes on each line, beyond the usual stride
+};
+
+static const TestSize testSizes[] =
+{
+	{ 37, 23, 0 },
+	{ 64, 16, 0 },
+	{ 37, 23, 5 },
+	{ 13, 9, 3 },
+};
+
+static const char *testDepths[] = { "1", "8", "16", "24", "32", "48", "64", "f32", "f96", "f128" };
+
+// repeatable noise, restarted for every image so cases don't depend on each other
+class Noise
+{
+public:
+	unsigned int seed;
+
+	Noise(unsigned int s) { seed = s; }
+
+	unsigned char Next()
+	{
+		seed = seed * 1103515245 + 12345;
+		return (unsigned char)(seed >> 16);
+	}
+};
+
+// an 8 bit per channel image with a gradient, noise, and some flat areas with hard edges
+static void FillSynthetic(msaImage &image, int width, int height, int depth, unsigned int seed)
+{
+	Noise noise(seed);
+	image.CreateImage(width, height, depth);
+	int samples = width * depth / 8;
+	for(int y = 0; y < height; ++y)
+	{
+		unsigned char *line = &image.Data()[y * image.BytesPerLine()];
+		for(int x = 0; x < samples; ++x)
+		{
+			int pixel = x / (depth / 8);
+			if((pixel / 8 + y / 6) % 3 == 0)
+				line[x] = (pixel / 8) % 2 == 0 ? 230 : 20;
+			else
+				line[x] = (unsigned char)(((x * 5 + y * 9) & 0xFF) / 2 + noise.Next() / 2);
+		}
+	}
+}
+
+// copy an image into a buffer with a wider stride, filling the extra bytes with junk
+static void PadStride(msaImage &image, int padding)
+{
+	if(padding == 0)
+		return;
+
+	// wider samples have to stay aligned, so round the padding up to a whole sample
+	int sampleBytes = (image.BitsPerSample() + 7) / 8;
+	padding = (padding + sampleBytes - 1) / sampleBytes * sampleBytes;
+
+	int lineBytes = (image.Width() * image.Depth() + 7) / 8;
+	int bpl = image.BytesPerLine() + padding;
+	unsigned char *buffer = new unsigned char[image.Height() * bpl];
+	memset(buffer, 0xCD, image.Height() * bpl);
+	for(int y = 0; y < image.Height(); ++y)
+		memcpy(&buffer[y * bpl], &image.Data()[y * image.BytesPerLine()], lineBytes);
+
+	image.TakeExternalData(image.Width(), image.Height(), bpl, image.Depth(), buffer, false, image.IsFloat());
+}
+
+// make a test image of any depth, going through the matching 8 bit depth
+static void MakeImage(msaImage &image, const TestSize &size, const string &depthName, unsigned int seed)
+{
+	msaPixel white = { 255, 255, 255, 255 };
+	bool isFloat = depthName[0] == 'f';
+	int depth = atoi(depthName.c_str() + (isFloat ? 1 : 0));
+
+	if(isFloat)
+	{
+		msaImage base;
+		FillSynthetic(base, size.width, size.height, depth / 4, seed);
+		base.ToFloat(image);
+	}
+	else if(depth == 1)
+	{
+		msaImage base;
+		FillSynthetic(base, size.width, size.height, 8, seed);
+		base.Threshold(128, image);
+	}
+	else if(depth == 16 || depth == 48 || depth == 64)
+	{
+		msaImage base;
+		FillSynthetic(base, size.width, size.height, depth / 2, seed);
+		base.SimpleConvert(depth, white, image);
+	}
+	else
+		FillSynthetic(image, size.width, size.height, depth, seed);
+
+	PadStride(image, size.padding);
+}
+
+struct TestContext
+{
+	TestSize size;
+	string depthName;
+	msaImage image;		// image under test
+	msaImage other;		// second image of the same depth
+	msaImage gray;		// 8 bit images, for masks and planes
+	msaImage gray2;
+	msaImage gray3;
+	msaImage gray4;
+};
+
+class TestRunner
+{
+public:
+	map<string, string> golden;
+	vector<pair<string, string> > results;
+	string prefix;		// size and depth, so the golden file says what broke
+	bool verbose;
+	int failures;
+	int checks;
+	int checkFailures;
+
+	TestRunner() { verbose = false; failures = 0; checks = 0; checkFailures = 0; }
+
+	// run one check; body throws a message if the bound doesn't hold
+	void Check(const string &caseName, function<void()> body)
+	{
+		string name = prefix + caseName;
+		++checks;
+		try
+		{
+			body();
+			if(verbose)
+				printf("ok    %s\n", name.c_str());
+		}
+		catch(const char *message)
+		{
+			// on stderr, so a failed check shows while updating too
+			fprintf(stderr, "FAIL  %s %s\n", name.c_str(), message);
+			++checkFailures;
+		}
+	}
+
+	// run one case; body adds whatever it produces to the hasher
+	void Run(const string &caseName, function<void(Hasher &)> body)
+	{
+		string name = prefix + caseName;
+		Hasher hasher;
+		string result;
+		try
+		{
+			body(hasher);
+			char text[32];
+			snprintf(text, sizeof(text), "%016llx", hasher.hash);
+			result = text;
+		}
+		catch(const char *message)
+		{
+			// record the message, with spaces swapped out to keep the file one case per line
+			result = string("throw:") + message;
+			for(size_t i = 0; i < result.size(); ++i)
+				if(result[i] == ' ')
+					result[i] = '_';
+		}
+
+		results.push_back(make_pair(name, result));
+
+		map<string, string>::iterator it = golden.find(name);
+		if(it == golden.end())
+		{
+			printf("NEW   %s %s\n", name.c_str(), result.c_str());
+			++failures;
+		}
+		else if(it->second != result)
+		{
+			printf("FAIL  %s expected %s got %s\n", name.c_str(), it->second.c_str(), result.c_str());
+			++failures;
+		}
+		else if(verbose)
+			printf("ok    %s %s\n", name.c_str(), result.c_str());
+	}
+};
+
+// the largest difference between two 8 bit per sample images of the same shape
+static int MaxDifference(msaImage &a, msaImage &b)
+{
+	int planes = a.Planar() ? a.Channels() : 1;
+	int lineBytes = a.Planar() ? a.Width() : a.Width() * a.Depth() / 8;
+	int most = 0;
+	for(int c = 0; c < planes; ++c)
+	{
+		for(int y = 0; y < a.Height(); ++y)
+		{
+			const unsigned char *pa = &a.Plane(c)[y * a.BytesPerLine()];
+			const unsigned char *pb = &b.Plane(c)[y * b.BytesPerLine()];
+			for(int x = 0; x < lineBytes; ++x)
+				most = max(most, abs(pa[x] - pb[x]));
+		}
+	}
+	return most;
+}
+
+static void AddTransformCases(TestRunner &runner, const string &prefix, msaImage &image)
+{
+	const char *qualities[3] = { "fast", "better", "best" };
+	for(int q = 0; q < 3; ++q)
+	{
+		int quality = q * 50;
+		runner.Run(prefix + "transform/rot10/" + qualities[q], [&image, quality](Hasher &hasher)
+		{
+			msaAffineTransform transform;
+			transform.SetTransform(1.0, DegreesToRadians(10.0), image.Width(), image.Height());
+			msaImage output;
+			image.TransformImage(transform, output, quality);
+			hasher.Add(output);
+		});
+		runner.Run(prefix + "transform/rot200x1.3/" + qualities[q], [&image, quality](Hasher &hasher)
+		{
+			msaAffineTransform transform;
+			transform.SetTransform(1.3, DegreesToRadians(200.0), image.Width(), image.Height());
+			transform.oob_r = 10;
+			transform.oob_g = 20;
+			transform.oob_b = 30;
+			transform.oob_a = 40;
+			msaImage output;
+			image.TransformImage(transform, output, quality);
+			hasher.Add(output);
+		});
+	}
+
+	const struct
+	{
+		const char *name;
+		msaImage::ResizeFilter filter;
+		double scale;
+	} resizes[] = {
+		{ "area/half", msaImage::ResizeFilter::Area, 0.5 },
+		{ "area/0.7", msaImage::ResizeFilter::Area, 0.7 },
+		{ "lanczos3/0.6", msaImage::ResizeFilter::Lanczos3, 0.6 },
+		{ "lanczos3/1.7", msaImage::ResizeFilter::Lanczos3, 1.7 },
+	};
+	for(size_t r = 0; r < sizeof(resizes) / sizeof(resizes[0]); ++r)
+	{
+		msaImage::ResizeFilter filter = resizes[r].filter;
+		double scale = resizes[r].scale;
+		runner.Run(prefix + "resize/" + resizes[r].name, [&image, filter, scale](Hasher &hasher)
+		{
+			msaImage output;
+			image.Resize(max(1, (int)(image.Width() * scale)), max(1, (int)(image.Height() * scale)), filter, output);
+			hasher.Add(output);
+		});
+	}
+}
+
+static void AddFilterCases(TestRunner &runner, const string &prefix, msaImage &image)
+{
+	struct FilterCase
+	{
+		const char *name;
+		msaFilters::FilterType type;
+		int width;
+		int height;
+	};
+	static const FilterCase filters[] =
+	{
+		{ "gaussian/3x3", msaFilters::FilterType::Gaussian, 3, 3 },
+		{ "gaussian/5x5", msaFilters::FilterType::Gaussian, 5, 5 },
+		{ "gaussian/7x7", msaFilters::FilterType::Gaussian, 7, 7 },
+		{ "sharpen/5x5", msaFilters::FilterType::Sharpen, 5, 5 },
+		{ "dilate/3x3", msaFilters::FilterType::Dilate, 3, 3 },
+		{ "dilate/5x3", msaFilters::FilterType::Dilate, 5, 3 },
+		{ "erode/3x3", msaFilters::FilterType::Erode, 3, 3 },
+		{ "erode/5x3", msaFilters::FilterType::Erode, 5, 3 },
+		{ "median/3x3", msaFilters::FilterType::Median, 3, 3 },
+		{ "median/5x5", msaFilters::FilterType::Median, 5, 5 },
+		{ "box/3x3", msaFilters::FilterType::Box, 3, 3 },
+		{ "box/5x3", msaFilters::FilterType::Box, 5, 3 },
+		{ "box/9x9", msaFilters::FilterType::Box, 9, 9 },
+		{ "recursivegaussian/3x3", msaFilters::FilterType::RecursiveGaussian, 3, 3 },
+		{ "recursivegaussian/15x9", msaFilters::FilterType::RecursiveGaussian, 15, 9 },
+	};
+
+	for(size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); ++f)
+	{
+		const FilterCase &filterCase = filters[f];
+		runner.Run(prefix + "filter/" + filterCase.name, [&image, &filterCase](Hasher &hasher)
+		{
+			msaFilters filter;
+			filter.SetType(filterCase.type, filterCase.width, filterCase.height);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+	}
+
+	// the other ways of ranking color pixels
+	struct MedianCase
+	{
+		const char *name;
+		msaFilters::MedianMode mode;
+	};
+	static const MedianCase medians[] =
+	{
+		{ "perchannel", msaFilters::MedianMode::PerChannel },
+		{ "vector", msaFilters::MedianMode::Vector },
+	};
+	for(size_t m = 0; m < sizeof(medians) / sizeof(medians[0]); ++m)
+	{
+		for(int size = 3; size <= 5; size += 2)
+		{
+			const MedianCase &medianCase = medians[m];
+			runner.Run(prefix + "filter/median/" + to_string(size) + "x" + to_string(size) + "/" + medianCase.name,
+					[&image, &medianCase, size](Hasher &hasher)
+			{
+				msaFilters filter;
+				filter.SetType(msaFilters::FilterType::Median, size, size);
+				filter.SetMedianMode(medianCase.mode);
+				msaImage output;
+				filter.FilterImage(image, output);
+				hasher.Add(output);
+			});
+		}
+	}
+
+	// the morphology made of both, by rectangles and by an element whose second pass is turned
+	//  round from its first
+	static const FilterCase compoundFilters[] =
+	{
+		{ "open/5x3", msaFilters::FilterType::Open, 5, 3 },
+		{ "close/5x3", msaFilters::FilterType::Close, 5, 3 },
+		{ "tophat/5x5", msaFilters::FilterType::TopHat, 5, 5 },
+		{ "blackhat/5x5", msaFilters::FilterType::BlackHat, 5, 5 },
+		{ "gradient/3x3", msaFilters::FilterType::Gradient, 3, 3 },
+	};
+	for(size_t f = 0; f < sizeof(compoundFilters) / sizeof(compoundFilters[0]); ++f)
+	{
+		const FilterCase &filterCase = compoundFilters[f];
+		runner.Run(prefix + "filter/" + filterCase.name, [&image, &filterCase](Hasher &hasher)
+		{
+			msaFilters filter;
+			filter.SetType(filterCase.type, filterCase.width, filterCase.height);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+	}
+	runner.Run(prefix + "filter/open/mask4x3", [&image](Hasher &hasher)
+	{
+		static const int mask[12] = { 1, 1, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1 };
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Open, mask, 4, 3, 3, 0);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+
+	// dilate and erode by structuring elements, including an off center one with holes
+	runner.Run(prefix + "filter/dilate/disk7", [&image](Hasher &hasher)
+	{
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Dilate, msaFilters::ElementShape::Disk, 7, 7);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+	runner.Run(prefix + "filter/erode/diamond5", [&image](Hasher &hasher)
+	{
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Erode, msaFilters::ElementShape::Diamond, 5, 5);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+	runner.Run(prefix + "filter/dilate/line9at30", [&image](Hasher &hasher)
+	{
+		msaFilters filter;
+		filter.SetLineElement(msaFilters::FilterType::Dilate, 9, 30.0);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+	runner.Run(prefix + "filter/erode/mask4x3", [&image](Hasher &hasher)
+	{
+		static const int mask[12] = { 1, 1, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1 };
+		msaFilters filter;
+		filter.SetStructuringElement(msaFilters::FilterType::Erode, mask, 4, 3, 3, 0);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+
+	// unsharp masks, with and without a threshold
+	static const double thresholds[] = { 0.0, 8.0 };
+	for(int t = 0; t < 2; ++t)
+	{
+		double threshold = thresholds[t];
+		runner.Run(prefix + "filter/unsharp/r2a1.5t" + to_string((int)threshold), [&image, threshold](Hasher &hasher)
+		{
+			msaFilters filter;
+			filter.SetUnsharpMask(1.5, 2.0, threshold);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+	}
+
+	// bilateral filters by both methods; only 8 bit images have them
+	static const msaFilters::BilateralMethod bilateralMethods[] =
+			{ msaFilters::BilateralMethod::Grid, msaFilters::BilateralMethod::Exact };
+	static const char *bilateralNames[] = { "grid", "exact" };
+	for(int m = 0; m < 2; ++m)
+	{
+		msaFilters::BilateralMethod method = bilateralMethods[m];
+		runner.Run(prefix + "filter/bilateral/" + bilateralNames[m] + "/s2r20", [&image, method](Hasher &hasher)
+		{
+			msaFilters filter;
+			filter.SetBilateral(2.0, 20.0);
+			filter.SetBilateralMethod(method);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+		// sigmas under the grid's smallest cells
+		runner.Run(prefix + "filter/bilateral/" + bilateralNames[m] + "/s0.5r1", [&image, method](Hasher &hasher)
+		{
+			msaFilters filter;
+			filter.SetBilateral(0.5, 1.0);
+			filter.SetBilateralMethod(method);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+	}
+
+	// sigmas larger than the image, where the edges decide everything
+	runner.Run(prefix + "filter/recursivegaussian/sigma60x25", [&image](Hasher &hasher)
+	{
+		msaFilters filter;
+		filter.SetRecursiveGaussian(60.0, 25.0);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+
+	// the recursive Gaussian against the kernel it stands in for, within the 3 levels documented
+	//  for 8 bit samples; SetType sizes from 5 up give sigmas from 1.5 up
+	if(image.BitsPerSample() == 8)
+	{
+		static const int gaussianSizes[][2] = { { 5, 5 }, { 7, 7 }, { 9, 9 }, { 15, 9 }, { 21, 21 }, { 31, 31 },
+				{ 41, 41 } };
+		for(size_t g = 0; g < sizeof(gaussianSizes) / sizeof(gaussianSizes[0]); ++g)
+		{
+			int w = gaussianSizes[g][0];
+			int h = gaussianSizes[g][1];
+			runner.Check(prefix + "filter/recursivegaussian/" + to_string(w) + "x" + to_string(h) + "/bound",
+					[&image, w, h]()
+			{
+				msaFilters filter;
+				msaImage kernel, recursive;
+				filter.SetType(msaFilters::FilterType::Gaussian, w, h);
+				filter.FilterImage(image, kernel);
+				filter.SetType(msaFilters::FilterType::RecursiveGaussian, w, h);
+				filter.FilterImage(image, recursive);
+				if(MaxDifference(kernel, recursive) > 3)
+					throw "more than 3 levels from the Gaussian kernel";
+			});
+		}
+	}
+
+	// an off center, lopsided user kernel
+	runner.Run(prefix + "filter/user/4x3", [&image](Hasher &hasher)
+	{
+		static const int values[12] = { 1, 2, 0, -1, 3, 5, 2, 1, 0, 1, 4, -2 };
+		msaFilters filter;
+		filter.SetUserDefined(values, 4, 3, 1, 2, 16);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+	// the same through FFTs, which has to match exactly
+	runner.Run(prefix + "filter/user/4x3/fft", [&image](Hasher &hasher)
+	{
+		static const int values[12] = { 1, 2, 0, -1, 3, 5, 2, 1, 0, 1, 4, -2 };
+		msaFilters filter;
+		filter.SetUserDefined(values, 4, 3, 1, 2, 16);
+		filter.SetConvolutionMethod(msaFilters::ConvolutionMethod::FFT);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+	// fixed point kernels, with the error reported for them; at 8 bits the Gaussian's sums fit
+	//  16 bits, and the sharpen's don't
+	static const FilterCase fixedFilters[] =
+	{
+		{ "gaussian/5x5", msaFilters::FilterType::Gaussian, 5, 5 },
+		{ "sharpen/5x5", msaFilters::FilterType::Sharpen, 5, 5 },
+	};
+	static const int fixedBits[] = { 14, 8 };
+	for(size_t f = 0; f < sizeof(fixedFilters) / sizeof(fixedFilters[0]); ++f)
+	{
+		for(size_t b = 0; b < sizeof(fixedBits) / sizeof(fixedBits[0]); ++b)
+		{
+			const FilterCase &filterCase = fixedFilters[f];
+			int bits = fixedBits[b];
+			runner.Run(prefix + "filter/" + filterCase.name + "/fixed" + to_string(bits),
+					[&image, &filterCase, bits](Hasher &hasher)
+			{
+				msaFilters filter;
+				filter.SetType(filterCase.type, filterCase.width, filterCase.height);
+				filter.SetFixedPoint(bits);
+				hasher.Add(filter.GetFixedPointError());
+				msaImage output;
+				filter.FilterImage(image, output);
+				hasher.Add(output);
+			});
+		}
+	}
+
+	// and every precision against the kernel's own divisor, within the error reported; the user
+	//  kernel has negative values and a divisor fixed point can't scale exactly
+	if(image.BitsPerSample() == 8)
+	{
+		static const int userValues[9] = { -1, 2, 0, 3, 4, 1, -2, 1, -1 };
+		static const char *kernelNames[] = { "gaussian/5x5", "sharpen/5x5", "user/3x3" };
+		for(int k = 0; k < 3; ++k)
+		{
+			for(int bits = 1; bits <= 14; ++bits)
+			{
+				runner.Check(prefix + "filter/" + kernelNames[k] + "/fixed" + to_string(bits) + "/bound",
+						[&image, k, bits]()
+				{
+					msaFilters filter;
+					if(k == 0)
+						filter.SetType(msaFilters::FilterType::Gaussian, 5, 5);
+					else if(k == 1)
+						filter.SetType(msaFilters::FilterType::Sharpen, 5, 5);
+					else
+						filter.SetUserDefined(userValues, 3, 3, 1, 1, 7);
+					msaImage exact, fixed;
+					filter.FilterImage(image, exact);
+					filter.SetFixedPoint(bits);
+					filter.FilterImage(image, fixed);
+					if(MaxDifference(exact, fixed) > filter.GetFixedPointError())
+						throw "more than GetFixedPointError() from the kernel's own divisor";
+				});
+			}
+		}
+	}
+
+	// a kernel wider than the smaller images, through FFTs
+	runner.Run(prefix + "filter/user/17x13/fft", [&image](Hasher &hasher)
+	{
+		int values[17 * 13];
+		for(int i = 0; i < 17 * 13; ++i)
+			values[i] = (i * 7) % 11 - 3;
+		msaFilters filter;
+		filter.SetUserDefined(values, 17, 13, 8, 6, 0);
+		filter.SetConvolutionMethod(msaFilters::ConvolutionMethod::FFT);
+		msaImage output;
+		filter.FilterImage(image, output);
+		hasher.Add(output);
+	});
+
+	// the other border modes, on a lopsided window and one wider than the smaller images
+	struct BorderCase
+	{
+		const char *name;
+		msaFilters::BorderMode mode;
+	};
+	static const BorderCase borders[] =
+	{
+		{ "reflect", msaFilters::BorderMode::Reflect },
+		{ "wrap", msaFilters::BorderMode::Wrap },
+		{ "constant", msaFilters::BorderMode::Constant },
+	};
+	static const FilterCase borderFilters[] =
+	{
+		{ "gaussian/5x5", msaFilters::FilterType::Gaussian, 5, 5 },
+		{ "dilate/5x3", msaFilters::FilterType::Dilate, 5, 3 },
+		{ "median/5x5", msaFilters::FilterType::Median, 5, 5 },
+		{ "box/19x3", msaFilters::FilterType::Box, 19, 3 },
+	};
+
+	for(size_t b = 0; b < sizeof(borders) / sizeof(borders[0]); ++b)
+	{
+		for(size_t f = 0; f < sizeof(borderFilters) / sizeof(borderFilters[0]); ++f)
+		{
+			const BorderCase &borderCase = borders[b];
+			const FilterCase &filterCase = borderFilters[f];
+			runner.Run(prefix + "filter/" + filterCase.name + "/" + borderCase.name,
+					[&image, &filterCase, &borderCase](Hasher &hasher)
+			{
+				msaFilters filter;
+				filter.SetType(filterCase.type, filterCase.width, filterCase.height);
+				filter.SetBorderMode(borderCase.mode, 100.0);
+				msaImage output;
+				filter.FilterImage(image, output);
+				hasher.Add(output);
+			});
+		}
+
+		runner.Run(prefix + "filter/user/4x3/" + borders[b].name, [&image, b](Hasher &hasher)
+		{
+			static const int values[12] = { 1, 2, 0, -1, 3, 5, 2, 1, 0, 1, 4, -2 };
+			msaFilters filter;
+			filter.SetUserDefined(values, 4, 3, 1, 2, 16);
+			filter.SetBorderMode(borders[b].mode, 100.0);
+			msaImage output;
+			filter.FilterImage(image, output);
+			hasher.Add(output);
+		});
+	}
+}
+
+static void AddEdgeCases(TestRunner &runner, const string &prefix, msaImage &image)
+{
+	// each operator's gradients, and Canny with thresholds scaled to match
+	static const msaEdges::GradientOperator operators[2] =
+			{ msaEdges::GradientOperator::Sobel, msaEdges::GradientOperator::Scharr };
+	static const char *operatorNames[2] = { "sobel", "scharr" };
+	for(int o = 0; o < 2; ++o)
+	{
+		msaEdges::GradientOperator op = operators[o];
+		runner.Run(prefix + "edges/gradients/" + operatorNames[o], [&image, op](Hasher &hasher)
+		{
+			msaEdges edges;
+			edges.SetOperator(op);
+			msaImage gx, gy, magnitude, orientation;
+			edges.Gradients(image, gx, gy, magnitude, orientation);
+			hasher.Add(gx);
+			hasher.Add(gy);
+			hasher.Add(magnitude);
+			hasher.Add(orientation);
+		});
+		double scale = o == 0 ? 1.0 : 4.0;
+		runner.Run(prefix + "edges/canny/" + operatorNames[o], [&image, op, scale](Hasher &hasher)
+		{
+			msaEdges edges;
+			edges.SetOperator(op);
+			msaImage output;
+			edges.Canny(image, output, 40.0 * scale, 100.0 * scale);
+			hasher.Add(output);
+		});
+	}
+}
+
+static void AddPyramidCases(TestRunner &runner, const string &prefix, msaImage &image)
+{
+	runner.Run(prefix + "pyramid/gaussian", [&image](Hasher &hasher)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(image, msaPyramid::PyramidType::Gaussian);
+		for(int level = 0; level < pyramid.Levels(); ++level)
+		{
+			msaImage output;
+			pyramid.Level(level, output);
+			hasher.Add(output);
+		}
+	});
+	runner.Run(prefix + "pyramid/laplacian", [&image](Hasher &hasher)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(image, msaPyramid::PyramidType::Laplacian, 3);
+		for(int level = 0; level < pyramid.Levels(); ++level)
+		{
+			msaImage output;
+			pyramid.Level(level, output);
+			hasher.Add(output);
+		}
+	});
+	// halving the finest details in place, as blending would change the levels
+	runner.Run(prefix + "pyramid/reconstruct", [&image](Hasher &hasher)
+	{
+		msaPyramid pyramid;
+		pyramid.Build(image, msaPyramid::PyramidType::Laplacian);
+		msaImage level;
+		pyramid.Level(0, level);
+		for(int y = 0; y < level.Height(); ++y)
+		{
+			float *p = (float *)(level.Data() + y * level.BytesPerLine());
+			for(int x = 0; x < level.Width() * level.Channels(); ++x)
+				p[x] *= 0.5f;
+		}
+		msaImage output;
+		pyramid.Reconstruct(output);
+		hasher.Add(output);
+	});
+	runner.Run(prefix + "pyramid/expand", [&image](Hasher &hasher)
+	{
+		msaImage reduced, output;
+		msaPyramid::Reduce(image, reduced);
+		msaPyramid::Expand(reduced, image.Width(), image.Height(), output);
+		hasher.Add(output);
+	});
+}
+
+static void AddConvertCases(TestRunner &runner, TestContext &context)
+{
+	msaImage &image = context.image;
+
+	const int depths[] = { 1, 8, 16, 24, 32, 48, 64 };
+	for(size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+	{
+		int newDepth = depths[d];
+		runner.Run("convert/simple/" + to_string(newDepth), [&image, newDepth](Hasher &hasher)
+		{
+			msaPixel color = { 200, 150, 100, 180 };
+			msaImage output;
+			image.SimpleConvert(newDepth, color, output);
+			hasher.Add(output);
+		});
+		runner.Run("convert/fromfloat/" + to_string(newDepth), [&image, newDepth](Hasher &hasher)
+		{
+			msaImage output;
+			image.FromFloat(newDepth, output);
+			hasher.Add(output);
+		});
+	}
+
+	runner.Run("convert/fromfloat/scaled", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.FromFloat(image.Depth() / 4, output, 100.0f);
+		hasher.Add(output);
+	});
+	runner.Run("convert/tofloat", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.ToFloat(output);
+		hasher.Add(output);
+	});
+	runner.Run("convert/tofloat/scaled", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.ToFloat(output, 3.0f);
+		hasher.Add(output);
+	});
+	runner.Run("convert/threshold", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.Threshold(100, output);
+		hasher.Add(output);
+	});
+	runner.Run("convert/threshold/adaptive", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.AdaptiveThreshold(7, 5, 4, output);
+		hasher.Add(output);
+	});
+	runner.Run("convert/threshold/sauvola", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.SauvolaThreshold(9, 9, 0.3, output);
+		hasher.Add(output);
+	});
+	runner.Run("convert/toplanar", [&image](Hasher &hasher)
+	{
+		msaImage output;
+		image.ToPlanar(output);
+		hasher.Add(output);
+	});
+	runner.Run("convert/tointerleaved", [&image](Hasher &hasher)
+	{
+		msaImage planar, output;
+		image.ToPlanar(planar);
+		planar.ToInterleaved(output);
+		hasher.Add(output);
+	});
+	runner.Run("colormap", [&image](Hasher &hasher)
+	{
+		msaPixel map[256];
+		for(int i = 0; i < 256; ++i)
+		{
+			map[i].r = (unsigned char)i;
+			map[i].g = (unsigned char)(255 - i);
+			map[i].b = (unsigned char)(i * 3);
+			map[i].a = 255;
+		}
+		msaImage output;
+		image.ColorMap(map, output);
+		hasher.Add(output);
+	});
+	runner.Run("remapbrightness", [&image](Hasher &hasher)
+	{
+		unsigned char map[256];
+		for(int i = 0; i < 256; ++i)
+			map[i] = (unsigned char)(i * i / 255);
+		msaImage output;
+		image.RemapBrightness(map, output);
+		hasher.Add(output);
+	});
+	runner.Run("addalpha", [&context](Hasher &hasher)
+	{
+		msaImage output;
+		context.image.AddAlphaChannel(context.gray, output);
+		hasher.Add(output);
+	});
+}
+
+static void AddSplitCases(TestRunner &runner, TestContext &context)
+{
+	msaImage &image = context.image;
+
+	runner.Run("split/rgb", [&image](Hasher &hasher)
+	{
+		msaImage r, g, b;
+		image.SplitRGB(r, g, b);
+		hasher.Add(r);
+		hasher.Add(g);
+		hasher.Add(b);
+	});
+	runner.Run("split/rgba", [&image](Hasher &hasher)
+	{
+		msaImage r, g, b, a;
+		image.SplitRGBA(r, g, b, a);
+		hasher.Add(r);
+		hasher.Add(g);
+		hasher.Add(b);
+		hasher.Add(a);
+	});
+	runner.Run("split/hsv", [&image](Hasher &hasher)
+	{
+		msaImage h, s, v;
+		image.SplitHSV(h, s, v);
+		hasher.Add(h);
+		hasher.Add(s);
+		hasher.Add(v);
+	});
+	runner.Run("split/hsva", [&image](Hasher &hasher)
+	{
+		msaImage h, s, v, a;
+		image.SplitHSVA(h, s, v, a);
+		hasher.Add(h);
+		hasher.Add(s);
+		hasher.Add(v);
+		hasher.Add(a);
+	});
+}
+
+// the compose functions only take 8 bit planes, so they don't depend on the depth under test
+static void AddComposeCases(TestRunner &runner, TestContext &context)
+{
+	runner.Run("compose/rgb", [&context](Hasher &hasher)
+	{
+		msaImage output;
+		output.ComposeRGB(context.gray, context.gray2, context.gray3);
+		hasher.Add(output);
+	});
+	runner.Run("compose/rgba", [&context](Hasher &hasher)
+	{
+		msaImage output;
+		output.ComposeRGBA(context.gray, context.gray2, context.gray3, context.gray4);
+		hasher.Add(output);
+	});
+	runner.Run("compose/hsv", [&context](Hasher &hasher)
+	{
+		msaImage output;
+		output.ComposeHSV(context.gray, context.gray2, context.gray3);
+		hasher.Add(output);
+	});
+	runner.Run("compose/hsva", [&context](Hasher &hasher)
+	{
+		msaImage output;
+		output.ComposeHSVA(context.gray, context.gray2, context.gray3, context.gray4);
+		hasher.Add(output);
+	});
+	runner.Run("create/fill", [&context](Hasher &hasher)
+	{
+		const int depths[] = { 1, 8, 16, 24, 32, 48, 64 };
+		msaPixel fill = { 200, 150, 100, 180 };
+		for(size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+		{
+			msaImage output;
+			output.CreateImage(context.size.width, context.size.height, depths[d], fill);
+			hasher.Add(output);
+		}
+	});
+}
+
+static void AddCombineCases(TestRunner &runner, TestContext &context)
+{
+	typedef void (msaImage::*CombineFunction)(msaImage &, msaImage &);
+	struct CombineCase
+	{
+		const char *name;
+		CombineFunction function;
+	};
+	static const CombineCase combines[] =
+	{
+		{ "min", &msaImage::MinImages },
+		{ "max", &msaImage::MaxImages },
+		{ "sum", &msaImage::SumImages },
+		{ "diff", &msaImage::DiffImages },
+		{ "multiply", &msaImage::MultiplyImages },
+		{ "divide", &msaImage::DivideImages },
+	};
+
+	for(size_t c = 0; c < sizeof(combines) / sizeof(combines[0]); ++c)
+	{
+		CombineFunction function = combines[c].function;
+		runner.Run(string("combine/") + combines[c].name, [&context, function](Hasher &hasher)
+		{
+			msaImage output;
+			(context.image.*function)(context.other, output);
+			hasher.Add(output);
+		});
+	}
+}
+
+static void AddOverlayCases(TestRunner &runner, TestContext &context)
+{
+	// overlays go into the middle of a copy of the image
+	int w = context.size.width - 6;
+	int h = context.size.height - 4;
+
+	runner.Run("overlay", [&context, w, h](Hasher &hasher)
+	{
+		msaImage base, overlay;
+		MakeImage(base, context.size, context.depthName, 3);
+		MakeImage(overlay, { w, h, 0 }, context.depthName, 4);
+		base.OverlayImage(overlay, 3, 2, w, h);
+		hasher.Add(base);
+	});
+
+	const int maskDepths[] = { 8, 24, 32 };
+	for(int m = 0; m < 3; ++m)
+	{
+		int maskDepth = maskDepths[m];
+		runner.Run("overlay/mask" + to_string(maskDepth), [&context, w, h, maskDepth](Hasher &hasher)
+		{
+			msaImage base, overlay, mask;
+			MakeImage(base, context.size, context.depthName, 3);
+			MakeImage(overlay, { w, h, 0 }, context.depthName, 4);
+			FillSynthetic(mask, w, h, maskDepth, 5);
+			base.OverlayImage(overlay, mask, 3, 2, w, h);
+			hasher.Add(base);
+		});
+	}
+}
+
+static bool LoadGolden(const char *filename, map<string, string> &golden)
+{
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL)
+		return false;
+
+	char line[512];
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		char name[400], result[100];
+		if(line[0] == '#' || sscanf(line, "%399s %99s", name, result) != 2)
+			continue;
+		golden[name] = result;
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool SaveGolden(const char *filename, vector<pair<string, string> > &results)
+{
+	FILE *fp = fopen(filename, "w");
+	if(fp == NULL)
+		return false;
+
+	fprintf(fp, "# golden hashes for imgregress, regenerate with imgregress --update\n");
+	for(size_t i = 0; i < results.size(); ++i)
+		fprintf(fp, "%s %s\n", results[i].first.c_str(), results[i].second.c_str());
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *goldenFile = "regress.golden";
+	bool update = false;
+	TestRunner runner;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "--update") == 0)
+			update = true;
+		else if(strcmp(argv[i], "--verbose") == 0)
+			runner.verbose = true;
+		else if(strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+			goldenFile = argv[++i];
+		else
+		{
+			printf("usage: imgregress [--update] [--golden file] [--verbose]\n");
+			return -1;
+		}
+	}
+
+	if(!update && !LoadGolden(goldenFile, runner.golden))
+	{
+		printf("Cannot open %s, run with --update to create it\n", goldenFile);
+		return -1;
+	}
+
+	// while updating there's nothing to compare against, so stay quiet
+	if(update)
+		freopen("/dev/null", "w", stdout);
+
+	for(size_t s = 0; s < sizeof(testSizes) / sizeof(testSizes[0]); ++s)
+	{
+		const TestSize &size = testSizes[s];
+		char sizeName[64];
+		snprintf(sizeName, sizeof(sizeName), "%dx%d+%d/", size.width, size.height, size.padding);
+
+		TestContext context;
+		context.size = size;
+		FillSynthetic(context.gray, size.width, size.height, 8, 11);
+		FillSynthetic(context.gray2, size.width, size.height, 8, 12);
+		FillSynthetic(context.gray3, size.width, size.height, 8, 13);
+		FillSynthetic(context.gray4, size.width, size.height, 8, 14);
+		PadStride(context.gray, size.padding);
+
+		for(size_t d = 0; d < sizeof(testDepths) / sizeof(testDepths[0]); ++d)
+		{
+			context.depthName = testDepths[d];
+			MakeImage(context.image, size, context.depthName, 1);
+			MakeImage(context.other, size, context.depthName, 2);
+
+			runner.prefix = string(sizeName) + context.depthName + "/";
+
+			AddTransformCases(runner, "", context.image);
+			AddFilterCases(runner, "", context.image);
+			AddEdgeCases(runner, "", context.image);
+			AddPyramidCases(runner, "", context.image);
+			AddConvertCases(runner, context);
+			AddSplitCases(runner, context);
+			AddCombineCases(runner, context);
+			AddOverlayCases(runner, context);
+			if(d == 0)
+				AddComposeCases(runner, context);
+
+			// planar images go through their own per plane paths
+			msaImage planar;
+			bool hasPlanar = true;
+			try
+			{
+				context.image.ToPlanar(planar);
+			}
+			catch(const char *)
+			{
+				hasPlanar = false;
+			}
+			if(hasPlanar && planar.Channels() > 1)
+			{
+				AddTransformCases(runner, "planar/", planar);
+				AddFilterCases(runner, "planar/", planar);
+				AddEdgeCases(runner, "planar/", planar);
+				AddPyramidCases(runner, "planar/", planar);
+			}
+		}
+	}
+
+	if(update)
+	{
+		if(!SaveGolden(goldenFile, runner.results))
+		{
+			fprintf(stderr, "Cannot write %s\n", goldenFile);
+			return -1;
+		}
+		fprintf(stderr, "Wrote %d cases to %s\n", (int)runner.results.size(), goldenFile);
+		if(runner.checkFailures != 0)
+		{
+			fprintf(stderr, "%d of %d checks failed\n", runner.checkFailures, runner.checks);
+			return 1;
+		}
+		return 0;
+	}
+
+	// cases in the golden file that no longer run are failures too
+	map<string, string> ran(runner.results.begin(), runner.results.end());
+	for(map<string, string>::iterator it = runner.golden.begin(); it != runner.golden.end(); ++it)
+	{
+		if(ran.find(it->first) == ran.end())
+		{
+			printf("GONE  %s\n", it->first.c_str());
+			++runner.failures;
+		}
+	}
+
+	runner.failures += runner.checkFailures;
+	printf("%d cases and %d checks, %d failed\n", (int)runner.results.size(), runner.checks, runner.failures);
+	return runner.failures == 0 ? 0 : 1;
+}